@@ -15,7 +15,7 @@ parser.add_argument(
     help='the binning to use on the detector, and how many projections to skip'
 )
 parser.add_argument(
-    '--host', default="localhost", help='the projection server host')
+    '--host', default="localhost", help='the projection server host (or shm://name)')
 parser.add_argument(
     '--port', type=int, default=5558, help='the projection server port')
 
@@ -23,15 +23,20 @@ parser.add_argument(
     '--skipgeometry',
     action='store_true',
     help='assume the geometry packet is already sent')
+parser.add_argument(
+    '--dtype',
+    default='uint16',
+    help='the pixel type to read (and send) the data in')
 args = parser.parse_args()
 
 sample = args.sample
 print("sample", sample)
 path = args.path
 
-dark = data.read_stack(path, 'di00', sample = sample)
-flat = data.read_stack(path, 'io00', sample = sample)    
-proj = data.read_stack(path, 'scan_', skip = sample, sample = sample)
+dark = data.read_stack(path, 'di00', sample = sample, dtype = args.dtype)
+flat = data.read_stack(path, 'io00', sample = sample, dtype = args.dtype)
+proj = data.read_stack(path, 'scan_', skip = sample, sample = sample,
+                       dtype = args.dtype)
 
 print(np.shape(dark), np.shape(flat), np.shape(proj))
 
@@ -80,16 +85,13 @@ if not args.skipgeometry:
 # send darks (0), lights (1), projs (2)
 
 for i in np.arange(0, dark.shape[1]):
-    packet_dark = tomop.projection_packet(
-        0, i, [rows, cols], np.ascontiguousarray(dark[:, i, :].flatten()))
+    packet_dark = tomop.native_projection_packet(0, i, dark[:, i, :])
     pub.send(packet_dark)
 
 for i in np.arange(0, flat.shape[1]):
-    packet_light = tomop.projection_packet(
-        1, i, [rows, cols], np.ascontiguousarray(flat[:, i, :].flatten()))
+    packet_light = tomop.native_projection_packet(1, i, flat[:, i, :])
     pub.send(packet_light)
 
 for i in np.arange(0, proj_count):
-    packet_proj = tomop.projection_packet(
-            2, i, [rows, cols], np.ascontiguousarray(proj[:, i, :].flatten()))
+    packet_proj = tomop.native_projection_packet(2, i, proj[:, i, :])
     pub.send(packet_proj)
@@ -74,7 +74,7 @@ if __name__ == "__main__":
         description='Push a hdf5 data set to SliceRecon.')
     parser.add_argument('path', metavar='path', help='path to the data')
     parser.add_argument(
-        '--host', default="localhost", help='the projection server host')
+        '--host', default="localhost", help='the projection server host (or shm://name)')
     parser.add_argument(
         '--port', type=int, default=5558, help='the projection server port')
     parser.add_argument('--offset', type=int, default=0, help='offset')
@@ -106,17 +106,13 @@ if __name__ == "__main__":
         tp.parallel_beam_geometry_packet(0, rows, cols, args.projs, angles))
 
     for i in range(hdf5Reader.numberOfDarks):
-        packet_dark = tp.projection_packet(
-            0, i, [rows, cols],
-            np.ascontiguousarray(hdf5Reader.getDarkImage(i).flatten()))
+        packet_dark = tp.native_projection_packet(0, i, hdf5Reader.getDarkImage(i))
         pub.send(packet_dark)
         print("sent dark", i)
         time.sleep(args.time)
 
     for i in range(hdf5Reader.totalNumberOfFlats // 2):
-        packet_flat = tp.projection_packet(
-            1, i, [rows, cols],
-            np.ascontiguousarray(hdf5Reader.getFlatImage(i).flatten()))
+        packet_flat = tp.native_projection_packet(1, i, hdf5Reader.getFlatImage(i))
         pub.send(packet_flat)
         print("sent flat", i)
         time.sleep(args.time)
@@ -124,9 +120,7 @@ if __name__ == "__main__":
     for i in range(
             args.offset, args.offset + args.count
             if args.count > 0 else hdf5Reader.numberOfProjections):
-        packet_raw = tp.projection_packet(
-            2, i, [rows, cols],
-            np.ascontiguousarray(hdf5Reader.getRawImage(i).flatten()))
+        packet_raw = tp.native_projection_packet(2, i, hdf5Reader.getRawImage(i))
         pub.send(packet_raw)
         print("sent proj", i)
         time.sleep(args.time)
@@ -79,9 +79,13 @@ def main(arg):
     parser.add_argument('--binning', nargs='?', type=int, default=1, help="binning factor")
     parser.add_argument('--sample', type=int, default=1,
                         help='the binning to use on the detector, and how many projections to skip')
-    parser.add_argument('--host', default="localhost", help='the projection server host')
+    parser.add_argument('--host', default="localhost", help='the projection server host (or shm://name)')
     parser.add_argument('--port', type=int, default=5558, help='the projection server port')
+    parser.add_argument('--compress', action='store_true',
+                        help='compress the projections (the server has to support it)')
     parser.add_argument('--skipgeometry', action='store_true', help='assume the geometry packet is already sent')
+    parser.add_argument('--batch', type=int, default=32,
+                        help='the number of projections to read, and send, at once')
     args = parser.parse_args()
 
     fname = args.fname
@@ -136,6 +140,8 @@ def main(arg):
     rz = np.ceil(data_size[1] / 2)  # max radius in the z axis
 
     pub = tp.publisher(args.host, args.port)
+    if args.compress:
+        pub.set_compression(tp.codec.shuffle_lz)
 
     if not args.skipgeometry:
         window_min_point = [-rx, -rx, -rz]  # x,y,z
@@ -162,10 +168,14 @@ def main(arg):
     exchange_base = "exchange"
     tomo_grp = '/'.join([exchange_base, 'data'])
 
+    # The projections are small, so they are sent in batches to save the overhead of sending every projection in its
+    # own message
     j = 0
-    for i in np.arange(1, data_size[0], subsampling):
-        print("Pushing ", i, " of ", data_size[0])
-        data = dxreader.read_hdf5(fname, tomo_grp, slc=((int(i),int(i)+1), sino))
+    indices = np.arange(1, data_size[0], subsampling)
+    for start in range(0, len(indices), args.batch):
+        batch = indices[start:start + args.batch]
+        print("Pushing ", batch[0], "-", batch[-1], " of ", data_size[0])
+        data = dxreader.read_hdf5(fname, tomo_grp, slc=((int(batch[0]), int(batch[-1]) + 1, subsampling), sino))
 
         # Flat-field correction of raw data.
         data = tomopy.normalize(data, flat, dark)
@@ -180,8 +190,10 @@ def main(arg):
         # data[np.where(data == np.inf)] = 0.00
 
         packet_type = 2 # projection packet
-        pub.send(tp.projection_packet(packet_type, j, [rows, cols], np.ascontiguousarray(data[0].flatten())))
-        j = j+1
+        data = np.ascontiguousarray(data, dtype=np.float32)
+        pub.send(tp.projection_batch_packet(packet_type, j, 1, len(batch), [rows, cols], int(tp.dtype.f32),
+                                            data.view(np.uint8).ravel()))
+        j = j + len(batch)
 
 
         # Here is a validation FBP-gridrec reconstruction, locally with TomoPy. 
@@ -8,6 +8,8 @@
 
 #include <glm/glm.hpp>
 
+#include "tomop/tomop.hpp"
+
 #include "graphics/scene_object.hpp"
 #include "graphics/shader_program.hpp"
 #include "graphics/slice.hpp"
@@ -46,14 +48,14 @@ class ReconstructionComponent : public ObjectComponent {
     void draw(glm::mat4 world_to_screen) override;
     void describe() override;
 
-    void set_data(std::vector<float>& data, std::array<int32_t, 2> size,
+    void set_data(tomop::array_view<float> data, std::array<int32_t, 2> size,
                   int slice, bool additive = true);
     void update_partial_slice(std::vector<float>& data,
                               std::array<int32_t, 2> offset,
                               std::array<int32_t, 2> size,
                               std::array<int32_t, 2> global_size, int slice,
                               bool additive = true);
-    void set_volume_data(std::vector<float>& data,
+    void set_volume_data(tomop::array_view<float> data,
                          std::array<int32_t, 3>& volume_size);
     void update_partial_volume(std::vector<float>& data,
                                std::array<int32_t, 3>& offset,
@@ -18,7 +18,7 @@ struct slice {
 
     std::vector<float> data;
 
-    void add_data(std::vector<float> other) {
+    void add_data(const float* other) {
         for (auto i = 0u; i < data.size(); ++i) {
             data[i] += other[i];
         }
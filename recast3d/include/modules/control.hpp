@@ -18,40 +18,40 @@ using namespace tomop;
 // Module for analysis, benchmarking and control
 class ControlProtocol : public SceneModuleProtocol {
   public:
-    std::unique_ptr<Packet> read_packet(packet_desc desc, memory_buffer& buffer,
-                                        zmq::socket_t& socket,
-                                        SceneList& /* scenes */) override {
+    std::unique_ptr<Packet>
+    read_packet(packet_desc desc, multipart_message& message,
+                zmq::socket_t& socket, SceneList& /* scenes */) override {
         switch (desc) {
         case packet_desc::parameter_bool: {
             auto packet = std::make_unique<ParameterBoolPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
             return packet;
         }
         case packet_desc::parameter_float: {
             auto packet = std::make_unique<ParameterFloatPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
 
             return packet;
         }
         case packet_desc::parameter_enum: {
             auto packet = std::make_unique<ParameterEnumPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
 
             return packet;
         }
         case packet_desc::tracker: {
             auto packet = std::make_unique<TrackerPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
 
             return packet;
         }
         case packet_desc::benchmark: {
             auto packet = std::make_unique<BenchmarkPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
 
             return packet;
@@ -20,27 +20,27 @@ using namespace tomop;
 
 class GeometryProtocol : public SceneModuleProtocol {
   public:
-    std::unique_ptr<Packet> read_packet(packet_desc desc, memory_buffer& buffer,
-                                        zmq::socket_t& socket,
-                                        SceneList& /* scenes_ */) override {
+    std::unique_ptr<Packet>
+    read_packet(packet_desc desc, multipart_message& message,
+                zmq::socket_t& socket, SceneList& /* scenes_ */) override {
         switch (desc) {
         case packet_desc::geometry_specification: {
             auto packet = std::make_unique<GeometrySpecificationPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
             return packet;
         }
 
         case packet_desc::projection_data: {
             auto packet = std::make_unique<ProjectionDataPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
             return packet;
         }
 
         case packet_desc::partial_projection_data: {
             auto packet = std::make_unique<PartialProjectionDataPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
             return packet;
         }
@@ -17,13 +17,13 @@ using namespace tomop;
 
 class PartitioningProtocol : public SceneModuleProtocol {
   public:
-    std::unique_ptr<Packet> read_packet(packet_desc desc, memory_buffer& buffer,
-                                        zmq::socket_t& socket,
-                                        SceneList& /* scenes_ */) override {
+    std::unique_ptr<Packet>
+    read_packet(packet_desc desc, multipart_message& message,
+                zmq::socket_t& socket, SceneList& /* scenes_ */) override {
         switch (desc) {
         case packet_desc::set_part: {
             auto packet = std::make_unique<SetPartPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
             return packet;
         }
@@ -21,40 +21,35 @@ using namespace tomop;
 class ReconstructionProtocol : public SceneModuleProtocol {
   public:
     std::unique_ptr<tomop::Packet>
-    read_packet(tomop::packet_desc desc, memory_buffer& buffer,
+    read_packet(tomop::packet_desc desc, multipart_message& message,
                 zmq::socket_t& socket, SceneList& /* scenes_ */) override {
         switch (desc) {
         case packet_desc::slice_data: {
-            auto packet = std::make_unique<SliceDataPacket>();
-            packet->deserialize(std::move(buffer));
-            message_succes(socket);
-            return packet;
+            // the slice is read straight from the message
+            return read_view_<SliceDataPacket>(message, socket);
         }
 
         case packet_desc::partial_slice_data: {
             auto packet = std::make_unique<PartialSliceDataPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
             return packet;
         }
 
         case packet_desc::volume_data: {
-            auto packet = std::make_unique<VolumeDataPacket>();
-            packet->deserialize(std::move(buffer));
-            message_succes(socket);
-            return packet;
+            return read_view_<VolumeDataPacket>(message, socket);
         }
 
         case packet_desc::partial_volume_data: {
             auto packet = std::make_unique<PartialVolumeDataPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
             return packet;
         }
 
         case packet_desc::group_request_slices: {
             auto packet = std::make_unique<GroupRequestSlicesPacket>();
-            packet->deserialize(std::move(buffer));
+            packet->deserialize(message);
             message_succes(socket);
             return packet;
         }
@@ -67,7 +62,8 @@ class ReconstructionProtocol : public SceneModuleProtocol {
                  std::unique_ptr<Packet> event_packet) override {
         switch (desc) {
         case packet_desc::slice_data: {
-            SliceDataPacket& packet = *(SliceDataPacket*)event_packet.get();
+            auto& packet =
+                *(packet_view<SliceDataPacket>*)event_packet.get();
             auto scene = scenes.get_scene(packet.scene_id);
             if (!scene) {
                 std::cout << "Updating non-existing scene\n";
@@ -75,8 +71,9 @@ class ReconstructionProtocol : public SceneModuleProtocol {
             auto& reconstruction_component =
                 (ReconstructionComponent&)scene->object().get_component(
                     "reconstruction");
-            reconstruction_component.set_data(packet.data, packet.slice_size,
-                                              packet.slice_id, packet.additive);
+            reconstruction_component.set_data(
+                packet.array(&SliceDataPacket::data), packet.slice_size,
+                packet.slice_id, packet.additive);
             break;
         }
 
@@ -97,7 +94,8 @@ class ReconstructionProtocol : public SceneModuleProtocol {
         }
 
         case packet_desc::volume_data: {
-            VolumeDataPacket& packet = *(VolumeDataPacket*)event_packet.get();
+            auto& packet =
+                *(packet_view<VolumeDataPacket>*)event_packet.get();
             auto scene = scenes.get_scene(packet.scene_id);
             if (!scene) {
                 std::cout << "Updating non-existing scene\n";
@@ -105,8 +103,8 @@ class ReconstructionProtocol : public SceneModuleProtocol {
             auto& reconstruction_component =
                 (ReconstructionComponent&)scene->object().get_component(
                     "reconstruction");
-            reconstruction_component.set_volume_data(packet.data,
-                                                     packet.volume_size);
+            reconstruction_component.set_volume_data(
+                packet.array(&VolumeDataPacket::data), packet.volume_size);
             break;
         }
 
@@ -173,6 +171,21 @@ class ReconstructionProtocol : public SceneModuleProtocol {
     }
 
   private:
+    // a packet whose arrays do not fit in its message is dropped, but the
+    // sender is still answered so that the socket can carry on
+    template <typename P>
+    std::unique_ptr<tomop::Packet> read_view_(multipart_message& message,
+                                              zmq::socket_t& socket) {
+        auto packet = std::unique_ptr<tomop::Packet>();
+        try {
+            packet = std::make_unique<packet_view<P>>(std::move(message));
+        } catch (const tomop::server_error& e) {
+            std::cout << "Dropping malformed packet: " << e.what() << "\n";
+        }
+        message_succes(socket);
+        return packet;
+    }
+
     int group_size_count_ = -1;
     int group_size_requested_ = -1;
 };
@@ -21,19 +21,23 @@ namespace tomovis {
 
 class ManageSceneProtocol : public SceneModuleProtocol {
   public:
-    std::unique_ptr<Packet> read_packet(packet_desc desc, memory_buffer& buffer,
-                                        zmq::socket_t& socket,
-                                        SceneList& scenes_) override {
+    std::unique_ptr<Packet>
+    read_packet(packet_desc desc, multipart_message& message,
+                zmq::socket_t& socket, SceneList& scenes_) override {
         switch (desc) {
         case packet_desc::make_scene: {
-            zmq::message_t reply(sizeof(int));
+            zmq::message_t reply(2 * sizeof(int32_t));
 
             auto packet = std::make_unique<MakeScenePacket>();
-            packet->deserialize(std::move(buffer));
-
-            // reserve id from scenes_ and return it
-            auto scene_id = scenes_.reserve_id();
-            memcpy(reply.data(), &scene_id, sizeof(int));
+            packet->deserialize(message);
+
+            // reserve id from scenes_ and return it, followed by what we
+            // support (received packets are decompressed when they are read)
+            int32_t scene_id = scenes_.reserve_id();
+            int32_t capabilities = capability_compression;
+            memcpy(reply.data(), &scene_id, sizeof(int32_t));
+            memcpy((char*)reply.data() + sizeof(int32_t), &capabilities,
+                   sizeof(int32_t));
             socket.send(reply);
 
             packet->dimension = scene_id;
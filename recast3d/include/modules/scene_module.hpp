@@ -18,7 +18,7 @@ using namespace tomop;
 class SceneModuleProtocol {
    public:
     virtual std::unique_ptr<tomop::Packet> read_packet(tomop::packet_desc desc,
-                                                memory_buffer& buffer,
+                                                multipart_message& message,
                                                 zmq::socket_t& socket,
                                                 SceneList& scenes_) = 0;
     virtual void process(SceneList& scenes, packet_desc desc,
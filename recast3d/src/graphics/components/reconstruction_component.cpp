@@ -122,9 +122,15 @@ void ReconstructionComponent::send_slices() {
     }
 }
 
-void ReconstructionComponent::set_data(std::vector<float>& data,
+void ReconstructionComponent::set_data(tomop::array_view<float> data,
                                        std::array<int32_t, 2> size, int slice_idx,
                                        bool additive) {
+    if (data.empty() || data.size() != (size_t)size[0] * size[1]) {
+        std::cout << "Slice data does not match its size: " << slice_idx
+                  << "\n";
+        return;
+    }
+
     slice* s = nullptr;
     if (slices_.find(slice_idx) != slices_.end()) {
         s = slices_[slice_idx].get();
@@ -141,10 +147,10 @@ void ReconstructionComponent::set_data(std::vector<float>& data,
 
     if (!additive || !s->has_data()) {
         s->size = size;
-        s->data = data;
+        s->data.assign(data.begin(), data.end());
     } else {
         assert(s->size == size);
-        s->add_data(data);
+        s->add_data(data.data());
     }
 
     s->min_value = *std::min_element(s->data.begin(),
@@ -183,11 +189,11 @@ void ReconstructionComponent::update_partial_slice(
 }
 
 void ReconstructionComponent::set_volume_data(
-    std::vector<float>& data, std::array<int32_t, 3>& volume_size) {
-    volume_data_ = data;
+    tomop::array_view<float> data, std::array<int32_t, 3>& volume_size) {
+    volume_data_.assign(data.begin(), data.end());
     volume_texture_.set_data(volume_size[0], volume_size[1], volume_size[2],
-                             data);
-    update_histogram(data);
+                             volume_data_);
+    update_histogram(volume_data_);
 }
 
 void ReconstructionComponent::update_partial_volume(
@@ -35,12 +35,11 @@ void Server::start() {
         socket.bind("tcp://*:5555");
 
         while (true) {
-            zmq::message_t request;
+            multipart_message request;
 
             //  Wait for next request from client
-            socket.recv(&request);
-            auto desc = ((packet_desc*)request.data())[0];
-            auto buffer = memory_buffer(request.size(), (char*)request.data());
+            request.recv(socket);
+            auto desc = request.desc();
 
             if (modules_.find(desc) == modules_.end()) {
                 std::cout << "Unsupported package descriptor: "
@@ -49,9 +48,12 @@ void Server::start() {
                 continue;
             }
 
-            // forward the packet to the handler
-            packets_.push({desc, std::move(modules_[desc]->read_packet(
-                                     desc, buffer, socket, scenes_))});
+            // forward the packet to the handler, unless it could not be read
+            auto packet =
+                modules_[desc]->read_packet(desc, request, socket, scenes_);
+            if (packet) {
+                packets_.push({desc, std::move(packet)});
+            }
         }
     });
 
@@ -0,0 +1,57 @@
+#include <iostream>
+
+#include "flags/flags.hpp"
+
+#include "harness.hpp"
+
+using namespace slicerecon;
+
+/**
+ * Compares reconstructing a horizontal parallel beam slice by Fourier
+ * gridding (on the CPU) against backprojecting it, for slices of
+ * `--min-size` up to `--max-size` pixels (doubling), from as many detector
+ * columns. The slices are backprojected on the CPU, or with `--backend gpu`
+ * on the GPU (with ASTRA). The relative (RMS) difference between the two is
+ * reported as well.
+ */
+int main(int argc, char** argv)
+{
+    auto opts = flags::flags{argc, argv};
+    opts.info(argv[0], "benchmark of the gridding of horizontal slices");
+
+    auto min_size = opts.arg_as_or<int32_t>("--min-size", 512);
+    auto max_size = opts.arg_as_or<int32_t>("--max-size", 4096);
+    auto count = opts.arg_as_or<int32_t>("--projections", 1024);
+    auto rows = opts.arg_as_or<int32_t>("--rows", 4);
+    auto repeats = opts.arg_as_or<int32_t>("--repeats", 3);
+    auto backend = opts.arg_or("--backend", "cpu");
+
+    if (opts.passed("-h") || !opts.sane() || min_size <= 0 ||
+        (backend != "cpu" && backend != "gpu")) {
+        std::cout << opts.usage();
+        return opts.passed("-h") ? 0 : -1;
+    }
+
+    for (auto n = min_size; n <= max_size; n *= 2) {
+        auto geom = harness::parallel_geometry(rows, n, count);
+        auto sino = harness::noise_sinogram(geom, 0.8f);
+        auto x = orientation{2.0f, 0.0f, 0.0f, 0.0f, 2.0f, 0.0f,
+                             -1.0f, -1.0f, 0.0f};
+
+        auto params = harness::slice_settings(n, backend);
+        auto [bp_ms, bp] = harness::time_slice(params, geom, sino, x, repeats);
+
+        params = harness::slice_settings(n, "cpu");
+        params.gridrec = true;
+        auto [gridrec_ms, gridded] =
+            harness::time_slice(params, geom, sino, x, repeats);
+
+        std::cout << n << " x " << n << " (" << count
+                  << " projections): " << backend << " backprojection "
+                  << bp_ms << " ms, gridrec " << gridrec_ms << " ms ("
+                  << bp_ms / gridrec_ms << "x), difference "
+                  << harness::relative_difference(gridded, bp) << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bulk/bulk.hpp"
+
+#include "slicerecon/reconstruction/reconstructor.hpp"
+
+/**
+ * What the slice benchmarks have in common: a parallel beam scan of random
+ * data, a solver on either backend to reconstruct slices from it, and the
+ * comparison of a faster method against backprojecting the slice directly.
+ */
+namespace slicerecon::harness {
+
+/** The shortest time (in ms) of `repeats` runs of `f`. */
+template <typename F>
+double best(int repeats, F&& f) {
+    auto result = 0.0;
+    for (int r = 0; r < repeats; ++r) {
+        auto dt = bulk::util::timer();
+        f();
+        auto ms = dt.get();
+        result = (r == 0) ? ms : std::min(result, ms);
+    }
+    return result;
+}
+
+/**
+ * `count` parallel beam projections over half a turn, onto a detector of
+ * `rows x cols`, of a volume that fills the detector.
+ */
+inline acquisition::geometry parallel_geometry(int32_t rows, int32_t cols,
+                                               int32_t count) {
+    auto geom = acquisition::geometry{};
+    geom.rows = rows;
+    geom.cols = cols;
+    geom.proj_count = count;
+    geom.parallel = true;
+    for (int i = 0; i < count; ++i) {
+        geom.angles.push_back((float)M_PI * i / count);
+    }
+    geom.volume_min_point = {-0.5f * cols, -0.5f * cols, -0.5f * rows};
+    geom.volume_max_point = {0.5f * cols, 0.5f * cols, 0.5f * rows};
+    return geom;
+}
+
+/**
+ * A random sinogram for `geom`, laid out as `[rows][projections][cols]`,
+ * smoothed by averaging every value with `smoothing` times the previous one.
+ */
+inline std::vector<float> noise_sinogram(const acquisition::geometry& geom,
+                                         float smoothing) {
+    auto gen = std::mt19937(1);
+    auto noise = std::uniform_real_distribution<float>(-1.0f, 1.0f);
+
+    auto sino =
+        std::vector<float>((size_t)geom.rows * geom.proj_count * geom.cols);
+    auto previous = 0.0f;
+    for (auto& x : sino) {
+        x = previous = smoothing * previous + (1.0f - smoothing) * noise(gen);
+    }
+    return sino;
+}
+
+/**
+ * The settings for slices of `n x n` pixels on `backend` (`cpu` or `gpu`),
+ * which are backprojected directly.
+ */
+inline settings slice_settings(int32_t n, const std::string& backend) {
+    auto params = settings{n, 1, 1, 1, 1, 1, mode::continuous, false,
+                           false, false, {}, false, "shepp-logan"};
+    params.fftw_planner = planner_effort::estimate;
+    params.backend =
+        backend == "gpu" ? solver_backend::gpu : solver_backend::cpu;
+    params.gridrec = false;
+    params.hierarchical_tolerance = 0.0f;
+    return params;
+}
+
+/**
+ * The time (in ms) to reconstruct the slice `x` from `sino`, with a parallel
+ * beam solver for `params`, and the slice.
+ */
+inline std::pair<double, std::vector<float>>
+time_slice(const settings& params, const acquisition::geometry& geom,
+           std::vector<float>& sino, orientation x, int repeats) {
+    auto solver = std::unique_ptr<detail::solver>();
+    if (params.backend == solver_backend::gpu) {
+        solver = std::make_unique<detail::parallel_beam_solver>(params, geom);
+    } else {
+        solver =
+            std::make_unique<detail::cpu_parallel_beam_solver>(params, geom);
+    }
+    solver->upload(0, sino.data(), 0, geom.proj_count - 1);
+
+    auto result = slice_data{};
+    auto ms = best(repeats, [&] { result = solver->reconstruct_slice(x, 0); });
+    return {ms, std::move(result.second)};
+}
+
+/** The relative (RMS) difference between `x` and `reference`. */
+inline double relative_difference(const std::vector<float>& x,
+                                  const std::vector<float>& reference) {
+    auto difference = 0.0;
+    auto norm = 0.0;
+    for (size_t i = 0; i < reference.size(); ++i) {
+        difference += (x[i] - reference[i]) * (x[i] - reference[i]);
+        norm += reference[i] * reference[i];
+    }
+    return std::sqrt(difference / norm);
+}
+
+} // namespace slicerecon::harness
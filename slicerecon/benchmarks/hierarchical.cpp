@@ -0,0 +1,63 @@
+#include <cmath>
+#include <iostream>
+
+#include "flags/flags.hpp"
+
+#include "harness.hpp"
+
+using namespace slicerecon;
+
+/**
+ * Compares backprojecting an oblique parallel beam slice (tilted by `--tilt`
+ * degrees around the y axis) hierarchically (on the CPU) against
+ * backprojecting it directly, for slices of `--min-size` up to `--max-size`
+ * pixels (doubling), from as many detector columns. The slices are
+ * backprojected directly on the CPU, or with `--backend gpu` on the GPU
+ * (with ASTRA), by the solver of that backend. The relative (RMS) difference
+ * between the two is reported as well, it is zero if the slice was estimated
+ * to be cheaper to backproject directly.
+ */
+int main(int argc, char** argv)
+{
+    auto opts = flags::flags{argc, argv};
+    opts.info(argv[0], "benchmark of the hierarchical backprojection of oblique slices");
+
+    auto min_size = opts.arg_as_or<int32_t>("--min-size", 512);
+    auto max_size = opts.arg_as_or<int32_t>("--max-size", 2048);
+    auto count = opts.arg_as_or<int32_t>("--projections", 1024);
+    auto rows = opts.arg_as_or<int32_t>("--rows", 64);
+    auto tilt = opts.arg_as_or<float>("--tilt", 2.0f);
+    auto tolerance = opts.arg_as_or<float>("--tolerance", 0.25f);
+    auto repeats = opts.arg_as_or<int32_t>("--repeats", 3);
+    auto backend = opts.arg_or("--backend", "cpu");
+
+    if (opts.passed("-h") || !opts.sane() || min_size <= 0 || tolerance <= 0.0f ||
+        (backend != "cpu" && backend != "gpu")) {
+        std::cout << opts.usage();
+        return opts.passed("-h") ? 0 : -1;
+    }
+
+    for (auto n = min_size; n <= max_size; n *= 2) {
+        auto geom = harness::parallel_geometry(rows, n, count);
+        auto sino = harness::noise_sinogram(geom, 0.95f);
+        auto t = tilt * (float)M_PI / 180.0f;
+        auto x = orientation{2.0f * std::cos(t), 0.0f, 2.0f * std::sin(t),
+                             0.0f, 2.0f, 0.0f,
+                             -std::cos(t), -1.0f, -std::sin(t)};
+
+        auto params = harness::slice_settings(n, backend);
+        auto [bp_ms, bp] = harness::time_slice(params, geom, sino, x, repeats);
+
+        params.hierarchical_tolerance = tolerance;
+        auto [hierarchical_ms, hierarchical] =
+            harness::time_slice(params, geom, sino, x, repeats);
+
+        std::cout << n << " x " << n << " (" << count
+                  << " projections): " << backend << " backprojection "
+                  << bp_ms << " ms, hierarchical " << hierarchical_ms
+                  << " ms (" << bp_ms / hierarchical_ms << "x), difference "
+                  << harness::relative_difference(hierarchical, bp) << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bulk/bulk.hpp"
+#include "flags/flags.hpp"
+
+#include "slicerecon/util/kernels.hpp"
+#include "slicerecon/util/processing.hpp"
+
+using namespace slicerecon::util;
+
+/**
+ * Compares the throughput of the fused flat field / neglog / FDK weighting
+ * kernel against the chained (separate pass) preprocessing stages. The fused
+ * kernel is also timed on 16-bit integer projections, as most detectors
+ * produce them.
+ */
+int main(int argc, char** argv)
+{
+    auto opts = flags::flags{argc, argv};
+    opts.info(argv[0], "benchmark of the projection preprocessing kernels");
+
+    auto rows = opts.arg_as_or<int32_t>("--rows", 2048);
+    auto cols = opts.arg_as_or<int32_t>("--cols", 2048);
+    auto frames = opts.arg_as_or<int32_t>("--frames", 32);
+    auto weighted = !opts.passed("--parallel");
+    // weights that differ per projection are computed on the fly
+    auto per_projection = opts.passed("--vec");
+
+    if (opts.passed("-h") || !opts.sane()) {
+        std::cout << opts.usage();
+        return opts.passed("-h") ? 0 : -1;
+    }
+
+    auto pixels = (size_t)rows * cols;
+    auto rng = std::mt19937{1234};
+    auto counts = std::uniform_real_distribution<float>(200.0f, 60000.0f);
+
+    auto raw = std::vector<float>(pixels * frames);
+    for (auto& x : raw) {
+        x = counts(rng);
+    }
+    auto raw16 = std::vector<uint16_t>(raw.begin(), raw.end());
+    auto dark = std::vector<float>(pixels, 100.0f);
+    auto reciproc = std::vector<float>(pixels, 1.0f / 65000.0f);
+    auto data = raw;
+
+    // a cone beam geometry with the detector at distance `1000`, possibly
+    // with a slightly different source distance for every projection
+    auto coefficients = std::vector<detail::FDKScaler::coefficients>();
+    for (int i = 0; i < frames; ++i) {
+        auto distance = 1000.0f + (per_projection ? 0.5f * i : 0.0f);
+        auto ax = -0.5f * cols;
+        auto ay = -0.5f * rows;
+        auto aa = distance * distance + ax * ax + ay * ay;
+        coefficients.push_back({std::sqrt(aa), aa, 2.0f * ax, 2.0f * ay, 1.0f,
+                                1.0f, 0.0f});
+    }
+
+    auto flatfielder = detail::Flatfielder{{dark.data(), rows, cols},
+                                           {reciproc.data(), rows, cols}};
+    auto neglog = detail::Neglogger{};
+    auto fdk = detail::FDKScaler(rows, cols, coefficients);
+
+    auto report = [&](std::string name, double ms) {
+        auto bytes = (double)pixels * frames * sizeof(float);
+        std::cout << name << ": " << ms / frames << " ms/frame, "
+                  << bytes / (ms * 1.0e6) << " GB/s\n";
+    };
+
+    // chained stages, one full pass per stage
+    {
+        data = raw;
+        auto row_weights = std::vector<float>(cols);
+        auto dt = bulk::util::timer();
+        for (int i = 0; i < frames; ++i) {
+            auto proj = detail::Projection{&data[i * pixels], rows, cols};
+            flatfielder.apply({proj.data, slicerecon::dtype::f32}, proj);
+            neglog.apply(proj);
+            if (weighted) {
+                fdk.apply(proj, i, row_weights.data());
+            }
+        }
+        report("chained", dt.get());
+    }
+
+    // fused single pass, reading the raw projection `i` from `input(i)`
+    auto fused = [&](auto input) {
+        auto row_weights = std::vector<float>(cols);
+        for (int i = 0; i < frames; ++i) {
+            auto proj = detail::Projection{&data[i * pixels], rows, cols};
+            if (!weighted || fdk.shared()) {
+                flatfielder.apply_neglog(
+                    input(i), proj, weighted ? fdk.shared_plane() : nullptr);
+            } else {
+                for (int row = 0; row < rows; ++row) {
+                    fdk.row_weights(i, row, row_weights.data());
+                    flatfielder.apply_neglog_row(input(i), proj, row,
+                                                 row_weights.data());
+                }
+            }
+        }
+    };
+
+    {
+        data = raw;
+        auto dt = bulk::util::timer();
+        fused([&](int i) {
+            return slicerecon::raw_pixels{&data[i * pixels],
+                                          slicerecon::dtype::f32};
+        });
+        report("fused (" + kernels::instruction_set() + ")", dt.get());
+    }
+
+    {
+        auto dt = bulk::util::timer();
+        fused([&](int i) {
+            return slicerecon::raw_pixels{&raw16[i * pixels],
+                                          slicerecon::dtype::u16};
+        });
+        report("fused, uint16 (" + kernels::instruction_set() + ")", dt.get());
+    }
+
+    return 0;
+}
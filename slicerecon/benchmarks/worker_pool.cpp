@@ -0,0 +1,88 @@
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "bulk/backends/thread/thread.hpp"
+#include "bulk/bulk.hpp"
+#include "flags/flags.hpp"
+
+#include "slicerecon/util/worker_pool.hpp"
+
+using namespace slicerecon::util;
+
+namespace {
+
+// a task of roughly `work` units, to simulate (uneven) projection loads
+float busy(int work) {
+    auto x = 0.0f;
+    for (int i = 0; i < work; ++i) {
+        x += std::sqrt((float)i);
+    }
+    return x;
+}
+
+} // namespace
+
+/**
+ * Measures the per-group dispatch overhead of the persistent worker pool,
+ * compared to spawning a bulk environment for every group (as the projection
+ * processor used to do).
+ */
+int main(int argc, char** argv)
+{
+    auto opts = flags::flags{argc, argv};
+    opts.info(argv[0], "benchmark of the projection processing dispatch");
+
+    auto workers = opts.arg_as_or<int32_t>("--workers", 8);
+    auto group_size = opts.arg_as_or<int32_t>("--group-size", 8);
+    auto groups = opts.arg_as_or<int32_t>("--groups", 2000);
+    auto work = opts.arg_as_or<int32_t>("--work", 0);
+
+    if (opts.passed("-h") || !opts.sane()) {
+        std::cout << opts.usage();
+        return opts.passed("-h") ? 0 : -1;
+    }
+
+    // uneven loads: every fourth task is eight times as expensive
+    auto cost = [&](int task) { return (task % 4 == 0) ? 8 * work : work; };
+    auto sink = std::atomic<float>{0.0f};
+
+    auto report = [&](std::string name, double ms) {
+        std::cout << name << ": " << 1000.0 * ms / groups << " us/group\n";
+    };
+
+    {
+        auto env = bulk::thread::environment();
+        auto dt = bulk::util::timer();
+        for (int g = 0; g < groups; ++g) {
+            env.spawn(workers, [&](auto& world) {
+                auto s = world.rank();
+                auto p = world.active_processors();
+                auto x = 0.0f;
+                for (auto task = s; task < group_size; task += p) {
+                    x += busy(cost(task));
+                }
+                sink = sink + x;
+                world.barrier();
+            });
+        }
+        report("spawn per group", dt.get());
+    }
+
+    {
+        auto pool = worker_pool(workers);
+        auto dt = bulk::util::timer();
+        for (int g = 0; g < groups; ++g) {
+            pool.run(group_size, [&](int task, int) {
+                auto x = busy(cost(task));
+                sink = sink + x;
+            });
+        }
+        report("worker pool", dt.get());
+        std::cout << "steals: " << (double)pool.steals() / groups
+                  << " per group\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <complex>
+#include <vector>
+
+extern "C" {
+#include <fftw3.h>
+}
+
+#include <Eigen/Eigen>
+
+#include "astra/ParallelVecProjectionGeometry3D.h"
+#include "astra/VolumeGeometry3D.h"
+
+#include "../util/data_types.hpp"
+#include "../util/processing.hpp"
+#include "../util/worker_pool.hpp"
+
+namespace slicerecon::detail {
+
+/**
+ * Reconstructs horizontal parallel beam slices by Fourier gridding (as in
+ * gridrec), in `O(N^2 log N)` rather than the `O(N^2 P)` of backprojecting
+ * `P` projections onto an `N x N` slice.
+ *
+ * A slice is horizontal if every projection sees it in a single detector
+ * row, the slice is then the backprojection of a 2D sinogram. The spectrum
+ * of each (interpolated) row is placed on a line through the origin of the
+ * 2D spectrum of the slice, these samples are spread onto a twice
+ * oversampled Cartesian grid with an 'exponential of semicircle' kernel,
+ * and an inverse FFT of the grid, divided by the transform of the kernel,
+ * gives the slice.
+ *
+ * The rows are interpolated band limited, rather than linearly as in the
+ * backprojection, but with the frequency response of linear interpolation.
+ * The slices differ from backprojected ones only by the aliasing of the
+ * linear interpolation.
+ */
+class gridrec {
+  public:
+    /** Reconstructs slices onto `vol_geom`, using the workers of `pool`. */
+    gridrec(const settings& parameters, const acquisition::geometry& geometry,
+            const astra::CVolumeGeometry3D& vol_geom, util::worker_pool& pool);
+    ~gridrec();
+
+    gridrec(const gridrec&) = delete;
+    gridrec& operator=(const gridrec&) = delete;
+
+    /**
+     * Reconstruct the slice that the projections `vectors` map onto the
+     * slice volume, into `slice` (laid out as `[y][x]`). Row `r` of
+     * projection `i` starts at `data + i * projection_stride + r *
+     * row_stride`. Returns false, without touching `slice`, if the slice is
+     * not horizontal, or reaches too far beyond the detector to be gridded.
+     */
+    bool reconstruct(const std::vector<astra::SPar3DProjection>& vectors,
+                     const float* data, std::size_t projection_stride,
+                     std::size_t row_stride, float* slice);
+
+  private:
+    // the width (in grid cells) of the kernel, for a relative error of about
+    // 1e-5 on a twice oversampled grid
+    static constexpr int kernel_width = 6;
+
+    // how a projection sees the slice, its detector row, and the column of
+    // the voxel at the origin of the grid and its change per voxel
+    struct view {
+        bool active;
+        float row;
+        float s0;
+        float ds_x;
+        float ds_y;
+    };
+
+    // a sample of the spectrum of a row, as it is spread onto the grid: the
+    // first cell it reaches in each dimension, and the kernel weights. Only
+    // samples that are not `inside` the Hermitian half of the grid (away
+    // from its edges) reach their mirror image
+    struct sample {
+        int x;
+        int y;
+        bool inside;
+        std::array<float, kernel_width> weight_x;
+        std::array<float, kernel_width> weight_y;
+    };
+
+    bool set_slice_(const std::vector<astra::SPar3DProjection>& vectors);
+    void spectra_(const float* data, std::size_t projection_stride,
+                  std::size_t row_stride, int first, int count);
+    void spread_(int count, int strip, int strips);
+    void transform_(float* slice);
+
+    util::worker_pool& pool_;
+    int rows_;
+    int cols_;
+
+    // the slice, and its voxel size
+    int nx_;
+    int ny_;
+    float hx_;
+    float hy_;
+    Eigen::Vector3f origin_;
+    Eigen::Vector2f extent_;
+
+    // padded length of the rows, the number of (used) frequency bins, and
+    // the size of the (square) oversampled grid
+    int length_;
+    int bins_;
+    int grid_size_;
+    std::vector<double> bin_weights_;
+    std::vector<float> inverse_kernel_x_;
+    std::vector<float> inverse_kernel_y_;
+    std::vector<float> kernel_table_;
+
+    // the views of the current slice, and the samples of a chunk of them
+    std::vector<view> views_;
+    std::vector<std::complex<float>> values_;
+    std::vector<sample> samples_;
+    util::detail::fftw_buffer<std::complex<float>> grid_;
+
+    // per worker scratch space
+    std::vector<util::detail::fftw_buffer<float>> row_buffer_;
+    std::vector<util::detail::fftw_buffer<std::complex<float>>> freq_buffer_;
+    std::vector<util::detail::fftw_buffer<std::complex<float>>> column_buffer_;
+    fftwf_plan row_plan_;
+    fftwf_plan column_plan_;
+    fftwf_plan slice_plan_;
+};
+
+} // namespace slicerecon::detail
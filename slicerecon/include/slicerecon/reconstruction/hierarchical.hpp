@@ -0,0 +1,149 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include <Eigen/Eigen>
+
+#include "astra/ParallelVecProjectionGeometry3D.h"
+#include "astra/VolumeGeometry3D.h"
+
+#include "../util/data_types.hpp"
+#include "../util/worker_pool.hpp"
+
+namespace slicerecon::detail {
+
+/**
+ * Backprojects (oblique) parallel beam slices hierarchically, with the
+ * angular decomposition of Basu and Bresler.
+ *
+ * The backprojection onto a small part of the slice only depends on a short
+ * piece of each detector row, and projections with nearly the same
+ * direction backproject (nearly) the same onto it. The slice is divided into
+ * squares recursively. A square holds, for every detector row it reaches
+ * and for every group of similar projections, the sum of the pieces of rows
+ * of the group, shifted to its center. Going down a level halves the size of
+ * the squares, so that their groups can be twice as large, and the pieces of
+ * the children are the (shifted) sums of those of their parent. At the
+ * bottom, the few remaining groups are backprojected onto the pixels.
+ *
+ * The pieces are sampled (at least) twice as fine as the detector, and
+ * groups are made as large as `tolerance` allows, which bounds the error
+ * (in detector pixels) in the positions at which every level samples the
+ * projections. Merged groups are shifted onto each other by linear
+ * interpolation, so the result is somewhat smoother than a backprojection.
+ *
+ * This is `O(N^2 log N)` for slices that reach a bounded number of detector
+ * rows, but the (essentially) `N^2 P` distinct samples that a steep slice
+ * depends on all have to be read, which is as expensive as backprojecting.
+ * Slices for which backprojecting is estimated to be cheaper are left to
+ * the backprojection, as are slices for which the detector row of a pixel
+ * depends on the projection (such as for a tilted axis).
+ */
+class hierarchical_backprojector {
+  public:
+    /**
+     * Backprojects slices onto `vol_geom`, using the workers of `pool`.
+     * Backprojecting a projection onto a pixel directly costs `direct_cost`
+     * times as much as interpolating a sample on the workers. This is 1 if
+     * the slice is otherwise backprojected by the same workers, and less if
+     * it is backprojected on a GPU.
+     */
+    hierarchical_backprojector(const settings& parameters,
+                               const acquisition::geometry& geometry,
+                               const astra::CVolumeGeometry3D& vol_geom,
+                               util::worker_pool& pool,
+                               double direct_cost = 1.0);
+
+    /**
+     * Backproject the slice that the projections `vectors` map onto the
+     * slice volume, into `slice` (laid out as `[y][x]`). Row `r` of
+     * projection `i` starts at `data + i * projection_stride + r *
+     * row_stride`. Returns false, without touching `slice`, if the slice is
+     * better (or only) backprojected directly.
+     */
+    bool reconstruct(const std::vector<astra::SPar3DProjection>& vectors,
+                     const float* data, std::size_t projection_stride,
+                     std::size_t row_stride, float* slice);
+
+  private:
+    // a projection, sorted by its direction in the slice: the (sample)
+    // column of the first pixel, and its change per pixel
+    struct view {
+        int index;
+        float u;
+        Eigen::Vector2f g;
+    };
+
+    // a square of the slice (possibly cut off at its edges), and the groups
+    // of projections and detector rows it holds pieces of rows for
+    struct node {
+        int x0;
+        int y0;
+        int x1;
+        int y1;
+        int level;
+        int first_row;
+        int last_row;
+        int length;
+        Eigen::Vector2d center;
+    };
+
+    // the pieces of rows of a node, laid out as `[rows][groups][length]`,
+    // and the offsets of the groups (in samples)
+    struct pieces {
+        std::vector<float> data;
+        std::vector<double> offsets;
+    };
+
+    bool set_slice_(const std::vector<astra::SPar3DProjection>& vectors);
+    bool make_node_(int x0, int y0, int x1, int y1, int level,
+                    node& result) const;
+    int groups_(int level) const;
+    double cost_(const node& n) const;
+
+    void start_(const node& n, const float* data,
+                std::size_t projection_stride, std::size_t row_stride,
+                pieces& out);
+    void split_(const node& parent, const pieces& in, const node& child,
+                pieces& out);
+    void finish_(const node& n, const pieces& in, float* slice);
+    void descend_(const node& n, int depth, std::vector<pieces>& scratch,
+                  float* slice);
+
+    util::worker_pool& pool_;
+    double direct_cost_;
+    int rows_;
+    int cols_;
+    float tolerance_;
+    int oversampling_;
+
+    // the slice, its voxel size, and the center of its first voxel
+    int nx_;
+    int ny_;
+    float hx_;
+    float hy_;
+    Eigen::Vector3f origin_;
+
+    // the views of the current slice, the (common) sample row of its first
+    // pixel and its change per pixel, and the largest change of the column
+    std::vector<view> views_;
+    float v0_;
+    Eigen::Vector2f dv_;
+    Eigen::Vector2f dg_;
+
+    // the mean directions of the groups of `2^k` views, and the largest
+    // deviation from it of one of their views
+    std::vector<std::vector<Eigen::Vector2f>> directions_;
+    std::vector<float> deviations_;
+
+    // the size of the top level squares, and the nodes below which the
+    // groups are backprojected
+    int block_size_;
+    int leaf_size_;
+
+    // per worker scratch space, for a node of every depth
+    std::vector<std::vector<pieces>> scratch_;
+};
+
+} // namespace slicerecon::detail
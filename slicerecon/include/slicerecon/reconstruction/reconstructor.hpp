@@ -1,9 +1,15 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <complex>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <thread>
 #include <vector>
 
 extern "C" {
@@ -30,9 +36,14 @@ extern "C" {
 
 #include "../util/data_types.hpp"
 #include "../util/exceptions.hpp"
+#include "../util/ingest_ring.hpp"
 #include "../util/log.hpp"
 #include "../util/processing.hpp"
+#include "../util/slice_cache.hpp"
+#include "../util/worker_pool.hpp"
+#include "gridrec.hpp"
 #include "helpers.hpp"
+#include "hierarchical.hpp"
 
 namespace slicerecon {
 
@@ -67,16 +78,31 @@ void minmaxoutput(std::string name, const std::vector<T>& xs) {
 
 namespace detail {
 
+/**
+ * A solver reconstructs slices, and the low resolution preview, from
+ * (filtered) projection data it holds in one or two buffers.
+ */
 class solver {
   public:
     solver(settings parameters, acquisition::geometry geometry);
-    virtual ~solver();
+    virtual ~solver() = default;
 
     virtual slice_data reconstruct_slice(orientation x, int buffer_idx) = 0;
     virtual void reconstruct_preview(std::vector<float>& preview_buffer,
                                      int buffer_idx) = 0;
 
-    auto proj_data(int index) { return proj_datas_[index].get(); }
+    /**
+     * Store the projections `proj_id_begin` up to and including
+     * `proj_id_end` in buffer `buffer_idx`. The projections are given as a
+     * sinogram, i.e. `data` is laid out as `[rows][projections][cols]`.
+     */
+    virtual void upload(int buffer_idx, float* data, int proj_id_begin,
+                        int proj_id_end) = 0;
+
+    /** The FDK weights of the projections, only for cone beam solvers. */
+    virtual std::unique_ptr<util::detail::FDKScaler> fdk_weights() {
+        return nullptr;
+    }
 
     // returns true if we want to trigger a re-reconstruction
     virtual bool
@@ -94,15 +120,33 @@ class solver {
     }
 
   protected:
+    int buffer_count_() const {
+        return parameters_.reconstruction_mode == mode::alternating ? 2 : 1;
+    }
+
     settings parameters_;
     acquisition::geometry geometry_;
 
     std::unique_ptr<astra::CVolumeGeometry3D> vol_geom_;
+    std::unique_ptr<astra::CVolumeGeometry3D> vol_geom_small_;
+};
+
+/** A solver that backprojects on the GPU, using the CUDA kernels of ASTRA. */
+class gpu_solver : public solver {
+  public:
+    gpu_solver(settings parameters, acquisition::geometry geometry);
+    ~gpu_solver() override;
+
+    void upload(int buffer_idx, float* data, int proj_id_begin,
+                int proj_id_end) override;
+
+  protected:
+    void allocate_projections_(astra::CProjectionGeometry3D* proj_geom);
+
     astraCUDA3d::MemHandle3D vol_handle_;
     std::unique_ptr<astra::CFloat32VolumeData3DGPU> vol_data_;
     std::unique_ptr<astra::CCudaProjector3D> projector_;
 
-    std::unique_ptr<astra::CVolumeGeometry3D> vol_geom_small_;
     astraCUDA3d::MemHandle3D vol_handle_small_;
     std::unique_ptr<astra::CFloat32VolumeData3DGPU> vol_data_small_;
     std::vector<std::unique_ptr<astra::CCudaBackProjectionAlgorithm3D>>
@@ -114,14 +158,108 @@ class solver {
     std::vector<astraCUDA3d::MemHandle3D> proj_handles_;
 };
 
-class parallel_beam_solver : public solver {
+/**
+ * A solver that backprojects on the CPU, so that no GPU is needed. The
+ * projections are held in host memory, laid out as
+ * `[projections][rows][cols]`, and the volume is backprojected voxel by
+ * voxel, with (vectorized) bilinear interpolation on the detector. The lines
+ * of voxels are divided over a pool of worker threads.
+ */
+class cpu_solver : public solver {
+  public:
+    cpu_solver(settings parameters, acquisition::geometry geometry);
+
+    void upload(int buffer_idx, float* data, int proj_id_begin,
+                int proj_id_end) override;
+
+  protected:
+    /**
+     * Backproject buffer `buffer_idx` onto the volume `vol_geom`, with the
+     * projections given by `vectors`, into `volume` (laid out as
+     * `[z][y][x]`, like the ASTRA volumes). For parallel beam, only the
+     * detector rows `rows` are read (see `detector_rows`).
+     */
+    void backproject_(const astra::CVolumeGeometry3D& vol_geom,
+                      const std::vector<astra::SPar3DProjection>& vectors,
+                      int buffer_idx, float* volume, std::pair<int, int> rows);
+    void backproject_(const astra::CVolumeGeometry3D& vol_geom,
+                      const std::vector<astra::SConeProjection>& vectors,
+                      int buffer_idx, float* volume);
+
+    std::vector<std::vector<float>> buffers_;
+    std::unique_ptr<util::worker_pool> pool_;
+};
+
+// the projection vectors of an acquisition geometry
+std::vector<astra::SPar3DProjection>
+parallel_vectors(const acquisition::geometry& geometry);
+std::vector<astra::SConeProjection>
+cone_vectors(const acquisition::geometry& geometry);
+
+/**
+ * Transform the projection vectors such that the slice with orientation `x`
+ * is mapped onto the slice volume, whose window is `[-k, k]`.
+ */
+void slice_vectors(const std::vector<astra::SPar3DProjection>& vectors,
+                   std::vector<astra::SPar3DProjection>& result, orientation x,
+                   float k, const acquisition::geometry& geometry);
+void slice_vectors(const std::vector<astra::SConeProjection>& vectors,
+                   std::vector<astra::SConeProjection>& result, orientation x,
+                   float k, const acquisition::geometry& geometry);
+
+/**
+ * The detector rows `[first, second)` that the volume `vol_geom` projects
+ * onto, in any of the parallel beam projections `vectors`. This includes
+ * the rows that are read to interpolate, and is empty if the volume misses
+ * the detector.
+ */
+std::pair<int, int>
+detector_rows(const astra::CVolumeGeometry3D& vol_geom,
+              const std::vector<astra::SPar3DProjection>& vectors, int rows);
+
+/** Rotate and translate the detector of parallel beam projections. */
+void tilt_vectors(const std::vector<astra::SPar3DProjection>& vectors,
+                  std::vector<astra::SPar3DProjection>& result, float rotate,
+                  float translate);
+
+/** Log the orientation of a slice that is reconstructed. */
+void log_slice(orientation x, int buffer_idx);
+
+/** The FDK weights of cone beam projections. */
+std::unique_ptr<util::detail::FDKScaler>
+fdk_weights(const std::vector<astra::SConeProjection>& vectors,
+            const acquisition::geometry& geometry);
+
+/**
+ * Upload the sinogram `data` of the projections `proj_id_begin` up to and
+ * including `proj_id_end` to buffer `buffer_idx` of `alg`, like
+ * `solver::upload`, but only the projections that were received. Projection
+ * `proj_id_begin + i` was received if `received[i]` is non-zero, or if
+ * `received` is a null pointer. The other projections keep the data the
+ * buffer holds for them. The runs of received projections are uploaded
+ * one by one, gathered in `scratch` if they are not the whole sinogram.
+ */
+void upload_received(solver& alg, int buffer_idx, float* data, int rows,
+                     int cols, int proj_id_begin, int proj_id_end,
+                     const char* received, std::vector<float>& scratch);
+
+/**
+ * Backprojects parallel beam slices and previews on the GPU. With
+ * `gpu_gridrec`, horizontal slices are gridded on the CPU instead (see
+ * `gridrec`), and with a `hierarchical_tolerance`, oblique slices may be
+ * backprojected hierarchically on the CPU (see
+ * `hierarchical_backprojector`). Both work on a copy of the projections in
+ * host memory, laid out as `[rows][projections][cols]`.
+ */
+class parallel_beam_solver : public gpu_solver {
   public:
     parallel_beam_solver(settings parameters, acquisition::geometry geometry);
-    // FIXME ~solver clean up
 
     slice_data reconstruct_slice(orientation x, int buffer_idx) override;
     void reconstruct_preview(std::vector<float>& preview_buffer,
                              int buffer_idx) override;
+    void upload(int buffer_idx, float* data, int proj_id_begin,
+                int proj_id_end) override;
 
     bool
     parameter_changed(std::string parameter,
@@ -139,17 +277,21 @@ class parallel_beam_solver : public solver {
     std::vector<astra::SPar3DProjection> vec_buf_;
     float tilt_translate_ = 0.0f;
     float tilt_rotate_ = 0.0f;
+
+    std::unique_ptr<util::worker_pool> pool_;
+    std::unique_ptr<gridrec> gridrec_;
+    std::unique_ptr<hierarchical_backprojector> hierarchical_;
+    std::vector<std::vector<float>> host_buffers_;
 };
 
-class cone_beam_solver : public solver {
+class cone_beam_solver : public gpu_solver {
   public:
     cone_beam_solver(settings parameters, acquisition::geometry geometry);
-    // FIXME ~solver clean up
 
     slice_data reconstruct_slice(orientation x, int buffer_idx) override;
     void reconstruct_preview(std::vector<float>& preview_buffer,
                              int buffer_idx) override;
-    std::vector<float> fdk_weights();
+    std::unique_ptr<util::detail::FDKScaler> fdk_weights() override;
 
   private:
     // Cone specific stuff
@@ -159,11 +301,54 @@ class cone_beam_solver : public solver {
     std::vector<astra::SConeProjection> vec_buf_;
 };
 
+class cpu_parallel_beam_solver : public cpu_solver {
+  public:
+    cpu_parallel_beam_solver(settings parameters,
+                             acquisition::geometry geometry);
+
+    slice_data reconstruct_slice(orientation x, int buffer_idx) override;
+    void reconstruct_preview(std::vector<float>& preview_buffer,
+                             int buffer_idx) override;
+
+    bool
+    parameter_changed(std::string parameter,
+                      std::variant<float, std::string, bool> value) override;
+    std::vector<std::pair<std::string,
+                          std::variant<float, std::vector<std::string>, bool>>>
+    parameters() override;
+
+  private:
+    std::vector<astra::SPar3DProjection> vectors_;
+    std::vector<astra::SPar3DProjection> original_vectors_;
+    std::vector<astra::SPar3DProjection> vec_buf_;
+    float tilt_translate_ = 0.0f;
+    float tilt_rotate_ = 0.0f;
+
+    std::unique_ptr<gridrec> gridrec_;
+    std::unique_ptr<hierarchical_backprojector> hierarchical_;
+};
+
+class cpu_cone_beam_solver : public cpu_solver {
+  public:
+    cpu_cone_beam_solver(settings parameters, acquisition::geometry geometry);
+
+    slice_data reconstruct_slice(orientation x, int buffer_idx) override;
+    void reconstruct_preview(std::vector<float>& preview_buffer,
+                             int buffer_idx) override;
+    std::unique_ptr<util::detail::FDKScaler> fdk_weights() override;
+
+  private:
+    std::vector<astra::SConeProjection> vectors_;
+    std::vector<astra::SConeProjection> vec_buf_;
+};
+
 } // namespace detail
 
 class reconstructor {
   public:
     reconstructor(settings parameters);
+    ~reconstructor();
+
     void initialize(acquisition::geometry geom);
 
     void add_listener(listener* l) {
@@ -179,7 +364,11 @@ class reconstructor {
     }
 
     /**
-     * Push a projection into the reconstruction server.
+     * Push a projection into the reconstruction server. The projection is
+     * only copied into the ingest ring here, it is processed, uploaded and
+     * previewed by the stages of the reconstruction pipeline, each running
+     * on its own thread. What happens if the ring is full is decided by the
+     * overload policy (see `overload_policy`).
      *
      * @param k
      * @param proj_idx Projection index
@@ -188,122 +377,75 @@ class reconstructor {
      */
     void push_projection(proj_kind k, int32_t proj_idx,
                          std::array<int32_t, 2> shape, char* data) {
-        auto p = parameters_;
-        int ue = update_every_;
-        int gs = p.group_size;
+        push_(k, proj_idx, shape, [&](util::received_projection& p) {
+            p.storage.resize(pixels_);
+            memcpy(p.storage.data(), data, sizeof(float) * pixels_);
+            p.pixels = {p.storage.data(), dtype::f32};
+        });
+    }
 
-        if (!initialized_) {
-            slicerecon::util::log
-                << LOG_FILE << slicerecon::util::lvl::error
-                << "Pushing projection into uninitialized reconstructor"
-                << slicerecon::util::end_log;
-            return;
-        }
+    /**
+     * Push a projection without copying it. The projection is processed
+     * straight from `data`, in its native pixel type, which has to stay valid
+     * for as long as `owner` (e.g. the received message) is alive. The
+     * reconstructor holds on to `owner` until the projection is processed.
+     */
+    void push_projection(proj_kind k, int32_t proj_idx,
+                         std::array<int32_t, 2> shape, raw_pixels data,
+                         std::shared_ptr<void> owner) {
+        push_(k, proj_idx, shape, [&](util::received_projection& p) {
+            p.pixels = data;
+            p.owner = std::move(owner);
+        });
+    }
 
-        if (shape[0] * shape[1] != pixels_) {
+    /**
+     * Push a batch of `count` projections, with indices `first_idx`,
+     * `first_idx + stride`, ..., stored one after the other in `data`. The
+     * batch takes a single slot of the ingest ring, and is handed to the
+     * group processing as a whole. Like a single projection, the batch is
+     * processed straight from `data`, which is kept alive by `owner`.
+     *
+     * Returns false if the batch is rejected, because its indices are not
+     * increasing and non-negative (or do not fit in 32 bits).
+     */
+    bool push_projections(proj_kind k, int32_t first_idx, int32_t stride,
+                          int32_t count, std::array<int32_t, 2> shape,
+                          raw_pixels data, std::shared_ptr<void> owner) {
+        auto last_idx = (int64_t)first_idx + (int64_t)(count - 1) * stride;
+        if (count <= 0 || (count > 1 && stride < 1) || first_idx < 0 ||
+            last_idx > std::numeric_limits<int32_t>::max()) {
             util::log << LOG_FILE << util::lvl::warning
-                      << "Received projection of wrong shape (" << shape[0]
-                      << " x " << shape[1] << ") != " << pixels_
-                      << util::end_log;
-            throw server_error(
-                "Received projection has a different shape than the one set by "
-                "the acquisition geometry");
+                      << "Received projection batch with invalid indices ("
+                      << count << " from " << first_idx << " by " << stride
+                      << ")" << util::end_log;
+            return false;
         }
+        push_(
+            k, first_idx, shape,
+            [&](util::received_projection& p) {
+                p.count = count;
+                p.stride = stride;
+                p.pixels = data;
+                p.owner = std::move(owner);
+            },
+            count);
+        return true;
+    }
 
-        switch (k) {
-        case proj_kind::standard: {
-            // check if we received a (new) batch of darks/flats
-            if (received_flats_ >= p.darks + p.flats && p.darks > 0 &&
-                p.flats > 0) {
-                compute_flatfielding_();
-                received_flats_ = 0;
-            }
-
-            auto rel_proj_idx = proj_idx % ue;
-            bool full_group = rel_proj_idx % gs == gs - 1;
-            bool buffer_end_reached = proj_idx % ue == ue - 1;
-
-            // buffer incoming
-            memcpy(&buffer_[rel_proj_idx * pixels_], data,
-                   sizeof(float) * pixels_);
-
-            // see if some processing needs to be done
-            if (full_group || buffer_end_reached) {
-                // find processing range in the data buffer
-                auto begin_in_buffer =
-                    rel_proj_idx -
-                    (rel_proj_idx % gs); // starting idx of this group
-                process_(begin_in_buffer, rel_proj_idx);
-            }
-
-            // see if uploading needs to be done
-            if (buffer_end_reached) {
-                // copy data from buffer into sino_buffer
-
-                if (p.reconstruction_mode == mode::alternating) {
-                    transpose_into_sino_(0, ue - 1);
-
-                    // let the reconstructor know that now the (other) GPU
-                    // buffer is ready for reconstruction
-                    active_gpu_buffer_index_ = 1 - active_gpu_buffer_index_;
-                    bool use_gpu_lock = false;
-
-                    upload_sino_buffer_(0, ue - 1, active_gpu_buffer_index_,
-                                        use_gpu_lock);
-
-                } else { // --continuous mode
-                    auto begin_wrt_geom =
-                        (update_count_ * ue) % geom_.proj_count;
-                    auto end_wrt_geom =
-                        (begin_wrt_geom + ue - 1) % geom_.proj_count;
-                    bool use_gpu_lock = true;
-                    int gpu_buffer_idx = 0; // we only have one buffer
-
-                    if (end_wrt_geom > begin_wrt_geom) {
-                        transpose_into_sino_(0, ue - 1);
-                        upload_sino_buffer_(begin_wrt_geom, end_wrt_geom,
-                                            gpu_buffer_idx, use_gpu_lock);
-                    } else {
-                        transpose_into_sino_(0, geom_.proj_count - 1 -
-                                                    begin_wrt_geom);
-                        // we have gone around in the geometry
-                        upload_sino_buffer_(begin_wrt_geom,
-                                            geom_.proj_count - 1,
-                                            gpu_buffer_idx, use_gpu_lock);
-
-                        transpose_into_sino_(geom_.proj_count - begin_wrt_geom,
-                                             ue - 1);
-                        upload_sino_buffer_(0, end_wrt_geom, gpu_buffer_idx,
-                                            use_gpu_lock);
-                    }
-
-                    update_count_++;
-                }
-
-                // update low-quality 3D reconstruction
-                refresh_data_();
+    slice_data reconstruct_slice(orientation x) {
+        // a slice that is requested again, while the data it was
+        // reconstructed from has not changed, is sent without waiting for
+        // the GPU
+        if (initialized_) {
+            auto buffer_idx = active_gpu_buffer_index_.load();
+            auto key = util::slice_key(x, parameters_.slice_size, buffer_idx,
+                                       data_generation_[buffer_idx]);
+            if (auto cached = slice_cache_.find(key)) {
+                return std::move(*cached);
             }
-
-            break;
         }
-        case proj_kind::dark: {
-            memcpy(&all_darks_[proj_idx * pixels_], data,
-                   sizeof(float) * pixels_);
-            received_flats_++;
-            break;
-        }
-        case proj_kind::light: {
-            memcpy(&all_flats_[proj_idx * pixels_], data,
-                   sizeof(float) * pixels_);
-            received_flats_++;
-            break;
-        }
-        default:
-            break;
-        }
-    }
 
-    slice_data reconstruct_slice(orientation x) {
         // the lock is supposed to be always open if reconstruction mode ==
         // alternating
         std::lock_guard<std::mutex> guard(gpu_mutex_);
@@ -312,7 +454,12 @@ class reconstructor {
             return {{1, 1}, {0.0f}};
         }
 
-        return alg_->reconstruct_slice(x, active_gpu_buffer_index_);
+        auto buffer_idx = active_gpu_buffer_index_.load();
+        auto key = util::slice_key(x, parameters_.slice_size, buffer_idx,
+                                   data_generation_[buffer_idx]);
+        auto result = alg_->reconstruct_slice(x, buffer_idx);
+        slice_cache_.insert(key, result);
+        return result;
     }
 
     std::vector<float>& preview_data() { return small_volume_buffer_; }
@@ -320,6 +467,24 @@ class reconstructor {
     acquisition::geometry geometry() { return geom_; }
     bool initialized() const { return initialized_; }
 
+    /**
+     * The number of received projections that can wait to be processed: the
+     * `ingest_slots`, or two groups by default. Until the geometry is known,
+     * this is an upper bound, as a group can turn out to be smaller than
+     * `group_size` (in alternating mode, for a scan of fewer projections).
+     */
+    int ingest_capacity() const;
+
+    /** The counters of the ingest ring, for diagnostics. */
+    util::ingest_stats ingest_stats() const {
+        return ingest_ ? ingest_->stats() : util::ingest_stats{};
+    }
+
+    /** The counters of the slice cache, for diagnostics. */
+    util::slice_cache_stats slice_cache_stats() const {
+        return slice_cache_.stats();
+    }
+
     void set_scan_settings(int darks, int flats, bool already_linear) {
         parameters_.darks = darks;
         parameters_.flats = flats;
@@ -328,11 +493,40 @@ class reconstructor {
 
     void parameter_changed(std::string name,
                            std::variant<float, std::string, bool> value) {
-        if (alg_) {
-            if (alg_->parameter_changed(name, value)) {
-                for (auto l : listeners_) {
-                    l->notify(*this);
-                }
+        // parameters of the reconstructor itself
+        if (auto it = float_parameters_.find(name);
+            it != float_parameters_.end() &&
+            std::holds_alternative<float>(value)) {
+            *it->second = std::get<float>(value);
+            if (projection_processor_ && projection_processor_->paganin) {
+                projection_processor_->paganin->set_parameters(
+                    parameters_.paganin);
+            }
+        }
+        if (auto it = bool_parameters_.find(name);
+            it != bool_parameters_.end() &&
+            std::holds_alternative<bool>(value)) {
+            *it->second = std::get<bool>(value);
+        }
+
+        auto changed = false;
+        { // lock guard scope
+            // a slice that is being reconstructed meanwhile has to be done
+            // with the old parameters, and be stored under the generation
+            // that is invalidated here
+            std::lock_guard<std::mutex> guard(gpu_mutex_);
+            if (alg_) {
+                changed = alg_->parameter_changed(name, value);
+            }
+
+            // (the slices depend on the parameters, or on the data processed
+            // with them from now on)
+            invalidate_slices_();
+        }
+
+        if (changed) {
+            for (auto l : listeners_) {
+                l->notify(*this);
             }
         }
 
@@ -344,58 +538,105 @@ class reconstructor {
     }
 
   private:
-    std::vector<float> average_(std::vector<float> all) {
-        auto result = std::vector<float>(pixels_);
-        auto samples = all.size() / pixels_;
-        for (int i = 0; i < pixels_; ++i) {
-            float total = 0.0f;
-            for (auto j = 0u; j < samples; ++j) {
-                total += all[pixels_ * j + i];
-            }
-            result[i] = total / samples;
+    template <typename F>
+    void push_(proj_kind k, int32_t proj_idx, std::array<int32_t, 2> shape,
+               F&& fill, int32_t count = 1) {
+        if (!initialized_) {
+            slicerecon::util::log
+                << LOG_FILE << slicerecon::util::lvl::error
+                << "Pushing projection into uninitialized reconstructor"
+                << slicerecon::util::end_log;
+            return;
+        }
+
+        if (shape[0] * shape[1] != pixels_) {
+            util::log << LOG_FILE << util::lvl::warning
+                      << "Received projection of wrong shape (" << shape[0]
+                      << " x " << shape[1] << ") != " << pixels_
+                      << util::end_log;
+            throw server_error(
+                "Received projection has a different shape than the one set by "
+                "the acquisition geometry");
         }
-        return result;
-    }
 
-    void compute_flatfielding_() {
-        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
-                              << "Computing reciprocal for flat fielding"
-                              << slicerecon::util::end_log;
-
-        // 1) average dark
-        auto dark = average_(all_darks_);
-        // 2) average flats
-        auto light = average_(all_flats_);
-
-        // 3) compute reciprocal
-        for (int i = 0; i < geom_.rows * geom_.cols; ++i) {
-            if (dark[i] == light[i]) {
-                flat_fielder_[i] = 1.0f;
-            } else {
-                flat_fielder_[i] = 1.0f / (light[i] - dark[i]);
+        // darks and flats are never dropped
+        auto policy = parameters_.overload;
+        auto may_shed =
+            policy != overload_policy::block && k == proj_kind::standard;
+        auto slot = ingest_->claim(!may_shed);
+        if (!slot && may_shed) {
+            if (policy == overload_policy::drop_newest) {
+                ingest_->drop(count);
+                return;
             }
+            // the processing stage sheds (part of) its backlog, which frees
+            // up slots
+            ingest_->shed();
+            slot = ingest_->claim(true);
+        }
+        if (!slot) {
+            return;
         }
 
-        dark_ = dark;
+        slot->kind = k;
+        slot->idx = proj_idx;
+        slot->count = 1;
+        slot->stride = 1;
+        slot->shape = shape;
+        fill(*slot);
+        ingest_->publish();
     }
 
-    void process_(int proj_id_begin, int proj_id_end);
+    /**
+     * A processed group, waiting to be uploaded. `begin` and `end` are the
+     * (inclusive) projection range in the GPU buffer, if it wraps around
+     * the geometry, the part after `split` starts at projection 0.
+     */
+    struct upload_job {
+        int sino;
+        int begin;
+        int end;
+        int split;
+        bool cycle_end;
+        // whether each projection of the group was received, empty if all of
+        // them were. Projections that were not keep their previous data
+        std::vector<char> received;
+    };
+
+    void start_pipeline_();
+    void stop_pipeline_();
+
+    // the stages of the pipeline
+    void process_loop_();
+    void upload_loop_();
+    void preview_loop_();
+
+    void consume_(util::ingest_ring::slot& s);
+    bool shed_(util::ingest_ring::slot& s);
+    bool decimated_(int32_t proj_idx) const;
+    void consume_projection_(util::received_projection& p);
 
-    void upload_sino_buffer_(int proj_id_begin, int proj_id_end, int buffer_idx,
-                             bool lock_gpu = false);
+    void process_(int proj_id_begin, int proj_id_end, bool cycle_end);
 
-    void transpose_into_sino_(int proj_offset, int proj_end);
+    void upload_sino_buffer_(int sino, int proj_id_begin, int proj_id_end,
+                             size_t buffer_begin, int buffer_idx,
+                             bool lock_gpu = false,
+                             const char* received = nullptr);
+
+    int sino_split_();
+
+    void invalidate_slices_();
 
     void refresh_data_();
 
-    std::vector<float> all_darks_;
-    std::vector<float> all_flats_;
-    std::vector<float> dark_;
-    std::vector<float> flat_fielder_;
+    // the received projections of the current group, and scratch space to
+    // process them in
+    std::vector<util::received_projection> group_;
+    int group_first_ = -1;
     std::vector<float> buffer_;
 
-    int active_gpu_buffer_index_ = 0;
-    int update_every_;
+    std::atomic<int> active_gpu_buffer_index_ = {0};
+    int update_every_ = 0;
 
     int32_t pixels_ = -1;
     int32_t received_flats_ = 0;
@@ -407,15 +648,49 @@ class reconstructor {
 
     int update_count_ = 0;
     std::vector<float> small_volume_buffer_;
-    std::vector<float> sino_buffer_;
+
+    // a group is processed into one sinogram, while the other is uploaded
+    std::array<std::vector<float>, 2> sino_buffers_;
+    int sino_index_ = 0;
+    // runs of received projections of a group that is not complete are
+    // gathered here to be uploaded
+    std::vector<float> upload_scratch_;
 
     std::vector<listener*> listeners_;
-    bool initialized_ = false;
+    std::atomic<bool> initialized_ = false;
 
     std::unique_ptr<util::ProjectionProcessor> projection_processor_;
 
     std::mutex gpu_mutex_;
 
+    // the generation of the data in each GPU buffer, which changes with
+    // every upload, and the slices reconstructed from it
+    std::array<std::atomic<uint64_t>, 2> data_generation_ = {};
+    util::slice_cache slice_cache_;
+
+    // the pipeline: received projections wait in the ingest ring, processed
+    // groups in the upload queue, and a preview is requested after a full
+    // buffer has been uploaded (requests made while one is being computed
+    // are merged)
+    std::unique_ptr<util::ingest_ring> ingest_;
+    std::thread process_thread_;
+    std::thread upload_thread_;
+    std::thread preview_thread_;
+
+    std::mutex stage_mutex_;
+    std::condition_variable stage_cv_;
+    std::deque<upload_job> uploads_;
+    std::array<bool, 2> sino_busy_ = {false, false};
+    bool preview_requested_ = false;
+    int64_t previews_merged_ = 0;
+
+    // load shedding by the processing stage: the group that is being dropped
+    // (if non-negative), and the position in the ingest ring up to which
+    // projections are decimated
+    int32_t shed_group_ = -1;
+    uint64_t decimate_until_ = 0;
+    bool stopping_ = false;
+
     // list of parameters that can be changed from the visualization UI
     // NOTE: the enum parameters are hard coded into the handler
     std::map<std::string, float*> float_parameters_;
@@ -55,21 +55,19 @@ class plugin {
                   << util::end_log;
 
         while (true) {
-            zmq::message_t update;
+            tomop::multipart_message update;
             bool kill = false;
-            if (!socket_in_.recv(&update)) {
+            if (!update.recv(socket_in_)) {
                 kill = true;
             } else {
                 ack();
 
-                auto desc = ((tomop::packet_desc*)update.data())[0];
-                auto buffer =
-                    tomop::memory_buffer(update.size(), (char*)update.data());
+                auto desc = update.desc();
 
                 switch (desc) {
                 case tomop::packet_desc::slice_data: {
                     auto packet = std::make_unique<tomop::SliceDataPacket>();
-                    packet->deserialize(std::move(buffer));
+                    packet->deserialize(update);
 
                     if (!slice_data_callback_) {
                         throw tomop::server_error("No callback set for plugin");
@@ -92,7 +90,7 @@ class plugin {
                 }
                 case tomop::packet_desc::kill_scene: {
                     auto packet = std::make_unique<tomop::KillScenePacket>();
-                    packet->deserialize(std::move(buffer));
+                    packet->deserialize(update);
 
                     kill = true;
 
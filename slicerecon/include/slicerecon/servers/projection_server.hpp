@@ -1,3 +1,9 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
 #include <string>
 #include <thread>
 
@@ -11,11 +17,61 @@
 
 namespace slicerecon {
 
+/**
+ * Receives the projections and the geometry, and hands them to the
+ * reconstructor.
+ *
+ * With a `ZMQ_ROUTER` socket, packets are received from pipelined
+ * publishers (`tomop::publisher` with a `ZMQ_DEALER` socket). Every packet is
+ * preceded by its sequence number, and once a packet is handed to the
+ * reconstructor, its sequence number is acknowledged. Acknowledgements are
+ * cumulative, and are sent every `ack_interval` packets, or once no packet
+ * has arrived for `ack_delay`.
+ *
+ * Every acknowledgement also grants credits: the sequence number up to which
+ * the publisher may send. With the `block` overload policy, the credits are
+ * the free slots of the ingest ring, so that projections wait at the
+ * publisher rather than in the queues of ZeroMQ. With the other policies,
+ * the processing stage sheds load itself, and a full ring is granted.
+ * Publishers that stay silent for `peer_timeout` while they have credits
+ * are forgotten, and are no longer granted any.
+ */
 class projection_server {
   public:
+    static constexpr uint64_t ack_interval = 16;
+    static constexpr std::chrono::milliseconds ack_delay{1};
+    // the credits of a publisher before the reconstructor is initialized
+    static constexpr uint64_t initial_credits = 64;
+    // a publisher that sends nothing for this long, while it may, is
+    // forgotten (e.g. one that has reconnected under a new identity)
+    static constexpr std::chrono::seconds peer_timeout{10};
+
     projection_server(std::string hostname, int port, reconstructor& pool, int type = ZMQ_PULL)
-        : context_(1), socket_(context_, type), pool_(pool), type_(type) {
+        : context_(1), socket_(context_, type), pool_(pool), type_(type),
+          overload_(pool.parameters().overload) {
         using namespace std::string_literals;
+        if (tomop::shm_ring::is_address(hostname)) {
+            // a received projection keeps its slot until its group has been
+            // processed, so besides the ingest ring the slots have to hold a
+            // whole group, and the projection that is being received
+            auto parameters = pool.parameters();
+            auto ingest_slots = pool.ingest_capacity();
+            auto needed = (uint32_t)(parameters.group_size + ingest_slots + 1);
+            ring_ = tomop::shm_ring::create(hostname, needed);
+            if (ring_->slots() < needed) {
+                throw server_error(
+                    "The shared memory ring has " +
+                    std::to_string(ring_->slots()) + " slots, but needs at least " +
+                    std::to_string(needed) + " for a group size of " +
+                    std::to_string(parameters.group_size) + " and " +
+                    std::to_string(ingest_slots) + " ingest slots");
+            }
+            util::log << LOG_FILE << util::lvl::info
+                      << "Receiving through shared memory: " << hostname
+                      << " (" << ring_->slots() << " slots)" << util::end_log;
+            return;
+        }
+
         auto address = "tcp://"s + hostname + ":"s + std::to_string(port);
 
         util::log << LOG_FILE << util::lvl::info << "Binding to: " << address
@@ -28,6 +84,9 @@ class projection_server {
     }
 
     ~projection_server() {
+        if (ring_) {
+            ring_->stop();
+        }
         if (serve_thread_.joinable()) {
             serve_thread_.join();
         }
@@ -38,57 +97,48 @@ class projection_server {
 
     void serve() {
         serve_thread_ = std::thread([&] {
-            zmq::message_t update;
+            tomop::multipart_message update;
             while (true) {
-                socket_.recv(&update);
-                ack();
+                if (ring_) {
+                    if (!ring_->recv(update)) {
+                        break;
+                    }
+                } else if (type_ == ZMQ_ROUTER) {
+                    if (!recv_sequenced_(update)) {
+                        continue;
+                    }
+                } else {
+                    update.recv(socket_);
+                    ack();
+                }
 
-                auto desc = ((tomop::packet_desc*)update.data())[0];
-                auto buffer = (char*)update.data();
+                auto desc = update.desc();
 
                 switch (desc) {
                 case tomop::packet_desc::scan_settings: {
-                    auto mbuffer = tomop::memory_buffer(update.size(),
-                                                        (char*)update.data());
                     auto packet = std::make_unique<tomop::ScanSettingsPacket>();
-                    packet->deserialize(std::move(mbuffer));
+                    packet->deserialize(update);
 
                     pool_.set_scan_settings(packet->darks, packet->flats,
                                             packet->already_linear);
                     break;
                 }
                 case tomop::packet_desc::projection: {
-                    auto index = sizeof(tomop::packet_desc);
-
-                    /* This assumes that the projection packet from TOMOP
-                       does not change, but does avoid an unnecessary copy
-                     */
-                    int32_t type = 0;
-                    int32_t idx = 0;
-                    std::array<int32_t, 2> shape = {};
-
-                    memcpy(&type, buffer + index, sizeof(int32_t));
-                    index += sizeof(int32_t);
-
-                    memcpy(&idx, buffer + index, sizeof(int32_t));
-                    index += sizeof(int32_t);
-
-                    memcpy(&shape, buffer + index,
-                           sizeof(std::array<int32_t, 2>));
-                    index += sizeof(std::array<int32_t, 2>);
-
-                    // the first 4 bytes of the buffer are the size of the data,
-                    // so we skip ahead (its equal to reduce(shape))
-                    pool_.push_projection((proj_kind)type, idx, shape,
-                                          buffer + index + sizeof(int));
+                    push_projection_(update, false);
+                    break;
+                }
+                case tomop::packet_desc::typed_projection: {
+                    push_projection_(update, true);
+                    break;
+                }
+                case tomop::packet_desc::projection_batch: {
+                    push_batch_(update);
                     break;
                 }
                 case tomop::packet_desc::geometry_specification: {
-                    auto mbuffer = tomop::memory_buffer(update.size(),
-                                                        (char*)update.data());
                     auto packet =
                         std::make_unique<tomop::GeometrySpecificationPacket>();
-                    packet->deserialize(std::move(mbuffer));
+                    packet->deserialize(update);
 
                     geom_.volume_min_point = packet->volume_min_point;
                     geom_.volume_max_point = packet->volume_max_point;
@@ -104,12 +154,10 @@ class projection_server {
                     break;
                 }
                 case tomop::packet_desc::parallel_beam_geometry: {
-                    auto mbuffer = tomop::memory_buffer(update.size(),
-                                                        (char*)update.data());
                     auto packet =
                         std::make_unique<tomop::ParallelBeamGeometryPacket>();
 
-                    packet->deserialize(std::move(mbuffer));
+                    packet->deserialize(update);
 
                     if (packet->rows < 0 || packet->cols < 0) {
                         throw server_error(
@@ -135,11 +183,9 @@ class projection_server {
                     break;
                 }
                 case tomop::packet_desc::parallel_vec_geometry: {
-                    auto mbuffer = tomop::memory_buffer(update.size(),
-                                                        (char*)update.data());
                     auto packet =
                         std::make_unique<tomop::ParallelVecGeometryPacket>();
-                    packet->deserialize(std::move(mbuffer));
+                    packet->deserialize(update);
 
                     if (packet->rows < 0 || packet->cols < 0) {
                         throw server_error(
@@ -166,11 +212,9 @@ class projection_server {
                     break;
                 }
                 case tomop::packet_desc::cone_beam_geometry: {
-                    auto mbuffer = tomop::memory_buffer(update.size(),
-                                                        (char*)update.data());
                     auto packet =
                         std::make_unique<tomop::ConeBeamGeometryPacket>();
-                    packet->deserialize(std::move(mbuffer));
+                    packet->deserialize(update);
 
                     if (packet->rows < 0 || packet->cols < 0) {
                         throw server_error(
@@ -199,11 +243,9 @@ class projection_server {
                     break;
                 }
                 case tomop::packet_desc::cone_vec_geometry: {
-                    auto mbuffer = tomop::memory_buffer(update.size(),
-                                                        (char*)update.data());
                     auto packet =
                         std::make_unique<tomop::ConeVecGeometryPacket>();
-                    packet->deserialize(std::move(mbuffer));
+                    packet->deserialize(update);
 
                     if (packet->rows < 0 || packet->cols < 0) {
                         throw server_error(
@@ -234,6 +276,10 @@ class projection_server {
                               << "Unknown package received" << util::end_log;
                     break;
                 }
+
+                if (type_ == ZMQ_ROUTER) {
+                    acknowledge_();
+                }
             }
         });
     }
@@ -248,10 +294,238 @@ class projection_server {
     }
 
   private:
+    struct peer {
+        // the last sequence number that was received, and acknowledged, and
+        // the sequence number up to which the publisher may send
+        uint64_t received = 0;
+        uint64_t acknowledged = 0;
+        uint64_t granted = 0;
+        // when a packet was last received, or new credits were granted
+        std::chrono::steady_clock::time_point active =
+            std::chrono::steady_clock::now();
+    };
+
+    /**
+     * Receive a packet from a pipelined publisher, and remember its sequence
+     * number. Returns false (and skips the message) if it is malformed.
+     */
+    bool recv_sequenced_(tomop::multipart_message& update) {
+        // while no packets arrive, acknowledge the received ones, and keep
+        // granting the credits that are freed up to starved publishers
+        while (unsettled_()) {
+            zmq::pollitem_t items[] = {{socket_, 0, ZMQ_POLLIN, 0}};
+            if (zmq::poll(items, 1, ack_delay) > 0) {
+                break;
+            }
+            expire_peers_();
+            auto credits = credits_();
+            for (auto& [identity, p] : peers_) {
+                if (p.received != p.acknowledged ||
+                    p.received + credits > p.granted) {
+                    send_ack_(identity, p, credits);
+                }
+            }
+        }
+
+        zmq::message_t identity;
+        zmq::message_t sequence;
+        socket_.recv(&identity);
+        if (identity.more()) {
+            socket_.recv(&sequence);
+        }
+        if (!sequence.more() || sequence.size() != sizeof(uint64_t)) {
+            auto more = sequence.more();
+            while (more) {
+                zmq::message_t rest;
+                socket_.recv(&rest);
+                more = rest.more();
+            }
+            util::log << LOG_FILE << util::lvl::warning
+                      << "Received packet without a sequence number"
+                      << util::end_log;
+            return false;
+        }
+
+        update.recv(socket_);
+        current_ = std::string((const char*)identity.data(), identity.size());
+        auto& p = peers_[current_];
+        memcpy(&p.received, sequence.data(), sizeof(uint64_t));
+        p.active = std::chrono::steady_clock::now();
+        expire_peers_();
+        return true;
+    }
+
+    /**
+     * Forget the publishers that have sent nothing for `peer_timeout`, even
+     * though they had credits left. A publisher that has run out of credits
+     * waits for us, and is kept.
+     */
+    void expire_peers_() {
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = peers_.begin(); it != peers_.end();) {
+            auto& [identity, p] = *it;
+            if (identity != current_ && p.granted > p.received &&
+                now - p.active > peer_timeout) {
+                util::log << LOG_FILE << util::lvl::info
+                          << "Forgetting an idle publisher, after "
+                          << p.received << " packets" << util::end_log;
+                it = peers_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    /**
+     * Acknowledge the packets of the current publisher every `ack_interval`
+     * packets. The rest is acknowledged once no packets arrive.
+     */
+    void acknowledge_() {
+        auto& p = peers_[current_];
+        if (p.received - p.acknowledged >= ack_interval) {
+            send_ack_(current_, p, credits_());
+        }
+    }
+
+    /**
+     * Whether a publisher waits for an acknowledgement, or has run out of
+     * credits.
+     */
+    bool unsettled_() const {
+        for (auto& [identity, p] : peers_) {
+            if (p.received != p.acknowledged || p.granted <= p.received) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** The credits of a publisher, on top of what it has sent. */
+    uint64_t credits_() {
+        auto stats = pool_.ingest_stats();
+        if (stats.capacity == 0) {
+            return initial_credits;
+        }
+        if (overload_ != overload_policy::block) {
+            return stats.capacity;
+        }
+        // shared between the (active) publishers
+        auto free = (uint64_t)std::max(stats.capacity - stats.occupancy, 0);
+        auto publishers = (uint64_t)std::max<std::size_t>(peers_.size(), 1);
+        return (free + publishers - 1) / publishers;
+    }
+
+    /**
+     * Acknowledge the packets of a publisher, and grant it `credits` on top
+     * of them. Credits are never taken back.
+     */
+    void send_ack_(const std::string& identity, peer& p, uint64_t credits) {
+        p.acknowledged = p.received;
+        if (p.received + credits > p.granted) {
+            p.granted = p.received + credits;
+            p.active = std::chrono::steady_clock::now();
+        }
+
+        uint64_t ack[] = {p.acknowledged, p.granted};
+        zmq::message_t address(identity.data(), identity.size());
+        zmq::message_t reply(ack, sizeof(ack));
+        socket_.send(address, ZMQ_SNDMORE);
+        socket_.send(reply);
+    }
+
+    /**
+     * Hand a (typed) projection packet to the reconstructor. The
+     * reconstructor processes the projection straight from the message,
+     * which it releases once it is done.
+     */
+    void push_projection_(tomop::multipart_message& update, bool typed) {
+        int32_t type = 0;
+        int32_t idx = 0;
+        std::array<int32_t, 2> shape = {};
+        auto pixel_type = dtype::f32;
+        auto data = tomop::array_view<char>{};
+        auto message = std::shared_ptr<tomop::multipart_message>{};
+
+        if (typed) {
+            auto packet = read_<tomop::TypedProjectionPacket>(update);
+            auto pixels = packet.array(&tomop::TypedProjectionPacket::data);
+            type = packet.type;
+            idx = packet.projection_id;
+            shape = packet.shape;
+            pixel_type = (dtype)packet.dtype;
+            data = {(const char*)pixels.data(), pixels.size()};
+            message = packet.message();
+        } else {
+            auto packet = read_<tomop::ProjectionPacket>(update);
+            auto pixels = packet.array(&tomop::ProjectionPacket::data);
+            type = packet.type;
+            idx = packet.projection_id;
+            shape = packet.shape;
+            data = {(const char*)pixels.data(), pixels.size() * sizeof(float)};
+            message = packet.message();
+        }
+
+        auto bytes = (size_t)shape[0] * shape[1] * dtype_size(pixel_type);
+        if (!message || bytes == 0 || data.size() != bytes) {
+            util::log << LOG_FILE << util::lvl::warning
+                      << "Received projection with an unknown pixel type, or "
+                         "of inconsistent size"
+                      << util::end_log;
+            return;
+        }
+
+        pool_.push_projection((proj_kind)type, idx, shape,
+                              raw_pixels{data.data(), pixel_type},
+                              std::move(message));
+    }
+
+    /** As `push_projection_`, for a batch of projections. */
+    void push_batch_(tomop::multipart_message& update) {
+        auto packet = read_<tomop::ProjectionBatchPacket>(update);
+        auto data = packet.array(&tomop::ProjectionBatchPacket::data);
+
+        auto pixel_type = (dtype)packet.dtype;
+        auto bytes = (size_t)packet.shape[0] * packet.shape[1] *
+                     dtype_size(pixel_type) * std::max(packet.count, 0);
+        if (!packet.message() || bytes == 0 || data.size() != bytes) {
+            util::log << LOG_FILE << util::lvl::warning
+                      << "Received projection batch with an unknown pixel "
+                         "type, or of inconsistent size"
+                      << util::end_log;
+            return;
+        }
+
+        pool_.push_projections((proj_kind)packet.type, packet.first_id,
+                               packet.stride, packet.count, packet.shape,
+                               raw_pixels{data.data(), pixel_type},
+                               packet.message());
+    }
+
+    /**
+     * Read a packet without copying its pixels, these stay in the message.
+     * Returns an empty view (without a message) if the packet is malformed.
+     */
+    template <typename P>
+    tomop::packet_view<P> read_(tomop::multipart_message& update) {
+        try {
+            return tomop::packet_view<P>(std::move(update));
+        } catch (const tomop::server_error& e) {
+            util::log << LOG_FILE << util::lvl::warning << e.what()
+                      << util::end_log;
+            return {};
+        }
+    }
+
     zmq::context_t context_;
     zmq::socket_t socket_;
     reconstructor& pool_;
     int type_;
+    overload_policy overload_;
+    // packets from a producer on the same host, instead of the socket
+    std::shared_ptr<tomop::shm_ring> ring_;
+    // pipelined publishers, by their identity (`ZMQ_ROUTER`)
+    std::map<std::string, peer> peers_;
+    std::string current_;
 
     std::thread serve_thread_;
 
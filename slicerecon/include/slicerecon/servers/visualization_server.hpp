@@ -1,8 +1,10 @@
 #pragma once
 
 #include <array>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <string>
 #include <thread>
@@ -31,9 +33,9 @@ class visualization_server : public listener, public util::bench_listener {
         zmq::message_t reply;
         int n = recon.parameters().preview_size;
 
-        auto volprev =
-            tomop::VolumeDataPacket(scene_id_, {n, n, n}, recon.preview_data());
-        send(volprev);
+        auto volprev = std::make_shared<tomop::VolumeDataPacket>(
+            scene_id_, std::array<int32_t, 3>{n, n, n}, recon.preview_data());
+        send(std::move(volprev));
 
         auto grsp = tomop::GroupRequestSlicesPacket(scene_id_, 1);
         send(grsp);
@@ -43,6 +45,11 @@ class visualization_server : public listener, public util::bench_listener {
         send(tomop::BenchmarkPacket(scene_id_, name, time));
     }
 
+    void count_notify(std::string name, int64_t value) override {
+        // counters share the benchmark channel, RECAST3D shows them as-is
+        send(tomop::BenchmarkPacket(scene_id_, name, (float)value));
+    }
+
     void register_parameter(
         std::string parameter_name,
         std::variant<float, std::vector<std::string>, bool> value) override {
@@ -87,6 +94,11 @@ class visualization_server : public listener, public util::bench_listener {
             zmq::message_t reply;
             socket_.recv(&reply);
             scene_id_ = *(int32_t*)reply.data();
+            // older servers only reply with the scene id
+            if (reply.size() >= 2 * sizeof(int32_t)) {
+                memcpy(&capabilities_, (char*)reply.data() + sizeof(int32_t),
+                       sizeof(int32_t));
+            }
         }
 
         subscribe(subscribe_hostname);
@@ -112,17 +124,17 @@ class visualization_server : public listener, public util::bench_listener {
     }
 
     void send(const tomop::Packet& packet, bool try_plugin = false) {
-        std::lock_guard<std::mutex> guard(socket_mutex_);
-
-        zmq::message_t reply;
+        send_(packet, try_plugin, tomop::framing::single, nullptr);
+    }
 
-        if (try_plugin && plugin_socket_) {
-            packet.send(plugin_socket_.value());
-            plugin_socket_.value().recv(&reply);
-        } else {
-            packet.send(socket_);
-            socket_.recv(&reply);
-        }
+    /**
+     * Send a packet with large arrays (slices, previews). Its arrays are sent
+     * from the packet itself, which is kept alive until they are sent.
+     */
+    void send(std::shared_ptr<const tomop::Packet> packet,
+              bool try_plugin = false) {
+        auto& p = *packet;
+        send_(p, try_plugin, tomop::framing::multipart, std::move(packet));
     }
 
     void subscribe(std::string subscribe_host) {
@@ -290,10 +302,10 @@ class visualization_server : public listener, public util::bench_listener {
         auto result = slice_data_callback_(orientation, slice_id);
 
         if (!result.first.empty()) {
-            auto data_packet =
-                tomop::SliceDataPacket(scene_id_, slice_id, result.first,
-                                       std::move(result.second), false);
-            send(data_packet, true);
+            auto data_packet = std::make_shared<tomop::SliceDataPacket>(
+                scene_id_, slice_id, result.first, std::move(result.second),
+                false);
+            send(std::move(data_packet), true);
         }
     }
 
@@ -301,9 +313,46 @@ class visualization_server : public listener, public util::bench_listener {
         slice_data_callback_ = callback;
     }
 
+    /**
+     * Compress the slices and previews that are sent with `c`, if the
+     * visualization server reported that it supports it when the scene was
+     * made. Otherwise they are sent uncompressed. Plugins are expected to
+     * support it as well.
+     */
+    void set_compression(tomop::codec c) {
+        if (c != tomop::codec::none &&
+            !(capabilities_ & tomop::capability_compression)) {
+            util::log << LOG_FILE << util::lvl::warning
+                      << "The visualization server does not support "
+                         "compression, sending slices uncompressed"
+                      << util::end_log;
+            c = tomop::codec::none;
+        }
+        codec_ = c;
+    }
+
     int32_t scene_id() { return scene_id_; }
 
   private:
+    void send_(const tomop::Packet& packet, bool try_plugin, tomop::framing f,
+               std::shared_ptr<const void> owner) {
+        std::lock_guard<std::mutex> guard(socket_mutex_);
+
+        zmq::message_t reply;
+
+        if (try_plugin && plugin_socket_) {
+            packet.send(plugin_socket_.value(), f, std::move(owner),
+                        f == tomop::framing::multipart ? codec_
+                                                       : tomop::codec::none);
+            plugin_socket_.value().recv(&reply);
+        } else {
+            packet.send(socket_, f, std::move(owner),
+                        f == tomop::framing::multipart ? codec_
+                                                       : tomop::codec::none);
+            socket_.recv(&reply);
+        }
+    }
+
     // server connection
     zmq::context_t context_;
     zmq::socket_t socket_;
@@ -321,6 +370,9 @@ class visualization_server : public listener, public util::bench_listener {
     std::vector<std::pair<int32_t, std::array<float, 9>>> slices_;
 
     std::mutex socket_mutex_;
+
+    tomop::codec codec_ = tomop::codec::none;
+    int32_t capabilities_ = 0;
 };
 
 } // namespace slicerecon
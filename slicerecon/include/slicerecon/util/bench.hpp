@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -11,6 +13,9 @@ namespace slicerecon::util {
 
 struct bench_listener {
     virtual void bench_notify(std::string name, double time) = 0;
+    // counters (e.g. of dropped packets) are not timings, and are ignored
+    // unless a listener is interested in them
+    virtual void count_notify(std::string name, int64_t value) {}
 };
 
 struct bencher {
@@ -19,30 +24,60 @@ struct bencher {
             return;
         }
 
-        if (results.find(name) == results.end()) {
-            results[name] = {};
+        {
+            // timings are inserted from several threads
+            std::lock_guard<std::mutex> guard(mutex_);
+            results[name].push_back(time);
         }
-        results[name].push_back(time);
 
         notify_(name, time);
     }
 
+    /** Report the current value of a (cumulative) counter. */
+    void count(std::string name, int64_t value) {
+        if (!enabled_) {
+            return;
+        }
+
+        std::vector<bench_listener*> listeners;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            counts[name] = value;
+            listeners = listeners_;
+        }
+
+        for (auto l : listeners) {
+            l->count_notify(name, value);
+        }
+    }
+
     void print() {
+        std::lock_guard<std::mutex> guard(mutex_);
         for (auto [name, times] : results) {
             std::cout << name << ": ";
             for (auto time : times) {
                 std::cout << time << " ms, ";
             }
         }
+        for (auto [name, value] : counts) {
+            std::cout << name << ": " << value << ", ";
+        }
     }
 
     void register_listener(bench_listener* listener) {
+        std::lock_guard<std::mutex> guard(mutex_);
         listeners_.push_back(listener);
         // FIXME remove when, where?
     }
 
     void notify_(std::string name, double time) {
-        for (auto l : listeners_) {
+        std::vector<bench_listener*> listeners;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            listeners = listeners_;
+        }
+
+        for (auto l : listeners) {
             l->bench_notify(name, time);
         }
     }
@@ -51,7 +86,9 @@ struct bencher {
 
     bool enabled_ = false;
     std::map<std::string, std::vector<double>> results;
+    std::map<std::string, int64_t> counts;
     std::vector<bench_listener*> listeners_;
+    std::mutex mutex_;
 };
 
 extern bencher bench;
@@ -1,10 +1,15 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
 #include <utility>
 #include <variant>
 #include <vector>
 
+#include "tomop/dtype.hpp"
+
 namespace slicerecon {
 
 /**
@@ -14,6 +19,36 @@ namespace slicerecon {
  */
 enum class mode { alternating, continuous };
 
+/**
+ * How the rows of a projection are extended before filtering. Zero padding
+ * is the classic choice, edge padding repeats the boundary values and avoids
+ * the cupping artifacts of truncated (local) projections.
+ */
+enum class padding { zero, edge };
+
+/**
+ * How much effort FFTW spends on planning the transforms. More effort gives
+ * faster transforms, but takes (much) longer to plan, unless the wisdom is
+ * cached.
+ */
+enum class planner_effort { estimate, measure, patient, exhaustive };
+
+/**
+ * What happens to received projections when the reconstruction can not keep
+ * up and the ingest ring is full. Either the receiver (and so the publisher)
+ * waits for a free slot, the newest projection is dropped, or the processing
+ * stage sheds its backlog: by dropping the oldest queued group, or by leaving
+ * out every other angle of the queued projections.
+ */
+enum class overload_policy { block, drop_newest, drop_oldest_group, decimate };
+
+/**
+ * Where the slices and the preview are reconstructed. The GPU backend uses
+ * the CUDA kernels of ASTRA, the CPU backend backprojects on the host, for
+ * machines without a (CUDA capable) GPU.
+ */
+enum class solver_backend { gpu, cpu };
+
 struct paganin_settings {
     float pixel_size;
     float lambda;
@@ -36,6 +71,34 @@ struct settings {
     paganin_settings paganin;
     bool gaussian_pass;
     std::string filter;
+    // planning effort for FFTW
+    planner_effort fftw_planner = planner_effort::measure;
+    // directory to cache FFTW wisdom in, caching is disabled if empty
+    std::string wisdom_dir = "";
+    // how the filtered rows are extended to the padded FFT length
+    padding filter_padding = padding::edge;
+    // cores to pin the projection processing threads to, unpinned if empty
+    std::vector<int32_t> pinned_cores = {};
+    // the number of received projections that can be waiting to be
+    // processed, two groups if zero
+    int32_t ingest_slots = 0;
+    // what to do with projections when the reconstruction can not keep up
+    overload_policy overload = overload_policy::block;
+    // whether to reconstruct on the GPU or on the CPU
+    solver_backend backend = solver_backend::gpu;
+    // whether to reconstruct horizontal parallel beam slices by Fourier
+    // gridding, rather than by backprojection
+    bool gridrec = true;
+    // the error (in detector pixels) the hierarchical backprojection of
+    // oblique parallel beam slices may make at every level, smaller is more
+    // accurate but slower, and zero backprojects them directly (exactly)
+    float hierarchical_tolerance = 0.0f;
+    // the memory (in MiB) for reconstructed slices that are sent again while
+    // their data is unchanged, zero disables the cache
+    int32_t slice_cache_mb = 64;
+    // whether the GPU backend grids horizontal slices (on the CPU) as well,
+    // for which it keeps a copy of the projections in host memory
+    bool gpu_gridrec = false;
 };
 
 namespace acquisition {
@@ -78,6 +141,22 @@ using slice_data = std::pair<std::array<int32_t, 2>, std::vector<float>>;
  */
 enum class proj_kind : int32_t { dark = 0, light = 1, standard = 2 };
 
+/**
+ * The pixel type of a received projection, the `dtype` tag of a (typed)
+ * projection packet.
+ */
+using tomop::dtype;
+using tomop::dtype_size;
+
+/**
+ * The raw pixels of a projection, as they were received. These are converted
+ * to float by the first processing stage.
+ */
+struct raw_pixels {
+    const void* data = nullptr;
+    dtype type = dtype::f32;
+};
+
 /**
  * The data that defines a projection.
  */
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "data_types.hpp"
+
+namespace slicerecon::util {
+
+/** Counters of an ingest ring, for diagnostics. */
+struct ingest_stats {
+    int capacity = 0;
+    // the number of filled slots, right now and at most
+    int occupancy = 0;
+    int max_occupancy = 0;
+    // entries (projections or batches) that were published, projections
+    // that were dropped because the ring was full, and projections that were
+    // left out to shed load (see `overload_policy`)
+    int64_t received = 0;
+    int64_t dropped = 0;
+    int64_t decimated = 0;
+    // the number of times the producer had to wait for a free slot
+    int64_t stalls = 0;
+};
+
+/**
+ * A received projection (or dark, or flat), and the memory it lives in. The
+ * pixels, in the type they were received in, either point into `owner`, e.g.
+ * the message the projection was received in, which is kept alive instead of
+ * copying it, or into `storage`.
+ *
+ * This can also be a batch of `count` projections, with indices `idx`,
+ * `idx + stride`, ..., stored one after the other.
+ */
+struct received_projection {
+    proj_kind kind = proj_kind::standard;
+    int32_t idx = 0;
+    int32_t count = 1;
+    int32_t stride = 1;
+    std::array<int32_t, 2> shape = {};
+    raw_pixels pixels = {};
+    std::shared_ptr<void> owner;
+    std::vector<float> storage;
+};
+
+/**
+ * A bounded ring of projection slots, between the thread that receives
+ * projections and the threads that process them.
+ *
+ * There is a single producer, which claims a free slot, fills it and
+ * publishes it. Consumers pop filled slots in order, and release them when
+ * they are done. Neither side takes a lock: every slot carries a sequence
+ * number, which tells whether it is free for the producer or filled for the
+ * consumers. A side that finds nothing to do spins briefly, and then sleeps
+ * on a futex until the other side rings the doorbell.
+ */
+class ingest_ring {
+  public:
+    struct slot : received_projection {
+        /** The position of the slot in the stream of published entries. */
+        uint64_t position() const { return position_; }
+
+      private:
+        friend ingest_ring;
+        std::atomic<uint64_t> sequence_ = {0};
+        uint64_t position_ = 0;
+    };
+
+    /** Construct a ring of `capacity` slots. */
+    explicit ingest_ring(int capacity);
+    ~ingest_ring();
+
+    ingest_ring(const ingest_ring&) = delete;
+    ingest_ring& operator=(const ingest_ring&) = delete;
+
+    /**
+     * Claim the next free slot. If the ring is full, this waits for a slot
+     * to be released if `wait` is true, or returns `nullptr` otherwise. Also
+     * returns `nullptr` once the ring is stopped.
+     */
+    slot* claim(bool wait = true);
+
+    /** Hand the claimed slot to the consumers. */
+    void publish();
+
+    /** Count projections that were not enqueued because the ring was full. */
+    void drop(int count = 1) {
+        dropped_.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    /** Count projections that were left out to shed load. */
+    void decimate(int count = 1) {
+        decimated_.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    /**
+     * Ask the consumers to shed load, because the ring is full. Requests are
+     * counted, and are taken one at a time by `take_shed_request`.
+     */
+    void shed() { shed_requests_.fetch_add(1); }
+
+    /** Take a pending request to shed load, if there is one. */
+    bool take_shed_request() {
+        auto handled = shed_handled_.load();
+        while (handled < shed_requests_.load()) {
+            if (shed_handled_.compare_exchange_weak(handled, handled + 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Take the oldest filled slot, waiting for one if the ring is empty.
+     * Returns `nullptr` once the ring is stopped.
+     */
+    slot* pop();
+
+    /**
+     * Return a popped slot to the producer. The owner of its data is
+     * released, its storage is kept for reuse.
+     */
+    void release(slot* s);
+
+    /** Wake up and turn away all waiting producers and consumers. */
+    void stop();
+
+    ingest_stats stats() const;
+
+  private:
+    int capacity_;
+    std::unique_ptr<slot[]> slots_;
+
+    // the next position to claim, owned by the producer
+    alignas(64) uint64_t tail_ = 0;
+    std::atomic<uint64_t> published_tail_ = {0};
+    std::atomic<int> max_occupancy_ = {0};
+    std::atomic<int64_t> stalls_ = {0};
+    std::atomic<int64_t> dropped_ = {0};
+    std::atomic<int64_t> decimated_ = {0};
+    std::atomic<uint64_t> shed_requests_ = {0};
+
+    // the next position to pop, shared by the consumers
+    alignas(64) std::atomic<uint64_t> head_ = {0};
+    std::atomic<uint64_t> shed_handled_ = {0};
+
+    // doorbells, bumped on every publish and release respectively
+    alignas(64) std::atomic<uint32_t> filled_ = {0};
+    std::atomic<int32_t> consumers_waiting_ = {0};
+    alignas(64) std::atomic<uint32_t> freed_ = {0};
+    std::atomic<int32_t> producer_waiting_ = {0};
+
+    std::atomic<bool> stop_ = {false};
+};
+
+} // namespace slicerecon::util
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace slicerecon::util::kernels {
+
+/**
+ * Fused preprocessing of a single projection, in one sweep over the data:
+ *
+ *     out[i] = w[i] * -log((in[i] - dark[i]) * reciproc[i])
+ *
+ * where non-positive (flat fielded) values are clamped to zero. If `weights`
+ * is a null pointer, no (FDK) weighting is applied. `in` and `out` are allowed
+ * to alias.
+ *
+ * The implementation is picked at runtime based on the instruction sets the
+ * CPU supports (AVX-512, AVX2, or a scalar fallback).
+ */
+void flatfield_neglog(const float* in, float* out, const float* dark,
+                      const float* reciproc, const float* weights,
+                      std::size_t n);
+
+/**
+ * As above, for raw projections of (unsigned) integers, which are converted
+ * to float as they are loaded.
+ */
+void flatfield_neglog(const uint8_t* in, float* out, const float* dark,
+                      const float* reciproc, const float* weights,
+                      std::size_t n);
+void flatfield_neglog(const uint16_t* in, float* out, const float* dark,
+                      const float* reciproc, const float* weights,
+                      std::size_t n);
+void flatfield_neglog(const uint32_t* in, float* out, const float* dark,
+                      const float* reciproc, const float* weights,
+                      std::size_t n);
+
+/** The scalar reference implementation of `flatfield_neglog`. */
+void flatfield_neglog_scalar(const float* in, float* out, const float* dark,
+                             const float* reciproc, const float* weights,
+                             std::size_t n);
+void flatfield_neglog_scalar(const uint16_t* in, float* out,
+                             const float* dark, const float* reciproc,
+                             const float* weights, std::size_t n);
+
+/**
+ * Scaled negative log, `out[i] = scale * -log(in[i])`, where non-positive
+ * values are clamped to zero. `in` and `out` are allowed to alias.
+ */
+void neglog_scale(const float* in, float* out, float scale, std::size_t n);
+
+/**
+ * The FDK weights of a row of the detector, in terms of the squared distance
+ * from the source to pixel `c`, which is a quadratic polynomial in `c`:
+ *
+ *     out[c] = rho / sqrt(constant + c * (linear + c * quadratic))
+ */
+void fdk_row_weights(float rho, float constant, float linear, float quadratic,
+                     float* out, std::size_t n);
+
+/**
+ * Copy `n` floats from `src` to `dst`, bypassing the cache for the stores
+ * where possible. This is meant for large copies of data that is not read
+ * again soon by the copying thread. Call `stream_fence` before the data is
+ * handed over to another thread.
+ */
+void stream_copy(const float* src, float* dst, std::size_t n);
+
+/** Order the (weakly ordered) streaming stores of this thread. */
+void stream_fence();
+
+/**
+ * The detector coordinates of a line of voxels, in pixels. Voxel `i` of the
+ * line projects onto column `(u + i * du) / (w + i * dw)` and row
+ * `(v + i * dv) / (w + i * dw)`, where the pixel centers are at half-integer
+ * coordinates. For parallel beam, `w` is one and `dw` is zero.
+ */
+struct voxel_line {
+    float u;
+    float du;
+    float v;
+    float dv;
+    float w = 1.0f;
+    float dw = 0.0f;
+};
+
+/**
+ * Voxel-driven backprojection of a single projection of `rows` x `cols`
+ * pixels onto a line of `n` voxels. The projection is bilinearly
+ * interpolated, and zero outside of the detector, and the values are added
+ * to `out[i]`. For cone beam, the values are weighted by the (FDK) distance
+ * weight `1 / (w + i * dw)^2`, and voxels with a non-positive depth are
+ * skipped.
+ */
+void backproject_parallel(const float* projection, int rows, int cols,
+                          const voxel_line& line, float* out, std::size_t n);
+void backproject_cone(const float* projection, int rows, int cols,
+                      const voxel_line& line, float* out, std::size_t n);
+
+/** Name of the instruction set used by the fused kernels on this machine. */
+std::string instruction_set();
+
+} // namespace slicerecon::util::kernels
@@ -2,74 +2,305 @@
 
 #include "data_types.hpp"
 
+#include <array>
 #include <cmath>
 #include <complex>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
 #include <vector>
 
 extern "C" {
 #include <fftw3.h>
 }
 
-#include <bulk/backends/thread/thread.hpp>
 #include <bulk/bulk.hpp>
 
+#include "worker_pool.hpp"
+
 namespace slicerecon::util {
 
 namespace filter {
-std::vector<float> ram_lak(int cols);
-std::vector<float> shepp_logan(int cols);
-std::vector<float> gaussian(int cols, float sigma);
+
+/** The smallest even 2, 3, 5, 7-smooth number that is at least `size`. */
+int smooth_size(int size);
+
+/**
+ * The length the rows of `cols` pixels are padded to before filtering: the
+ * smallest even 2, 3, 5, 7-smooth number that is at least `2 * cols`.
+ */
+int padded_size(int cols);
+
+// The filters below are the half spectra (`n / 2 + 1` bins) of a real
+// transform of length `n`, in normalized frequency.
+std::vector<float> ram_lak(int n);
+std::vector<float> shepp_logan(int n);
+std::vector<float> gaussian(int n, float sigma);
+
+/**
+ * Reads a filter of `cols` (or `cols * proj_count`, one per projection)
+ * values from a file, and resamples it onto the half spectrum of length `n`.
+ */
+std::vector<float> from_file(std::string filename, int cols, int proj_count,
+                             int n);
+
+/**
+ * The Paganin (single-material phase retrieval) filter, as the half spectrum
+ * (`rows x (cols / 2 + 1)` bins) of a real 2D transform of `rows x cols`
+ * pixels, in the FFTW frequency order.
+ */
 std::vector<float> paganin(int rows, int cols, float pixel_size, float lambda,
                            float delta, float beta, float distance);
 } // namespace filter
 
 namespace detail {
 
+/** Owning pointer to memory allocated (aligned) by FFTW. */
+struct fftw_deleter {
+    void operator()(void* p) const { fftwf_free(p); }
+};
+
+template <typename T>
+using fftw_buffer = std::unique_ptr<T[], fftw_deleter>;
+
+template <typename T>
+fftw_buffer<T> fftw_alloc(size_t n) {
+    return fftw_buffer<T>((T*)fftwf_malloc(n * sizeof(T)));
+}
+
+/** Flags for the FFTW planner, based on the requested planning effort. */
+unsigned planner_flags(const settings& parameters);
+
+/**
+ * The file that caches the FFTW wisdom for a transform of size `n`, with
+ * `batch` transforms per call. Returns an empty string if caching is disabled.
+ */
+std::string wisdom_file(const settings& parameters, std::string kind, int n,
+                        int batch);
+
 struct Projection {
     float* data;
     int rows;
     int cols;
 };
 
+/**
+ * Flat fields the raw projection `in` into `proj`, the two are allowed to
+ * alias (if `in` is float). Reading the raw data from elsewhere allows the
+ * projections to be processed straight from the buffer they were received in,
+ * in their native pixel type.
+ */
 struct Flatfielder {
     Projection dark;
     Projection reciproc;
 
-    void apply(Projection proj) const;
+    void apply(raw_pixels in, Projection proj) const;
+
+    /**
+     * Flat field, take the negative log and (optionally) apply the FDK
+     * weights in a single vectorized pass over the projection.
+     */
+    void apply_neglog(raw_pixels in, Projection proj, const float* weights) const;
+
+    /** As `apply_neglog`, for the single row `row` of `proj`. */
+    void apply_neglog_row(raw_pixels in, Projection proj, int row,
+                          const float* weights) const;
+};
+
+/** Converts the raw projection `in` to float, into `proj`. */
+void convert(raw_pixels in, Projection proj);
+
+/** A (mean) dark field, and the reciprocal of the mean flat minus dark field. */
+struct FlatfieldSet {
+    std::vector<float> dark;
+    std::vector<float> reciproc;
+};
+
+/**
+ * Running means of the incoming dark and flat fields. The reciprocal is kept
+ * up to date after every frame, so that a completed set can be swapped in
+ * without further work. The memory use does not depend on the number of
+ * frames.
+ */
+class FlatfieldAccumulator {
+  public:
+    explicit FlatfieldAccumulator(size_t pixels);
+
+    void add_dark(raw_pixels data, worker_pool& pool);
+    void add_flat(raw_pixels data, worker_pool& pool);
+
+    int darks() const { return darks_; }
+    int flats() const { return flats_; }
+
+    /** Take the accumulated set, and start accumulating a new one. */
+    std::shared_ptr<FlatfieldSet> take();
+
+  private:
+    void add_(raw_pixels data, std::vector<float>& mean, int& count,
+              worker_pool& pool);
+    void reset_();
+
+    size_t pixels_;
+    std::vector<float> dark_;
+    std::vector<float> flat_;
+    std::vector<float> reciproc_;
+    int darks_ = 0;
+    int flats_ = 0;
 };
 
 struct Neglogger {
     void apply(Projection proj) const;
 };
 
-struct FDKScaler {
-    std::vector<float> weights;
-    void apply(Projection proj, int proj_idx) const;
+/**
+ * The FDK (cosine) weights. For a projection with source `s`, detector origin
+ * `d` and pixel vectors `t1` (columns) and `t2` (rows), the weight of pixel
+ * `(r, c)` is `rho / |a + r * t2 + c * t1|`, with `a = d - s` and
+ * `rho = |a|`. This only depends on a few inner products of these vectors,
+ * which are stored per projection.
+ *
+ * For circular geometries the weights are the same for every projection, and
+ * a single plane of weights is stored. Otherwise, the weights are computed on
+ * the fly, one row at a time.
+ */
+class FDKScaler {
+  public:
+    // rho, a.a, 2 a.t1, 2 a.t2, t1.t1, t2.t2, 2 t1.t2
+    using coefficients = std::array<float, 7>;
+
+    FDKScaler(int rows, int cols, std::vector<coefficients> projections);
+
+    /**
+     * Weight a projection. Unless the weights are shared, they are computed
+     * a row at a time into `weights` (scratch space for `cols` weights).
+     */
+    void apply(Projection proj, int proj_idx, float* weights) const;
+
+    /** Compute the weights of a single row of a projection. */
+    void row_weights(int proj_idx, int row, float* out) const;
+
+    bool shared() const { return !plane_.empty(); }
+
+    /** The plane of weights of every projection if they are shared, or null. */
+    const float* shared_plane() const {
+        return plane_.empty() ? nullptr : plane_.data();
+    }
+
+  private:
+    int rows_;
+    int cols_;
+    std::vector<coefficients> projections_;
+    std::vector<float> plane_;
 };
 
-struct Paganin {
-    Paganin(settings parameters, acquisition::geometry geom, float* data);
+/**
+ * Paganin phase retrieval of flat fielded projections. The projections are
+ * padded (by repeating their edges) to smooth sizes, and a few of them are
+ * transformed together in a single batched 2D FFT. The result is the
+ * (scaled) negative log of the filtered intensity, i.e. the projected
+ * thickness.
+ */
+class Paganin {
+  public:
+    Paganin(settings parameters, acquisition::geometry geom);
+    ~Paganin();
+
+    Paganin(const Paganin&) = delete;
+    Paganin& operator=(const Paganin&) = delete;
+
+    /** The number of projections that are transformed together. */
+    int batch() const { return batch_; }
+
+    /**
+     * Retrieve the phase of `count` (at most `batch()`) projections, stored
+     * one after the other starting at `proj.data`, in place. `s` selects the
+     * scratch buffers of the calling worker.
+     */
+    void apply(Projection proj, int count, int s);
 
-    void apply(Projection proj, int s);
+    /**
+     * Switch to the filter of new physical parameters. Recently used filters
+     * are cached, so switching back and forth (e.g. from the UI) does not
+     * recompute them. Safe to call while projections are being processed.
+     */
+    void set_parameters(paganin_settings paganin);
 
   private:
-    fftwf_plan fft2d_plan_;
-    fftwf_plan ffti2d_plan_;
-    std::vector<std::vector<std::complex<float>>> proj_freq_buffer_;
-    std::vector<float> paganin_filter_;
-    paganin_settings paganin_;
+    struct filter_set {
+        paganin_settings paganin;
+        // the half spectrum, including the normalization of the inverse FFT
+        std::vector<float> filter;
+        // converts the log of the intensity into a thickness
+        float scale;
+    };
+
+    // the size a dimension of the projections is padded to
+    static int padded_size_(int size);
+    void pad_(const float* proj, float* padded) const;
+
+    int rows_;
+    int cols_;
+    int ny_;
+    int nx_;
+    int freq_cols_;
+    int batch_;
+
+    // per thread buffers, holding a batch of padded projections and their
+    // half spectra
+    std::vector<fftw_buffer<float>> real_buffer_;
+    std::vector<fftw_buffer<std::complex<float>>> freq_buffer_;
+
+    // plans for a full batch, and for a single (left over) projection
+    fftwf_plan fft_plan_;
+    fftwf_plan ffti_plan_;
+    fftwf_plan fft_single_plan_;
+    fftwf_plan ffti_single_plan_;
+
+    std::shared_ptr<filter_set> filter_;
+    std::vector<std::shared_ptr<filter_set>> cache_;
+    std::mutex cache_mutex_;
 };
 
 class Filterer {
   public:
-    Filterer(settings parameters, acquisition::geometry geom, float* data);
+    Filterer(settings parameters, acquisition::geometry geom);
+    ~Filterer();
+
+    Filterer(const Filterer&) = delete;
+    Filterer& operator=(const Filterer&) = delete;
 
-    void set_filter(std::vector<float> filter) { filter_ = filter; }
+    /**
+     * Replace the filter, given as `padded_cols() / 2 + 1` frequency bins
+     * (or that many for each projection).
+     */
+    void set_filter(std::vector<float> filter);
 
-    void apply(Projection proj, int s, int proj_idx);
+    /** The length the rows are padded to before they are transformed. */
+    int padded_cols() const { return n_; }
+
+    /**
+     * Filter all the rows of a projection, which are padded and then
+     * transformed in a single batched FFT. Row `i` of the result is written
+     * to `out + i * out_stride`, which may point into `proj` itself.
+     */
+    void apply(Projection proj, int s, int proj_idx, float* out,
+               size_t out_stride);
 
   private:
-    std::vector<std::vector<std::complex<float>>> freq_buffer_;
+    void pad_(const float* row, float* padded) const;
+
+    int rows_;
+    int cols_;
+    int n_;
+    int freq_cols_;
+    padding padding_;
+
+    // per thread buffers, holding the padded rows and their half spectra
+    std::vector<fftw_buffer<float>> real_buffer_;
+    std::vector<fftw_buffer<std::complex<float>>> freq_buffer_;
+
+    // the filter including the normalization of the inverse transform
     std::vector<float> filter_;
     fftwf_plan fft_plan_;
     fftwf_plan ffti_plan_;
@@ -77,14 +308,76 @@ class Filterer {
 
 } // namespace detail
 
+/**
+ * The destination of processed projections: the sinogram of a buffer of
+ * `count` projections, in `[rows][count][cols]` layout. If `split` lies in
+ * `(0, count)`, the projections before and after it are stored as two
+ * separate sinograms, one after the other, as is needed when the buffer
+ * wraps around the end of the geometry. The sinogram starts at projection
+ * `first`, so that a single group can be stored on its own.
+ */
+struct sino_target {
+    float* data;
+    int rows;
+    int cols;
+    int count;
+    int split = 0;
+    int first = 0;
+
+    /** The first row of projection `proj`, and the stride between its rows. */
+    std::pair<float*, size_t> rows_of(int proj) const {
+        proj -= first;
+        auto two = split > 0 && split < count;
+        auto begin = (two && proj >= split) ? split : 0;
+        auto size = two ? (proj >= split ? count - split : split) : count;
+        return {data + (size_t)begin * rows * cols +
+                    (size_t)(proj - begin) * cols,
+                (size_t)size * cols};
+    }
+};
+
 class ProjectionProcessor {
   public:
-    ProjectionProcessor(settings param, acquisition::geometry geom)
-        : param_(param), geom_(geom) {}
+    ProjectionProcessor(settings param, acquisition::geometry geom);
+
+    /**
+     * Process the projections [proj_id_begin, ..., proj_id_end] of the
+     * target, stored one after the other in `data` (which is used as scratch
+     * space). The rows of the result are written directly into the sinogram.
+     * The first projection is projection `geom_id_begin` of the geometry,
+     * which selects its filter and FDK weights (the ids wrap around the
+     * geometry).
+     *
+     * If `inputs` is given, the raw projection `i` is instead read from
+     * `inputs[i]` (unless it is a null pointer), without copying it into
+     * `data` first. If `received` is given, projection `i` is skipped if
+     * `received[i]` is zero, and its rows in the sinogram are left as is.
+     */
+    void process(float* data, int proj_id_begin, int proj_id_end,
+                 int geom_id_begin, sino_target target,
+                 const raw_pixels* inputs = nullptr,
+                 const char* received = nullptr);
+
+    /**
+     * Add a dark (or flat) field to the running means of the next flat field
+     * set. This is parallelized over the pixels.
+     */
+    void add_dark(raw_pixels data) { accumulator_.add_dark(data, pool_); }
+    void add_flat(raw_pixels data) { accumulator_.add_flat(data, pool_); }
 
-    void process(float* data, int proj_id_begin, int proj_id_end);
+    /** The number of darks and flats in the next flat field set. */
+    int darks() const { return accumulator_.darks(); }
+    int flats() const { return accumulator_.flats(); }
 
-    std::unique_ptr<detail::Flatfielder> flatfielder;
+    /**
+     * Start using the accumulated darks and flats. The set is swapped in
+     * atomically, projections that are being processed keep using the
+     * previous set.
+     */
+    void swap_flatfield();
+
+    // whether to flat field the projections, with the current set
+    bool flatfielding = false;
     std::unique_ptr<detail::Neglogger> neglog;
     std::unique_ptr<detail::Filterer> filterer;
     std::unique_ptr<detail::Paganin> paganin;
@@ -94,7 +387,15 @@ class ProjectionProcessor {
     settings param_;
     acquisition::geometry geom_;
 
-    bulk::thread::environment env_;
+    worker_pool pool_;
+
+    detail::FlatfieldAccumulator accumulator_;
+    std::shared_ptr<detail::FlatfieldSet> flatfield_;
+
+    // a row of FDK weights per worker, for weights that are computed on the
+    // fly
+    std::vector<float> weight_rows_;
+    float* weight_row_(int s) { return &weight_rows_[(size_t)s * geom_.cols]; }
 };
 
 } // namespace slicerecon::util
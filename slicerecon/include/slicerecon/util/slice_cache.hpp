@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "data_types.hpp"
+
+namespace slicerecon::util {
+
+/** Counters of a slice cache, for diagnostics. */
+struct slice_cache_stats {
+    int64_t hits = 0;
+    int64_t misses = 0;
+    int64_t evictions = 0;
+    // the slices that are cached right now, and their size (in bytes)
+    int64_t entries = 0;
+    std::size_t bytes = 0;
+};
+
+/**
+ * What a reconstructed slice depends on: its orientation (quantized, so that
+ * a slice that is requested again maps onto the same key), its size, and the
+ * buffer it was reconstructed from along with the generation of the data in
+ * that buffer.
+ */
+struct slice_key {
+    std::array<int32_t, 9> orientation;
+    int32_t size;
+    int32_t buffer;
+    uint64_t generation;
+
+    slice_key(const slicerecon::orientation& x, int32_t slice_size,
+              int32_t buffer_idx, uint64_t data_generation);
+
+    bool operator==(const slice_key& other) const {
+        return orientation == other.orientation && size == other.size &&
+               buffer == other.buffer && generation == other.generation;
+    }
+};
+
+/**
+ * A least recently used cache of reconstructed slices, bounded by the memory
+ * their data takes up. Slices are resent (e.g. all of them after every
+ * preview) far more often than the data they are reconstructed from changes,
+ * such a slice is copied from the cache instead of reconstructed again.
+ */
+class slice_cache {
+  public:
+    /** A cache of at most `capacity` bytes of slices, zero disables it. */
+    explicit slice_cache(std::size_t capacity);
+
+    /** The slice stored for `key`, if any, which is then the most recent. */
+    std::optional<slice_data> find(const slice_key& key);
+
+    /** Store `slice` for `key`, evicting the least recently used slices. */
+    void insert(const slice_key& key, const slice_data& slice);
+
+    /** Drop every slice. */
+    void clear();
+
+    slice_cache_stats stats() const;
+
+  private:
+    struct key_hash {
+        std::size_t operator()(const slice_key& key) const;
+    };
+
+    using entry = std::pair<slice_key, slice_data>;
+
+    std::size_t capacity_;
+
+    // the slices, from most to least recently used
+    std::list<entry> entries_;
+    std::unordered_map<slice_key, std::list<entry>::iterator, key_hash> index_;
+    slice_cache_stats stats_;
+
+    mutable std::mutex mutex_;
+};
+
+} // namespace slicerecon::util
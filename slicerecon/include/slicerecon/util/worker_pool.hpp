@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace slicerecon::util {
+
+/**
+ * A fixed set of long-lived worker threads, that execute batches of
+ * independent tasks.
+ *
+ * The pool is meant for fine-grained, frequent work (such as processing a
+ * group of a handful of projections), for which spawning threads on every
+ * call is too expensive. Idle workers spin for a short while before they go
+ * to sleep on a futex, so that back-to-back batches are picked up without a
+ * system call.
+ *
+ * The tasks of a batch are divided into contiguous ranges, one per worker.
+ * Workers take tasks from the front of their own range, and once it is
+ * exhausted, steal the back half of the range of another worker. This
+ * balances out tasks of uneven cost.
+ */
+class worker_pool {
+  public:
+    /**
+     * Construct a pool of `workers` workers. The calling thread of `run` acts
+     * as the first worker, so `workers - 1` threads are started. If `cores`
+     * is not empty, the started threads are pinned (round robin) to the
+     * given cores.
+     */
+    explicit worker_pool(int workers, std::vector<int32_t> cores = {});
+    ~worker_pool();
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    /**
+     * Call `f(task, worker)` for every `task` in `[0, tasks)`, and wait for
+     * all of them to finish. The worker index is in `[0, size())`, and can
+     * be used to select per-thread scratch space. An exception thrown by a
+     * task is rethrown here, after the remaining tasks have finished.
+     *
+     * Batches can not be nested, and `run` should only be called from one
+     * thread at a time.
+     */
+    template <typename F>
+    void run(int tasks, F&& f) {
+        using callable = std::remove_reference_t<F>;
+        run_(tasks,
+             [](void* ctx, int task, int worker) {
+                 (*static_cast<callable*>(ctx))(task, worker);
+             },
+             const_cast<void*>(static_cast<const void*>(&f)));
+    }
+
+    /** The number of workers, including the calling thread. */
+    int size() const { return workers_; }
+
+    /** The total number of (successful) steals, for diagnostics. */
+    int64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+  private:
+    using task_fn = void (*)(void*, int, int);
+
+    struct alignas(64) queue {
+        // [begin, end) packed in a single word, so that the owner and the
+        // thieves can update it with a single compare-and-swap
+        std::atomic<uint64_t> range = {0};
+    };
+
+    void run_(int tasks, task_fn fn, void* ctx);
+    void loop_(int worker, std::vector<int32_t> cores);
+    void work_(int worker);
+    void execute_(int task, int worker);
+
+    int workers_;
+    int spin_iterations_;
+    std::unique_ptr<queue[]> queues_;
+    std::vector<std::thread> threads_;
+
+    // the current batch
+    task_fn fn_ = nullptr;
+    void* ctx_ = nullptr;
+    std::exception_ptr error_;
+    std::mutex error_mutex_;
+
+    // bumped to start a batch, and used as the futex word idle workers sleep on
+    alignas(64) std::atomic<uint32_t> generation_ = {0};
+    std::atomic<int32_t> sleepers_ = {0};
+    std::atomic<bool> stop_ = {false};
+
+    // the number of workers done with the current batch
+    alignas(64) std::atomic<uint32_t> finished_ = {0};
+    std::atomic<bool> waiting_ = {false};
+
+    std::atomic<int64_t> steals_ = {0};
+};
+
+} // namespace slicerecon::util
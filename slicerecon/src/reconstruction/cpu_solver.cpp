@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include <Eigen/Eigen>
+
+#include "slicerecon/reconstruction/reconstructor.hpp"
+#include "slicerecon/util/bench.hpp"
+#include "slicerecon/util/kernels.hpp"
+
+namespace slicerecon::detail {
+
+namespace {
+
+// the lines of voxels of a task, all projections are backprojected onto a
+// few neighbouring lines at a time, which mostly sample the same detector
+// pixels
+constexpr int lines_per_task = 4;
+
+/**
+ * The detector coordinates of a point `p` are affine in `p` for parallel
+ * beam: `(p - d) . a` for the column, and `(p - d) . b` for the row.
+ */
+struct parallel_projection {
+    Eigen::Vector3f d;
+    Eigen::Vector3f a;
+    Eigen::Vector3f b;
+};
+
+/**
+ * For cone beam, a point `p` is projected onto the detector by the ray from
+ * the source `s`. Its depth `w = (p - s) . n` is relative to the detector,
+ * i.e. one for points on the detector, and its detector coordinates are
+ * `((p - s) . a) / w + c_a` and `((p - s) . b) / w + c_b`.
+ */
+struct cone_projection {
+    Eigen::Vector3f s;
+    Eigen::Vector3f n;
+    Eigen::Vector3f a;
+    Eigen::Vector3f b;
+    float c_a;
+    float c_b;
+};
+
+parallel_projection to_projection(const astra::SPar3DProjection& x) {
+    auto r = Eigen::Vector3f(x.fRayX, x.fRayY, x.fRayZ);
+    auto d = Eigen::Vector3f(x.fDetSX, x.fDetSY, x.fDetSZ);
+    auto u = Eigen::Vector3f(x.fDetUX, x.fDetUY, x.fDetUZ);
+    auto v = Eigen::Vector3f(x.fDetVX, x.fDetVY, x.fDetVZ);
+
+    // solve p + t r = d + a u + b v for (a, b)
+    auto a = v.cross(r);
+    auto b = r.cross(u);
+    return {d, a / u.dot(a), b / v.dot(b)};
+}
+
+cone_projection to_projection(const astra::SConeProjection& x) {
+    auto s = Eigen::Vector3f(x.fSrcX, x.fSrcY, x.fSrcZ);
+    auto d = Eigen::Vector3f(x.fDetSX, x.fDetSY, x.fDetSZ);
+    auto u = Eigen::Vector3f(x.fDetUX, x.fDetUY, x.fDetUZ);
+    auto v = Eigen::Vector3f(x.fDetVX, x.fDetVY, x.fDetVZ);
+
+    // the ray hits the detector at s + (p - s) / w, solve for (a, b) there
+    auto normal = u.cross(v);
+    auto a = v.cross(normal);
+    auto b = normal.cross(u);
+    a /= u.dot(a);
+    b /= v.dot(b);
+    return {s, normal / (d - s).dot(normal), a, b, (s - d).dot(a),
+            (s - d).dot(b)};
+}
+
+/** The voxels of a volume, lines along x, in the order of the ASTRA data. */
+struct voxel_grid {
+    explicit voxel_grid(const astra::CVolumeGeometry3D& geom)
+        : nx(geom.getGridColCount()), ny(geom.getGridRowCount()),
+          nz(geom.getGridSliceCount()),
+          origin(geom.getWindowMinX() + 0.5f * geom.getPixelLengthX(),
+                 geom.getWindowMinY() + 0.5f * geom.getPixelLengthY(),
+                 geom.getWindowMinZ() + 0.5f * geom.getPixelLengthZ()),
+          step(geom.getPixelLengthX(), geom.getPixelLengthY(),
+               geom.getPixelLengthZ()) {}
+
+    int lines() const { return ny * nz; }
+
+    // the center of the first voxel of line `l`
+    Eigen::Vector3f start(int l) const {
+        return origin + Eigen::Vector3f(0.0f, (l % ny) * step[1],
+                                        (l / ny) * step[2]);
+    }
+
+    int nx;
+    int ny;
+    int nz;
+    Eigen::Vector3f origin;
+    Eigen::Vector3f step;
+};
+
+util::kernels::voxel_line line_of(const parallel_projection& x,
+                                  const Eigen::Vector3f& p, float dx) {
+    auto q = p - x.d;
+    return {q.dot(x.a), dx * x.a[0], q.dot(x.b), dx * x.b[0]};
+}
+
+util::kernels::voxel_line line_of(const cone_projection& x,
+                                  const Eigen::Vector3f& p, float dx) {
+    auto q = p - x.s;
+    auto w = q.dot(x.n);
+    auto dw = dx * x.n[0];
+    return {q.dot(x.a) + x.c_a * w, dx * x.a[0] + x.c_a * dw,
+            q.dot(x.b) + x.c_b * w, dx * x.b[0] + x.c_b * dw,
+            w, dw};
+}
+
+void backproject_line(const parallel_projection&, const float* projection,
+                      int rows, int cols, const util::kernels::voxel_line& l,
+                      float* out, int n) {
+    util::kernels::backproject_parallel(projection, rows, cols, l, out, n);
+}
+
+void backproject_line(const cone_projection&, const float* projection,
+                      int rows, int cols, const util::kernels::voxel_line& l,
+                      float* out, int n) {
+    util::kernels::backproject_cone(projection, rows, cols, l, out, n);
+}
+
+// only the detector rows `[row_begin, row_end)` of the projections in
+// `buffer` are read, the rows outside of it are treated as zero
+template <typename Vector>
+void backproject(util::worker_pool& pool,
+                 const astra::CVolumeGeometry3D& vol_geom,
+                 const std::vector<Vector>& vectors,
+                 const std::vector<float>& buffer, int rows, int cols,
+                 int row_begin, int row_end, float* volume) {
+    auto grid = voxel_grid(vol_geom);
+    auto projections = std::vector<decltype(to_projection(vectors[0]))>();
+    projections.reserve(vectors.size());
+    for (auto& x : vectors) {
+        projections.push_back(to_projection(x));
+    }
+
+    auto pixels = (std::size_t)rows * cols;
+    auto tasks = (grid.lines() + lines_per_task - 1) / lines_per_task;
+    pool.run(tasks, [&](int task, int) {
+        auto first = task * lines_per_task;
+        auto last = std::min(first + lines_per_task, grid.lines());
+        auto out = volume + (std::size_t)first * grid.nx;
+        std::fill(out, out + (std::size_t)(last - first) * grid.nx, 0.0f);
+
+        for (std::size_t i = 0; i < projections.size(); ++i) {
+            auto projection =
+                buffer.data() + i * pixels + (std::size_t)row_begin * cols;
+            for (auto l = first; l < last; ++l) {
+                auto line = line_of(projections[i], grid.start(l), grid.step[0]);
+                line.v -= row_begin * line.w;
+                line.dv -= row_begin * line.dw;
+                backproject_line(projections[i], projection,
+                                 row_end - row_begin, cols, line,
+                                 volume + (std::size_t)l * grid.nx, grid.nx);
+            }
+        }
+    });
+}
+
+} // namespace
+
+cpu_solver::cpu_solver(settings parameters, acquisition::geometry geometry)
+    : solver(parameters, geometry) {
+    auto threads = std::max((int)std::thread::hardware_concurrency(), 1);
+    pool_ = std::make_unique<util::worker_pool>(threads);
+
+    buffers_.resize(buffer_count_());
+    for (auto& buffer : buffers_) {
+        buffer.assign((std::size_t)geometry_.proj_count * geometry_.rows *
+                          geometry_.cols,
+                      0.0f);
+    }
+
+    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                          << "Backprojecting on the CPU with " << threads
+                          << " threads ("
+                          << util::kernels::instruction_set() << ")"
+                          << slicerecon::util::end_log;
+}
+
+void cpu_solver::upload(int buffer_idx, float* data, int proj_id_begin,
+                        int proj_id_end) {
+    // this runs concurrently with reconstructions from the other buffer, so
+    // it does not use the worker pool
+    auto count = (std::size_t)(proj_id_end - proj_id_begin + 1);
+    auto rows = (std::size_t)geometry_.rows;
+    auto cols = (std::size_t)geometry_.cols;
+    auto& buffer = buffers_[buffer_idx];
+    for (std::size_t i = 0; i < count; ++i) {
+        auto projection = &buffer[(proj_id_begin + i) * rows * cols];
+        for (std::size_t r = 0; r < rows; ++r) {
+            memcpy(projection + r * cols, data + (r * count + i) * cols,
+                   cols * sizeof(float));
+        }
+    }
+}
+
+void cpu_solver::backproject_(
+    const astra::CVolumeGeometry3D& vol_geom,
+    const std::vector<astra::SPar3DProjection>& vectors, int buffer_idx,
+    float* volume, std::pair<int, int> rows) {
+    backproject(*pool_, vol_geom, vectors, buffers_[buffer_idx],
+                geometry_.rows, geometry_.cols, rows.first, rows.second,
+                volume);
+}
+
+void cpu_solver::backproject_(const astra::CVolumeGeometry3D& vol_geom,
+                              const std::vector<astra::SConeProjection>& vectors,
+                              int buffer_idx, float* volume) {
+    backproject(*pool_, vol_geom, vectors, buffers_[buffer_idx],
+                geometry_.rows, geometry_.cols, 0, geometry_.rows, volume);
+}
+
+cpu_parallel_beam_solver::cpu_parallel_beam_solver(
+    settings parameters, acquisition::geometry geometry)
+    : cpu_solver(parameters, geometry) {
+    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                          << "Initializing parallel beam solver (CPU)"
+                          << slicerecon::util::end_log;
+
+    vectors_ = parallel_vectors(geometry_);
+    original_vectors_ = vectors_;
+    vec_buf_ = vectors_;
+
+    if (parameters_.gridrec) {
+        gridrec_ =
+            std::make_unique<gridrec>(parameters_, geometry_, *vol_geom_, *pool_);
+    }
+    if (parameters_.hierarchical_tolerance > 0.0f) {
+        hierarchical_ = std::make_unique<hierarchical_backprojector>(
+            parameters_, geometry_, *vol_geom_, *pool_);
+    }
+}
+
+slice_data cpu_parallel_beam_solver::reconstruct_slice(orientation x,
+                                                       int buffer_idx) {
+    auto dt = util::bench_scope("slice");
+
+    slice_vectors(vectors_, vec_buf_, x, vol_geom_->getWindowMaxX(),
+                  geometry_);
+    log_slice(x, buffer_idx);
+
+    auto n = parameters_.slice_size;
+    auto result = std::vector<float>((std::size_t)n * n, 0.0f);
+    auto pixels = (std::size_t)geometry_.rows * geometry_.cols;
+    if (gridrec_ && gridrec_->reconstruct(vec_buf_, buffers_[buffer_idx].data(),
+                                          pixels, geometry_.cols,
+                                          result.data())) {
+        return {{n, n}, std::move(result)};
+    }
+    if (hierarchical_ &&
+        hierarchical_->reconstruct(vec_buf_, buffers_[buffer_idx].data(),
+                                   pixels, geometry_.cols, result.data())) {
+        return {{n, n}, std::move(result)};
+    }
+
+    // only the detector rows the slice projects onto are read, and a slice
+    // that misses the detector is not backprojected at all
+    auto rows = detector_rows(*vol_geom_, vec_buf_, geometry_.rows);
+    if (rows.first < rows.second) {
+        backproject_(*vol_geom_, vec_buf_, buffer_idx, result.data(), rows);
+    }
+
+    return {{n, n}, std::move(result)};
+}
+
+void cpu_parallel_beam_solver::reconstruct_preview(
+    std::vector<float>& preview_buffer, int buffer_idx) {
+    auto dt = util::bench_scope("3D preview");
+
+    backproject_(*vol_geom_small_, vectors_, buffer_idx,
+                 preview_buffer.data(), {0, geometry_.rows});
+
+    // scaled like the GPU preview
+    float factor = (parameters_.preview_size / (float)geometry_.cols);
+    for (auto& x : preview_buffer) {
+        x *= (factor * factor * factor);
+    }
+}
+
+bool cpu_parallel_beam_solver::parameter_changed(
+    std::string parameter, std::variant<float, std::string, bool> value) {
+    bool tilt_changed = false;
+    if (parameter == "tilt angle") {
+        tilt_changed = true;
+        tilt_rotate_ = std::get<float>(value);
+    } else if (parameter == "tilt translate") {
+        tilt_changed = true;
+        tilt_translate_ = std::get<float>(value);
+    }
+
+    if (tilt_changed) {
+        tilt_vectors(original_vectors_, vectors_, tilt_rotate_,
+                     tilt_translate_);
+    }
+
+    return tilt_changed;
+}
+
+std::vector<
+    std::pair<std::string, std::variant<float, std::vector<std::string>, bool>>>
+cpu_parallel_beam_solver::parameters() {
+    if (!parameters_.tilt_axis) {
+        return {};
+    }
+    return {{"tilt angle", 0.0f}, {"tilt translate", 0.0f}};
+}
+
+cpu_cone_beam_solver::cpu_cone_beam_solver(settings parameters,
+                                           acquisition::geometry geometry)
+    : cpu_solver(parameters, geometry) {
+    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                          << "Initializing cone beam solver (CPU)"
+                          << slicerecon::util::end_log;
+
+    vectors_ = cone_vectors(geometry_);
+    vec_buf_ = vectors_;
+}
+
+slice_data cpu_cone_beam_solver::reconstruct_slice(orientation x,
+                                                   int buffer_idx) {
+    auto dt = util::bench_scope("slice");
+
+    slice_vectors(vectors_, vec_buf_, x, vol_geom_->getWindowMaxX(),
+                  geometry_);
+    log_slice(x, buffer_idx);
+
+    auto n = parameters_.slice_size;
+    auto result = std::vector<float>((std::size_t)n * n);
+    backproject_(*vol_geom_, vec_buf_, buffer_idx, result.data());
+
+    return {{n, n}, std::move(result)};
+}
+
+void cpu_cone_beam_solver::reconstruct_preview(
+    std::vector<float>& preview_buffer, int buffer_idx) {
+    auto dt = util::bench_scope("3D preview");
+
+    backproject_(*vol_geom_small_, vectors_, buffer_idx,
+                 preview_buffer.data());
+}
+
+std::unique_ptr<util::detail::FDKScaler> cpu_cone_beam_solver::fdk_weights() {
+    return detail::fdk_weights(vectors_, geometry_);
+}
+
+} // namespace slicerecon::detail
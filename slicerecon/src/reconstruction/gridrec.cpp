@@ -0,0 +1,393 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "slicerecon/reconstruction/gridrec.hpp"
+#include "slicerecon/util/log.hpp"
+
+namespace slicerecon::detail {
+
+namespace {
+
+// the rows are transformed and spread in chunks of a few projections, which
+// bounds the memory for their samples
+constexpr int views_per_chunk = 32;
+
+// the columns of the grid are transformed a few at a time, after copying
+// them into contiguous memory
+constexpr int columns_per_task = 8;
+
+// the kernel is tabulated (and linearly interpolated) at this many points
+// per grid cell
+constexpr int table_resolution = 4096;
+
+// the 'exponential of semicircle' kernel, for `u` in cells from its center
+float es_kernel(double u, int width) {
+    auto beta = 2.30 * width;
+    auto x = 2.0 * u / width;
+    auto r = 1.0 - x * x;
+    return r > 0.0 ? (float)std::exp(beta * (std::sqrt(r) - 1.0)) : 0.0f;
+}
+
+// the reciprocal of the Fourier transform of the kernel, at the frequencies
+// `t - n / 2` for `t` in `[0, n)`, on a grid of `size` cells
+std::vector<float> inverse_kernel(int n, int size, int width) {
+    // (the kernel vanishes smoothly at its edges, so the midpoint rule
+    // converges quickly)
+    constexpr int points = 512;
+    auto du = (double)width / points;
+    auto result = std::vector<float>(n);
+    for (int t = 0; t < n; ++t) {
+        auto frequency = 2.0 * M_PI * (t - n / 2) / size;
+        auto total = 0.0;
+        for (int k = 0; k < points; ++k) {
+            auto u = -0.5 * width + (k + 0.5) * du;
+            total += es_kernel(u, width) * std::cos(frequency * u);
+        }
+        result[t] = (float)(1.0 / (total * du));
+    }
+    return result;
+}
+
+int wrap(int x, int n) {
+    x %= n;
+    return x < 0 ? x + n : x;
+}
+
+} // namespace
+
+gridrec::gridrec(const settings& parameters,
+                 const acquisition::geometry& geometry,
+                 const astra::CVolumeGeometry3D& vol_geom,
+                 util::worker_pool& pool)
+    : pool_(pool), rows_(geometry.rows), cols_(geometry.cols),
+      nx_(vol_geom.getGridColCount()), ny_(vol_geom.getGridRowCount()),
+      hx_(vol_geom.getPixelLengthX()), hy_(vol_geom.getPixelLengthY()),
+      length_(util::filter::padded_size(geometry.cols)), bins_(length_ / 2),
+      grid_size_(util::filter::padded_size(std::max(nx_, ny_))) {
+    // the grid is indexed by `t = i - n / 2`, so that `t = 0` is near the
+    // center of the slice
+    origin_ = {vol_geom.getWindowMinX() + (nx_ / 2 + 0.5f) * hx_,
+               vol_geom.getWindowMinY() + (ny_ / 2 + 0.5f) * hy_,
+               0.5f * (vol_geom.getWindowMinZ() + vol_geom.getWindowMaxZ())};
+    extent_ = {vol_geom.getWindowMaxX() - vol_geom.getWindowMinX(),
+               vol_geom.getWindowMaxY() - vol_geom.getWindowMinY()};
+
+    inverse_kernel_x_ = inverse_kernel(nx_, grid_size_, kernel_width);
+    inverse_kernel_y_ = inverse_kernel(ny_, grid_size_, kernel_width);
+    kernel_table_.resize(kernel_width * table_resolution + 2);
+    for (std::size_t k = 0; k < kernel_table_.size(); ++k) {
+        kernel_table_[k] = es_kernel(
+            (double)k / table_resolution - 0.5 * kernel_width, kernel_width);
+    }
+
+    // the negative frequencies are folded onto the positive ones, and
+    // halved again for the sample and its mirror image. The response of
+    // linear interpolation is applied, so that the slices are as sharp as
+    // backprojected ones
+    bin_weights_.resize(bins_);
+    for (int m = 0; m < bins_; ++m) {
+        auto x = M_PI * m / length_;
+        auto sinc = m == 0 ? 1.0 : std::sin(x) / x;
+        bin_weights_[m] = (m == 0 ? 0.5 : 1.0) * sinc * sinc / length_;
+    }
+
+    views_.resize(geometry.proj_count);
+    values_.resize((std::size_t)views_per_chunk * bins_);
+    samples_.resize((std::size_t)views_per_chunk * bins_);
+
+    auto half = grid_size_ / 2 + 1;
+    for (int w = 0; w < pool_.size(); ++w) {
+        row_buffer_.push_back(
+            util::detail::fftw_alloc<float>(std::max(length_, grid_size_)));
+        freq_buffer_.push_back(util::detail::fftw_alloc<std::complex<float>>(
+            std::max(length_ / 2 + 1, half)));
+        column_buffer_.push_back(util::detail::fftw_alloc<std::complex<float>>(
+            (std::size_t)columns_per_task * grid_size_));
+    }
+
+    auto flags = util::detail::planner_flags(parameters);
+    auto row = row_buffer_[0].get();
+    auto freq = reinterpret_cast<fftwf_complex*>(freq_buffer_[0].get());
+    auto column = reinterpret_cast<fftwf_complex*>(column_buffer_[0].get());
+    row_plan_ = fftwf_plan_dft_r2c_1d(length_, row, freq, flags);
+    column_plan_ = fftwf_plan_many_dft(1, &grid_size_, columns_per_task,
+                                       column, nullptr, 1, grid_size_, column,
+                                       nullptr, 1, grid_size_, FFTW_BACKWARD,
+                                       flags);
+    slice_plan_ = fftwf_plan_dft_c2r_1d(grid_size_, freq, row, flags);
+
+    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                          << "Gridding horizontal slices onto a "
+                          << grid_size_ << " x " << grid_size_
+                          << " grid, rows padded to " << length_
+                          << slicerecon::util::end_log;
+}
+
+gridrec::~gridrec() {
+    fftwf_destroy_plan(row_plan_);
+    fftwf_destroy_plan(column_plan_);
+    fftwf_destroy_plan(slice_plan_);
+}
+
+bool gridrec::reconstruct(const std::vector<astra::SPar3DProjection>& vectors,
+                          const float* data, std::size_t projection_stride,
+                          std::size_t row_stride, float* slice) {
+    if (!set_slice_(vectors)) {
+        return false;
+    }
+
+    auto half = grid_size_ / 2 + 1;
+    if (!grid_) {
+        grid_ = util::detail::fftw_alloc<std::complex<float>>(
+            (std::size_t)grid_size_ * half);
+    }
+
+    // the grid is divided into strips of rows, one per worker, so that the
+    // samples can be spread without synchronization
+    auto strips = pool_.size();
+    pool_.run(strips, [&](int strip, int) {
+        auto begin = (std::size_t)strip * grid_size_ / strips * half;
+        auto end = (std::size_t)(strip + 1) * grid_size_ / strips * half;
+        std::fill(grid_.get() + begin, grid_.get() + end,
+                  std::complex<float>(0.0f));
+    });
+
+    auto count = (int)views_.size();
+    for (int first = 0; first < count; first += views_per_chunk) {
+        auto n = std::min(views_per_chunk, count - first);
+        spectra_(data, projection_stride, row_stride, first, n);
+        pool_.run(strips,
+                  [&](int strip, int) { spread_(n, strip, strips); });
+    }
+
+    transform_(slice);
+    return true;
+}
+
+bool gridrec::set_slice_(const std::vector<astra::SPar3DProjection>& vectors) {
+    auto lowest = std::numeric_limits<float>::max();
+    auto highest = std::numeric_limits<float>::lowest();
+
+    int i = 0;
+    for (auto [rx, ry, rz, dx, dy, dz, pxx, pxy, pxz, pyx, pyy, pyz] :
+         vectors) {
+        auto r = Eigen::Vector3f(rx, ry, rz);
+        auto d = Eigen::Vector3f(dx, dy, dz);
+        auto px = Eigen::Vector3f(pxx, pxy, pxz);
+        auto py = Eigen::Vector3f(pyx, pyy, pyz);
+
+        // the detector coordinates of p solve p + t r = d + a px + b py
+        auto a = py.cross(r);
+        auto b = r.cross(px);
+        a /= px.dot(a);
+        b /= py.dot(b);
+
+        // the detector row may not change by more than a fraction of a pixel
+        // over the slice
+        if (std::abs(b[0]) * extent_[0] + std::abs(b[1]) * extent_[1] >
+            1.0e-3f) {
+            return false;
+        }
+
+        auto row = (origin_ - d).dot(b);
+        auto s0 = (origin_ - d).dot(a);
+        auto& v = views_[i++];
+        v = {row > -0.5f && row < rows_ + 0.5f, row, s0, a[0] * hx_,
+             a[1] * hy_};
+        if (!v.active) {
+            continue;
+        }
+
+        for (auto tx : {-(nx_ / 2), nx_ - 1 - nx_ / 2}) {
+            for (auto ty : {-(ny_ / 2), ny_ - 1 - ny_ / 2}) {
+                auto s = v.s0 + tx * v.ds_x + ty * v.ds_y;
+                lowest = std::min(lowest, s);
+                highest = std::max(highest, s);
+            }
+        }
+    }
+
+    // the rows are zero padded to `length_`, and are periodic beyond that,
+    // so the slice has to project onto `[cols - length, length)`
+    return lowest > highest ||
+           (lowest >= cols_ - length_ + 1 && highest <= length_ - 1);
+}
+
+void gridrec::spectra_(const float* data, std::size_t projection_stride,
+                       std::size_t row_stride, int first, int count) {
+    auto ratio = (double)grid_size_ / length_;
+    pool_.run(count, [&](int task, int worker) {
+        auto& v = views_[first + task];
+        auto values = &values_[(std::size_t)task * bins_];
+        auto samples = &samples_[(std::size_t)task * bins_];
+        if (!v.active) {
+            std::fill(values, values + bins_, std::complex<float>(0.0f));
+            return;
+        }
+
+        // interpolate the row of the slice, and zero pad it
+        auto row = row_buffer_[worker].get();
+        std::fill(row, row + length_, 0.0f);
+        auto r0 = (int)std::floor(v.row - 0.5f);
+        auto f = v.row - 0.5f - r0;
+        for (auto [r, weight] : {std::pair{r0, 1.0f - f}, {r0 + 1, f}}) {
+            if (r < 0 || r >= rows_ || weight == 0.0f) {
+                continue;
+            }
+            auto source = data + (std::size_t)(first + task) * projection_stride +
+                          (std::size_t)r * row_stride;
+            for (int c = 0; c < cols_; ++c) {
+                row[c] += weight * source[c];
+            }
+        }
+
+        auto freq = freq_buffer_[worker].get();
+        fftwf_execute_dft_r2c(row_plan_, row,
+                              reinterpret_cast<fftwf_complex*>(freq));
+
+        // the row at column `s0 + x` is `sum_m w_m Q_m exp(2 pi i m (s0 - 0.5
+        // + x) / L)`, see `bin_weights_`. The samples are spread with their
+        // mirror image onto the Hermitian half of the grid
+        auto step = std::polar(1.0, 2.0 * M_PI * (v.s0 - 0.5) / length_);
+        auto phase = std::complex<double>(1.0);
+        for (int m = 0; m < bins_; ++m) {
+            auto value = std::complex<float>(
+                bin_weights_[m] * phase * std::complex<double>(freq[m]));
+            phase *= step;
+
+            // (in double precision, the positions can be thousands of cells)
+            auto xi_x = m * v.ds_x * ratio;
+            auto xi_y = m * v.ds_y * ratio;
+
+            // of a sample and its mirror image, the one that lies in the
+            // Hermitian half is kept, only samples near its edges reach both
+            auto wrapped = xi_x - grid_size_ * std::floor(xi_x / grid_size_);
+            if (wrapped > 0.5 * grid_size_) {
+                xi_x = -xi_x;
+                xi_y = -xi_y;
+                value = std::conj(value);
+            }
+            values[m] = value;
+
+            auto& sample = samples[m];
+            auto x0 = std::ceil(xi_x - 0.5 * kernel_width);
+            auto y0 = std::ceil(xi_y - 0.5 * kernel_width);
+            sample.x = wrap((int)x0, grid_size_);
+            sample.y = wrap((int)y0, grid_size_);
+            sample.inside = sample.x > 0 &&
+                            sample.x + kernel_width <= grid_size_ / 2;
+            auto kernel = [&](double u) {
+                auto k = (float)((u + 0.5 * kernel_width) * table_resolution);
+                auto i = std::clamp((int)k, 0, (int)kernel_table_.size() - 2);
+                auto t = k - i;
+                return kernel_table_[i] +
+                       t * (kernel_table_[i + 1] - kernel_table_[i]);
+            };
+            for (int j = 0; j < kernel_width; ++j) {
+                sample.weight_x[j] = kernel(x0 + j - xi_x);
+                sample.weight_y[j] = kernel(y0 + j - xi_y);
+            }
+        }
+    });
+}
+
+void gridrec::spread_(int count, int strip, int strips) {
+    auto half = grid_size_ / 2 + 1;
+    auto begin = strip * grid_size_ / strips;
+    auto end = (strip + 1) * grid_size_ / strips;
+    auto grid = grid_.get();
+    auto mirror = [&](int x) { return x == 0 ? 0 : grid_size_ - x; };
+
+    // near the edges of the Hermitian half, a sample is spread cell by cell,
+    // together with its mirror image
+    auto add = [&](int y, const sample& s, std::complex<float> value,
+                   bool mirrored) {
+        auto out = grid + (std::size_t)y * half;
+        for (int j = 0; j < kernel_width; ++j) {
+            auto x = s.x + j;
+            x = x >= grid_size_ ? x - grid_size_ : x;
+            x = mirrored ? mirror(x) : x;
+            if (x < half) {
+                out[x] += s.weight_x[j] * value;
+            }
+        }
+    };
+
+    for (std::size_t k = 0; k < (std::size_t)count * bins_; ++k) {
+        auto value = values_[k];
+        if (value == std::complex<float>(0.0f)) {
+            continue;
+        }
+        auto& s = samples_[k];
+        for (int j = 0; j < kernel_width; ++j) {
+            auto y = s.y + j;
+            y = y >= grid_size_ ? y - grid_size_ : y;
+            if (s.inside) {
+                if (y >= begin && y < end) {
+                    auto out = grid + (std::size_t)y * half + s.x;
+                    auto row_value = s.weight_y[j] * value;
+                    for (int i = 0; i < kernel_width; ++i) {
+                        out[i] += s.weight_x[i] * row_value;
+                    }
+                }
+                continue;
+            }
+
+            if (y >= begin && y < end) {
+                add(y, s, s.weight_y[j] * value, false);
+            }
+            auto y_mirror = mirror(y);
+            if (y_mirror >= begin && y_mirror < end) {
+                add(y_mirror, s, s.weight_y[j] * std::conj(value), true);
+            }
+        }
+    }
+}
+
+void gridrec::transform_(float* slice) {
+    auto half = grid_size_ / 2 + 1;
+    auto grid = grid_.get();
+
+    // transform the columns of the (Hermitian half of the) grid
+    auto tasks = (half + columns_per_task - 1) / columns_per_task;
+    pool_.run(tasks, [&](int task, int worker) {
+        auto first = task * columns_per_task;
+        auto n = std::min(columns_per_task, half - first);
+        auto column = column_buffer_[worker].get();
+        for (int y = 0; y < grid_size_; ++y) {
+            auto in = grid + (std::size_t)y * half + first;
+            for (int j = 0; j < columns_per_task; ++j) {
+                column[(std::size_t)j * grid_size_ + y] =
+                    j < n ? in[j] : std::complex<float>(0.0f);
+            }
+        }
+        fftwf_execute_dft(column_plan_,
+                          reinterpret_cast<fftwf_complex*>(column),
+                          reinterpret_cast<fftwf_complex*>(column));
+        for (int y = 0; y < grid_size_; ++y) {
+            auto out = grid + (std::size_t)y * half + first;
+            for (int j = 0; j < n; ++j) {
+                out[j] = column[(std::size_t)j * grid_size_ + y];
+            }
+        }
+    });
+
+    // and only the rows that are part of the slice, then deapodize
+    pool_.run(ny_, [&](int y, int worker) {
+        auto freq = freq_buffer_[worker].get();
+        auto row = row_buffer_[worker].get();
+        auto in = grid + (std::size_t)wrap(y - ny_ / 2, grid_size_) * half;
+        std::copy(in, in + half, freq);
+        fftwf_execute_dft_c2r(slice_plan_,
+                              reinterpret_cast<fftwf_complex*>(freq), row);
+
+        auto out = slice + (std::size_t)y * nx_;
+        for (int x = 0; x < nx_; ++x) {
+            out[x] = row[wrap(x - nx_ / 2, grid_size_)] *
+                     inverse_kernel_x_[x] * inverse_kernel_y_[y];
+        }
+    });
+}
+
+} // namespace slicerecon::detail
@@ -0,0 +1,472 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "slicerecon/reconstruction/hierarchical.hpp"
+#include "slicerecon/util/log.hpp"
+
+namespace slicerecon::detail {
+
+namespace {
+
+// the detector row of a pixel may differ by this much (in pixels) between
+// the projections
+constexpr float row_tolerance = 1.0e-3f;
+
+// the groups are backprojected onto squares of (at most) this size
+constexpr int leaf_size = 4;
+
+// the extra samples at either end of a piece of a row, which cover the
+// interpolation and the rounding of the shifts
+constexpr int margin = 3;
+
+// the pieces of the top level squares of a worker are limited to this many
+// samples
+constexpr double max_samples = 1 << 23;
+
+// the (relative) costs of interpolating a sample of a piece from the
+// projections, of adding a sample of a parent to a child, and of
+// interpolating a piece for a pixel. Backprojecting a projection onto a
+// pixel costs `direct_cost` (which is 1 on the CPU)
+constexpr double start_cost = 1.0;
+constexpr double split_cost = 0.25;
+constexpr double finish_cost = 2.0;
+
+/**
+ * Add the row of `cols` samples, linearly interpolated at `x0 + j / os`, to
+ * `out[j]` for `j` in `[0, length)`. The row is zero beyond its ends.
+ */
+void add_interpolated(const float* row, int cols, double x0, int os,
+                      float* out, int length) {
+    for (int q = 0; q < std::min(os, length); ++q) {
+        // the samples `q + l * os` lie between the same two columns
+        auto x = x0 + (double)q / os;
+        auto i0 = (int)std::floor(x);
+        auto f = (float)(x - i0);
+        auto count = (length - q + os - 1) / os;
+        auto dst = out + q;
+
+        // both columns `i0 + l` and `i0 + l + 1` are on the detector for
+        // `l` in `[begin, end)`
+        auto begin = std::clamp(-i0, 0, count);
+        auto end = std::clamp(cols - 1 - i0, begin, count);
+        if (begin > 0 && begin == -i0) {
+            dst[(std::size_t)(begin - 1) * os] += f * row[0];
+        }
+        auto src = row + i0;
+        for (int l = begin; l < end; ++l) {
+            dst[(std::size_t)l * os] += src[l] + f * (src[l + 1] - src[l]);
+        }
+        if (end < count && end == cols - 1 - i0) {
+            dst[(std::size_t)end * os] += (1.0f - f) * row[cols - 1];
+        }
+    }
+}
+
+} // namespace
+
+hierarchical_backprojector::hierarchical_backprojector(
+    const settings& parameters, const acquisition::geometry& geometry,
+    const astra::CVolumeGeometry3D& vol_geom, util::worker_pool& pool,
+    double direct_cost)
+    : pool_(pool), direct_cost_(direct_cost), rows_(geometry.rows),
+      cols_(geometry.cols),
+      tolerance_(parameters.hierarchical_tolerance),
+      oversampling_(std::clamp(
+          (int)std::ceil(0.25f / parameters.hierarchical_tolerance - 1.0e-3f),
+          2, 8)),
+      nx_(vol_geom.getGridColCount()), ny_(vol_geom.getGridRowCount()),
+      hx_(vol_geom.getPixelLengthX()), hy_(vol_geom.getPixelLengthY()),
+      block_size_(leaf_size), leaf_size_(leaf_size) {
+    origin_ = {vol_geom.getWindowMinX() + 0.5f * hx_,
+               vol_geom.getWindowMinY() + 0.5f * hy_,
+               0.5f * (vol_geom.getWindowMinZ() + vol_geom.getWindowMaxZ())};
+
+    views_.reserve(geometry.proj_count);
+    scratch_.resize(pool_.size());
+
+    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                          << "Backprojecting oblique slices hierarchically, "
+                             "with a tolerance of "
+                          << tolerance_ << " pixels (sampled "
+                          << oversampling_ << "x)" << slicerecon::util::end_log;
+}
+
+bool hierarchical_backprojector::reconstruct(
+    const std::vector<astra::SPar3DProjection>& vectors, const float* data,
+    std::size_t projection_stride, std::size_t row_stride, float* slice) {
+    if (!set_slice_(vectors)) {
+        return false;
+    }
+
+    // the top level squares are independent of each other, their pixels
+    // that miss the detector are zero
+    auto bx = (nx_ + block_size_ - 1) / block_size_;
+    auto by = (ny_ + block_size_ - 1) / block_size_;
+    pool_.run(bx * by, [&](int block, int worker) {
+        auto x0 = (block % bx) * block_size_;
+        auto y0 = (block / bx) * block_size_;
+        auto x1 = std::min(x0 + block_size_, nx_);
+        auto y1 = std::min(y0 + block_size_, ny_);
+        for (auto y = y0; y < y1; ++y) {
+            std::fill(slice + (std::size_t)y * nx_ + x0,
+                      slice + (std::size_t)y * nx_ + x1, 0.0f);
+        }
+
+        auto n = node{};
+        if (!make_node_(x0, y0, x1, y1, 0, n)) {
+            return;
+        }
+        auto& scratch = scratch_[worker];
+        if (scratch.size() < 32) {
+            scratch.resize(32);
+        }
+        start_(n, data, projection_stride, row_stride, scratch[0]);
+        descend_(n, 0, scratch, slice);
+    });
+
+    return true;
+}
+
+bool hierarchical_backprojector::set_slice_(
+    const std::vector<astra::SPar3DProjection>& vectors) {
+    views_.clear();
+    for (auto [rx, ry, rz, dx, dy, dz, pxx, pxy, pxz, pyx, pyy, pyz] :
+         vectors) {
+        auto r = Eigen::Vector3f(rx, ry, rz);
+        auto d = Eigen::Vector3f(dx, dy, dz);
+        auto px = Eigen::Vector3f(pxx, pxy, pxz);
+        auto py = Eigen::Vector3f(pyx, pyy, pyz);
+
+        // the detector coordinates of p solve p + t r = d + a px + b py
+        auto a = py.cross(r);
+        auto b = r.cross(px);
+        a /= px.dot(a);
+        b /= py.dot(b);
+
+        // (in samples, i.e. with the pixel centers at integers)
+        auto u = (origin_ - d).dot(a) - 0.5f;
+        auto v = (origin_ - d).dot(b) - 0.5f;
+        auto dv = Eigen::Vector2f(b[0] * hx_, b[1] * hy_);
+        if (views_.empty()) {
+            v0_ = v;
+            dv_ = dv;
+        } else if (std::abs(v - v0_) + std::abs(dv[0] - dv_[0]) * nx_ +
+                       std::abs(dv[1] - dv_[1]) * ny_ >
+                   row_tolerance) {
+            return false;
+        }
+        views_.push_back({(int)views_.size(), u, {a[0] * hx_, a[1] * hy_}});
+    }
+    if (views_.empty()) {
+        return false;
+    }
+
+    // views that are next to each other in this order are grouped together
+    std::sort(views_.begin(), views_.end(), [](auto& lhs, auto& rhs) {
+        return std::atan2(lhs.g[1], lhs.g[0]) < std::atan2(rhs.g[1], rhs.g[0]);
+    });
+
+    auto count = (int)views_.size();
+    dg_ = {0.0f, 0.0f};
+    directions_.assign(1, {});
+    deviations_.assign(1, 0.0f);
+    for (auto& x : views_) {
+        directions_[0].push_back(x.g);
+        dg_ = dg_.cwiseMax(x.g.cwiseAbs());
+    }
+    for (int k = 1; (1 << (k - 1)) < count; ++k) {
+        auto groups = groups_(k);
+        auto& mean = directions_.emplace_back(groups, Eigen::Vector2f::Zero());
+        auto deviation = 0.0f;
+        for (int a = 0; a < groups; ++a) {
+            auto begin = a << k;
+            auto end = std::min((a + 1) << k, count);
+            for (auto s = begin; s < end; ++s) {
+                mean[a] += views_[s].g;
+            }
+            mean[a] /= (float)(end - begin);
+            for (auto s = begin; s < end; ++s) {
+                deviation = std::max(deviation, (views_[s].g - mean[a]).norm());
+            }
+        }
+        deviations_.push_back(deviation);
+    }
+
+    // the top level squares are as large as their pieces allow, but small
+    // enough to keep the workers busy, their estimated cost is compared to
+    // that of backprojecting
+    auto best = -1.0;
+    auto pixels = (double)nx_ * ny_;
+    for (auto size = leaf_size_; size < 2 * std::max(nx_, ny_); size *= 2) {
+        auto n = node{};
+        auto x0 = std::max(nx_ / 2 - size / 2, 0);
+        auto y0 = std::max(ny_ / 2 - size / 2, 0);
+        auto x1 = std::min(x0 + size, nx_);
+        auto y1 = std::min(y0 + size, ny_);
+        if (!make_node_(x0, y0, x1, y1, 0, n)) {
+            // the center misses the detector, the slice is mostly empty
+            continue;
+        }
+        auto samples = (double)(n.last_row - n.first_row) * n.length;
+        if (samples * groups_(n.level) > max_samples) {
+            break;
+        }
+
+        auto blocks = (double)((nx_ + size - 1) / size) *
+                      ((ny_ + size - 1) / size);
+        auto rounds = std::ceil(blocks / pool_.size());
+        auto per_pixel = (count * samples * start_cost + cost_(n)) /
+                         ((double)(x1 - x0) * (y1 - y0));
+        auto cost = per_pixel * pixels * rounds * pool_.size() / blocks;
+        if (best < 0.0 || cost < best) {
+            best = cost;
+            block_size_ = size;
+        }
+    }
+
+    return best >= 0.0 && best < pixels * count * direct_cost_;
+}
+
+bool hierarchical_backprojector::make_node_(int x0, int y0, int x1, int y1,
+                                            int level, node& result) const {
+    // the rows that are interpolated for the pixels, the row is affine in
+    // the pixel so its extremes are at the corners
+    auto lowest = std::numeric_limits<float>::max();
+    auto highest = std::numeric_limits<float>::lowest();
+    for (auto x : {x0, x1 - 1}) {
+        for (auto y : {y0, y1 - 1}) {
+            auto v = v0_ + x * dv_[0] + y * dv_[1];
+            lowest = std::min(lowest, v);
+            highest = std::max(highest, v);
+        }
+    }
+    auto first = std::max((int)std::floor(lowest), 0);
+    auto last = std::min((int)std::floor(highest) + 2, rows_);
+    if (first >= last) {
+        return false;
+    }
+
+    // the largest groups for which the views deviate by less than the
+    // tolerance over the square
+    auto w = x1 - x0 - 1;
+    auto h = y1 - y0 - 1;
+    auto radius = 0.5f * std::sqrt((float)(w * w + h * h));
+    auto top = (int)deviations_.size() - 1;
+    while (level < top && radius * deviations_[level + 1] <= tolerance_) {
+        ++level;
+    }
+
+    auto extent = oversampling_ * 0.5 * (w * dg_[0] + h * dg_[1]);
+    result = {x0,
+              y0,
+              x1,
+              y1,
+              level,
+              first,
+              last,
+              2 * ((int)std::ceil(extent) + margin) + 1,
+              {0.5 * (x0 + x1 - 1), 0.5 * (y0 + y1 - 1)}};
+    return true;
+}
+
+int hierarchical_backprojector::groups_(int level) const {
+    return ((int)views_.size() + (1 << level) - 1) >> level;
+}
+
+double hierarchical_backprojector::cost_(const node& n) const {
+    auto w = n.x1 - n.x0;
+    auto h = n.y1 - n.y0;
+    if (w <= leaf_size_ && h <= leaf_size_) {
+        return finish_cost * w * h * groups_(n.level) * 2.0;
+    }
+
+    // the children are (roughly) alike, so one of them is followed
+    auto mx = w > leaf_size_ ? n.x0 + (w + 1) / 2 : n.x1;
+    auto my = h > leaf_size_ ? n.y0 + (h + 1) / 2 : n.y1;
+    auto children = (mx < n.x1 ? 2 : 1) * (my < n.y1 ? 2 : 1);
+    auto child = node{};
+    if (!make_node_(n.x0, n.y0, mx, my, n.level, child)) {
+        return 0.0;
+    }
+    auto samples = (double)(child.last_row - child.first_row) *
+                   groups_(n.level) * child.length;
+    return children * (split_cost * samples + cost_(child));
+}
+
+void hierarchical_backprojector::start_(const node& n, const float* data,
+                                        std::size_t projection_stride,
+                                        std::size_t row_stride,
+                                        pieces& out) {
+    auto groups = groups_(n.level);
+    auto length = n.length;
+    auto middle = length / 2;
+    out.data.assign((std::size_t)(n.last_row - n.first_row) * groups * length,
+                    0.0f);
+    out.offsets.assign(groups, 0.0);
+
+    // the views are interpolated exactly at the center of the square, so
+    // the groups are not offset
+    auto count = (int)views_.size();
+    for (int a = 0; a < groups; ++a) {
+        for (auto s = a << n.level; s < std::min((a + 1) << n.level, count);
+             ++s) {
+            auto& x = views_[s];
+            auto x0 = x.u + n.center.dot(x.g.cast<double>()) -
+                      (double)middle / oversampling_;
+            auto projection = data + (std::size_t)x.index * projection_stride;
+            for (auto r = n.first_row; r < n.last_row; ++r) {
+                add_interpolated(
+                    projection + (std::size_t)r * row_stride, cols_, x0,
+                    oversampling_,
+                    &out.data[((std::size_t)(r - n.first_row) * groups + a) *
+                              length],
+                    length);
+            }
+        }
+    }
+}
+
+void hierarchical_backprojector::split_(const node& parent, const pieces& in,
+                                        const node& child, pieces& out) {
+    auto parent_groups = groups_(parent.level);
+    auto groups = groups_(child.level);
+    auto ratio = 1 << (child.level - parent.level);
+    auto& directions = directions_[parent.level];
+    out.data.resize((std::size_t)(child.last_row - child.first_row) * groups *
+                    child.length);
+    out.offsets.resize(groups);
+
+    // a view `i` of parent group `a` is sampled at `u_i(c) + (j - m + phi_a)
+    // / os` by its sample `j`, so that sample `j' - m' + m + t_a + phi'`
+    // with `t_a = os (c' - c) . g_a - phi_a` is the sample `j'` of the child
+    // (approximating the direction of the view by that of its group). The
+    // child offset `phi'` is chosen such that the first group is shifted by
+    // whole samples, the others are interpolated linearly (rounding them
+    // instead would err by up to half a sample at every merge)
+    auto shift = child.center - parent.center;
+    auto t = [&](int a) {
+        return oversampling_ * shift.dot(directions[a].cast<double>()) -
+               in.offsets[a];
+    };
+    for (int j = 0; j < groups; ++j) {
+        auto begin = j * ratio;
+        auto end = std::min((j + 1) * ratio, parent_groups);
+        auto offset = std::round(t(begin)) - t(begin);
+        out.offsets[j] = offset;
+
+        for (auto a = begin; a < end; ++a) {
+            auto exact = t(a) + offset;
+            auto whole = std::floor(exact);
+            auto weight = (float)(exact - whole);
+            if (weight < 1e-4f || weight > 1.0f - 1e-4f) {
+                whole = std::round(exact);
+                weight = 0.0f;
+            }
+            auto delta = parent.length / 2 - child.length / 2 + (int)whole;
+            auto lo = std::max(0, -delta);
+            auto hi = std::min(child.length,
+                               parent.length - delta - (weight > 0.0f));
+            for (auto r = child.first_row; r < child.last_row; ++r) {
+                auto src =
+                    &in.data[((std::size_t)(r - parent.first_row) *
+                                  parent_groups +
+                              a) *
+                             parent.length] +
+                    delta;
+                auto dst = &out.data[((std::size_t)(r - child.first_row) *
+                                          groups +
+                                      j) *
+                                     child.length];
+                // (the first group overwrites the child)
+                if (a == begin) {
+                    std::fill(dst, dst + std::max(lo, 0), 0.0f);
+                    std::copy(src + lo, src + std::max(lo, hi), dst + lo);
+                    std::fill(dst + std::max(lo, hi), dst + child.length, 0.0f);
+                    continue;
+                }
+                if (weight == 0.0f) {
+                    for (auto i = lo; i < hi; ++i) {
+                        dst[i] += src[i];
+                    }
+                    continue;
+                }
+                for (auto i = lo; i < hi; ++i) {
+                    dst[i] += src[i] + weight * (src[i + 1] - src[i]);
+                }
+            }
+        }
+    }
+}
+
+void hierarchical_backprojector::finish_(const node& n, const pieces& in,
+                                         float* slice) {
+    auto groups = groups_(n.level);
+    auto length = n.length;
+    auto& directions = directions_[n.level];
+
+    // pixel `p` samples group `a` at `m - phi_a + os (p - c) . g_a`
+    auto base = std::vector<float>(groups);
+    auto step_x = std::vector<float>(groups);
+    auto step_y = std::vector<float>(groups);
+    for (int a = 0; a < groups; ++a) {
+        auto g = directions[a].cast<double>();
+        base[a] = (float)(length / 2 - in.offsets[a] -
+                          oversampling_ * n.center.dot(g));
+        step_x[a] = (float)(oversampling_ * g[0]);
+        step_y[a] = (float)(oversampling_ * g[1]);
+    }
+
+    for (auto y = n.y0; y < n.y1; ++y) {
+        for (auto x = n.x0; x < n.x1; ++x) {
+            auto v = v0_ + x * dv_[0] + y * dv_[1];
+            auto r0 = (int)std::floor(v);
+            auto f = v - r0;
+            auto total = 0.0f;
+            for (auto [r, weight] : {std::pair{r0, 1.0f - f}, {r0 + 1, f}}) {
+                if (r < n.first_row || r >= n.last_row || weight == 0.0f) {
+                    continue;
+                }
+                auto row = &in.data[(std::size_t)(r - n.first_row) * groups *
+                                    length];
+                auto sum = 0.0f;
+                for (int a = 0; a < groups; ++a) {
+                    auto position = base[a] + x * step_x[a] + y * step_y[a];
+                    auto i = (int)position;
+                    auto g = position - i;
+                    auto piece = row + (std::size_t)a * length + i;
+                    sum += piece[0] + g * (piece[1] - piece[0]);
+                }
+                total += weight * sum;
+            }
+            slice[(std::size_t)y * nx_ + x] = total;
+        }
+    }
+}
+
+void hierarchical_backprojector::descend_(const node& n, int depth,
+                                          std::vector<pieces>& scratch,
+                                          float* slice) {
+    auto w = n.x1 - n.x0;
+    auto h = n.y1 - n.y0;
+    if (w <= leaf_size_ && h <= leaf_size_) {
+        finish_(n, scratch[depth], slice);
+        return;
+    }
+
+    auto mx = w > leaf_size_ ? n.x0 + (w + 1) / 2 : n.x1;
+    auto my = h > leaf_size_ ? n.y0 + (h + 1) / 2 : n.y1;
+    for (auto [x0, x1] : {std::pair{n.x0, mx}, {mx, n.x1}}) {
+        for (auto [y0, y1] : {std::pair{n.y0, my}, {my, n.y1}}) {
+            auto child = node{};
+            if (x0 == x1 || y0 == y1 ||
+                !make_node_(x0, y0, x1, y1, n.level, child)) {
+                continue;
+            }
+            split_(n, scratch[depth], child, scratch[depth + 1]);
+            descend_(child, depth + 1, scratch, slice);
+        }
+    }
+}
+
+} // namespace slicerecon::detail
@@ -1,4 +1,8 @@
+#include <algorithm>
 #include <complex>
+#include <cstring>
+#include <limits>
+#include <thread>
 
 #include <Eigen/Eigen>
 
@@ -35,13 +39,6 @@ solver::solver(settings parameters, acquisition::geometry geometry)
                           << "Slice vol: " << slicerecon::util::info(*vol_geom_)
                           << slicerecon::util::end_log;
 
-    // Volume data
-    vol_handle_ = astraCUDA3d::allocateGPUMemory(parameters_.slice_size,
-                                                 parameters_.slice_size, 1,
-                                                 astraCUDA3d::INIT_ZERO);
-    vol_data_ = std::make_unique<astra::CFloat32VolumeData3DGPU>(
-        vol_geom_.get(), vol_handle_);
-
     // Small preview volume
     vol_geom_small_ = std::make_unique<astra::CVolumeGeometry3D>(
         parameters_.preview_size, parameters_.preview_size,
@@ -53,6 +50,16 @@ solver::solver(settings parameters, acquisition::geometry geometry)
     slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
                           << slicerecon::util::info(*vol_geom_small_)
                           << slicerecon::util::end_log;
+}
+
+gpu_solver::gpu_solver(settings parameters, acquisition::geometry geometry)
+    : solver(parameters, geometry) {
+    // Volume data
+    vol_handle_ = astraCUDA3d::allocateGPUMemory(parameters_.slice_size,
+                                                 parameters_.slice_size, 1,
+                                                 astraCUDA3d::INIT_ZERO);
+    vol_data_ = std::make_unique<astra::CFloat32VolumeData3DGPU>(
+        vol_geom_.get(), vol_handle_);
 
     vol_handle_small_ = astraCUDA3d::allocateGPUMemory(
         parameters_.preview_size, parameters_.preview_size,
@@ -61,7 +68,7 @@ solver::solver(settings parameters, acquisition::geometry geometry)
         vol_geom_small_.get(), vol_handle_small_);
 }
 
-solver::~solver() {
+gpu_solver::~gpu_solver() {
     slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
                           << "Deconstructing solver and freeing GPU memory"
                           << slicerecon::util::end_log;
@@ -73,58 +80,30 @@ solver::~solver() {
     }
 }
 
-parallel_beam_solver::parallel_beam_solver(settings parameters,
-                                           acquisition::geometry geometry)
-    : solver(parameters, geometry) {
-    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
-                          << "Initializing parallel beam solver"
-                          << slicerecon::util::end_log;
-    if (!geometry_.vec_geometry) {
-        // Projection geometry
-        auto proj_geom = astra::CParallelProjectionGeometry3D(
-            geometry_.proj_count, geometry_.rows, geometry_.cols, 1.0f, 1.0f,
-            geometry_.angles.data());
-
-        proj_geom_ = slicerecon::util::proj_to_vec(&proj_geom);
-
-        proj_geom_small_ = slicerecon::util::proj_to_vec(&proj_geom);
-
-    } else {
-        auto par_projs =
-            slicerecon::util::list_to_par_projections(geometry_.angles);
-        proj_geom_ = std::make_unique<astra::CParallelVecProjectionGeometry3D>(
-            geometry_.proj_count, geometry_.rows, geometry_.cols,
-            par_projs.data());
-        proj_geom_small_ =
-            std::make_unique<astra::CParallelVecProjectionGeometry3D>(
-                geometry_.proj_count, geometry_.rows, geometry_.cols,
-                par_projs.data());
-    }
-
-    vectors_ = std::vector<astra::SPar3DProjection>(
-        proj_geom_->getProjectionVectors(),
-        proj_geom_->getProjectionVectors() + geometry_.proj_count);
-    original_vectors_ = vectors_;
-    vec_buf_ = vectors_;
+void gpu_solver::upload(int buffer_idx, float* data, int proj_id_begin,
+                        int proj_id_end) {
+    astra::uploadMultipleProjections(proj_datas_[buffer_idx].get(), data,
+                                     proj_id_begin, proj_id_end);
+}
 
+void gpu_solver::allocate_projections_(
+    astra::CProjectionGeometry3D* proj_geom) {
     auto zeros = std::vector<float>(
         geometry_.proj_count * geometry_.cols * geometry_.rows, 0.0f);
 
     // Projection data
-    int nr_handles =
-        parameters.reconstruction_mode == mode::alternating ? 2 : 1;
-    for (int i = 0; i < nr_handles; ++i) {
+    for (int i = 0; i < buffer_count_(); ++i) {
         proj_handles_.push_back(astraCUDA3d::createProjectionArrayHandle(
             zeros.data(), geometry_.cols, geometry_.proj_count,
             geometry_.rows));
         proj_datas_.push_back(
             std::make_unique<astra::CFloat32ProjectionData3DGPU>(
-                proj_geom_.get(), proj_handles_[0]));
+                proj_geom, proj_handles_[i]));
     }
 
     // Back projection algorithm, link to previously made objects
     projector_ = std::make_unique<astra::CCudaProjector3D>();
-    for (int i = 0; i < nr_handles; ++i) {
+    for (int i = 0; i < buffer_count_(); ++i) {
         algs_.push_back(std::make_unique<astra::CCudaBackProjectionAlgorithm3D>(
             projector_.get(), proj_datas_[i].get(), vol_data_.get()));
         algs_small_.push_back(
@@ -133,38 +112,241 @@ parallel_beam_solver::parallel_beam_solver(settings parameters,
     }
 }
 
-slice_data parallel_beam_solver::reconstruct_slice(orientation x,
-                                                   int buffer_idx) {
-    auto dt = util::bench_scope("slice");
-    auto k = vol_geom_->getWindowMaxX();
+std::vector<astra::SPar3DProjection>
+parallel_vectors(const acquisition::geometry& geometry) {
+    auto proj_geom = std::unique_ptr<astra::CParallelVecProjectionGeometry3D>();
+    if (!geometry.vec_geometry) {
+        auto angles = geometry.angles;
+        auto par_geom = astra::CParallelProjectionGeometry3D(
+            geometry.proj_count, geometry.rows, geometry.cols, 1.0f, 1.0f,
+            angles.data());
+        proj_geom = slicerecon::util::proj_to_vec(&par_geom);
+    } else {
+        auto par_projs =
+            slicerecon::util::list_to_par_projections(geometry.angles);
+        proj_geom = std::make_unique<astra::CParallelVecProjectionGeometry3D>(
+            geometry.proj_count, geometry.rows, geometry.cols,
+            par_projs.data());
+    }
+
+    return std::vector<astra::SPar3DProjection>(
+        proj_geom->getProjectionVectors(),
+        proj_geom->getProjectionVectors() + geometry.proj_count);
+}
+
+std::vector<astra::SConeProjection>
+cone_vectors(const acquisition::geometry& geometry) {
+    auto proj_geom = std::unique_ptr<astra::CConeVecProjectionGeometry3D>();
+    if (!geometry.vec_geometry) {
+        auto angles = geometry.angles;
+        auto cone_geom = astra::CConeProjectionGeometry3D(
+            geometry.proj_count, geometry.rows, geometry.cols,
+            geometry.detector_size[0], geometry.detector_size[1],
+            angles.data(), geometry.source_origin, geometry.origin_det);
+        proj_geom = slicerecon::util::proj_to_vec(&cone_geom);
+    } else {
+        auto cone_projs = slicerecon::util::list_to_cone_projections(
+            geometry.rows, geometry.cols, geometry.angles);
+        proj_geom = std::make_unique<astra::CConeVecProjectionGeometry3D>(
+            geometry.proj_count, geometry.rows, geometry.cols,
+            cone_projs.data());
 
+        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                              << slicerecon::util::info(*proj_geom)
+                              << slicerecon::util::end_log;
+    }
+
+    return std::vector<astra::SConeProjection>(
+        proj_geom->getProjectionVectors(),
+        proj_geom->getProjectionVectors() + geometry.proj_count);
+}
+
+void slice_vectors(const std::vector<astra::SPar3DProjection>& vectors,
+                   std::vector<astra::SPar3DProjection>& result, orientation x,
+                   float k, const acquisition::geometry& geometry) {
     auto [delta, rot, scale] = util::slice_transform(
         {x[6], x[7], x[8]}, {x[0], x[1], x[2]}, {x[3], x[4], x[5]}, k);
 
-    // From the ASTRA geometry, get the vectors, modify, and reset them
     int i = 0;
     for (auto [rx, ry, rz, dx, dy, dz, pxx, pxy, pxz, pyx, pyy, pyz] :
-         vectors_) {
+         vectors) {
         auto r = Eigen::Vector3f(rx, ry, rz);
         auto d = Eigen::Vector3f(dx, dy, dz);
         auto px = Eigen::Vector3f(pxx, pxy, pxz);
         auto py = Eigen::Vector3f(pyx, pyy, pyz);
 
-        d += 0.5f * (geometry_.cols * px + geometry_.rows * py);
+        d += 0.5f * (geometry.cols * px + geometry.rows * py);
         r = scale.cwiseProduct(rot * r);
         d = scale.cwiseProduct(rot * (d + delta));
         px = scale.cwiseProduct(rot * px);
         py = scale.cwiseProduct(rot * py);
-        d -= 0.5f * (geometry_.cols * px + geometry_.rows * py);
+        d -= 0.5f * (geometry.cols * px + geometry.rows * py);
 
-        vec_buf_[i] = {r[0],  r[1],  r[2],  d[0],  d[1],  d[2],
-                       px[0], px[1], px[2], py[0], py[1], py[2]};
+        result[i] = {r[0],  r[1],  r[2],  d[0],  d[1],  d[2],
+                     px[0], px[1], px[2], py[0], py[1], py[2]};
         ++i;
     }
+}
 
-    proj_geom_ = std::make_unique<astra::CParallelVecProjectionGeometry3D>(
-        geometry_.proj_count, geometry_.rows, geometry_.cols, vec_buf_.data());
+void slice_vectors(const std::vector<astra::SConeProjection>& vectors,
+                   std::vector<astra::SConeProjection>& result, orientation x,
+                   float k, const acquisition::geometry& geometry) {
+    (void)geometry;
+    auto [delta, rot, scale] = util::slice_transform(
+        {x[6], x[7], x[8]}, {x[0], x[1], x[2]}, {x[3], x[4], x[5]}, k);
+
+    int i = 0;
+    for (auto [rx, ry, rz, dx, dy, dz, pxx, pxy, pxz, pyx, pyy, pyz] :
+         vectors) {
+        auto s = Eigen::Vector3f(rx, ry, rz);
+        auto d = Eigen::Vector3f(dx, dy, dz);
+        auto t1 = Eigen::Vector3f(pxx, pxy, pxz);
+        auto t2 = Eigen::Vector3f(pyx, pyy, pyz);
+
+        s = scale.cwiseProduct(rot * (s + delta));
+        d = scale.cwiseProduct(rot * (d + delta));
+        t1 = scale.cwiseProduct(rot * t1);
+        t2 = scale.cwiseProduct(rot * t2);
+
+        result[i] = {s[0],  s[1],  s[2],  d[0],  d[1],  d[2],
+                     t1[0], t1[1], t1[2], t2[0], t2[1], t2[2]};
+        ++i;
+    }
+}
+
+std::pair<int, int>
+detector_rows(const astra::CVolumeGeometry3D& vol_geom,
+              const std::vector<astra::SPar3DProjection>& vectors, int rows) {
+    // the detector row is an affine function of the position, so its extremes
+    // over the volume are attained in the corners
+    auto lowest = std::numeric_limits<float>::max();
+    auto highest = std::numeric_limits<float>::lowest();
+    for (auto [rx, ry, rz, dx, dy, dz, pxx, pxy, pxz, pyx, pyy, pyz] :
+         vectors) {
+        auto r = Eigen::Vector3f(rx, ry, rz);
+        auto d = Eigen::Vector3f(dx, dy, dz);
+        auto px = Eigen::Vector3f(pxx, pxy, pxz);
+        auto py = Eigen::Vector3f(pyx, pyy, pyz);
+
+        // the row of p solves p + t r = d + a px + b py
+        auto b = r.cross(px);
+        b /= py.dot(b);
+        for (int corner = 0; corner < 8; ++corner) {
+            auto p = Eigen::Vector3f(
+                (corner & 1) ? vol_geom.getWindowMaxX()
+                             : vol_geom.getWindowMinX(),
+                (corner & 2) ? vol_geom.getWindowMaxY()
+                             : vol_geom.getWindowMinY(),
+                (corner & 4) ? vol_geom.getWindowMaxZ()
+                             : vol_geom.getWindowMinZ());
+            auto row = (p - d).dot(b);
+            lowest = std::min(lowest, row);
+            highest = std::max(highest, row);
+        }
+    }
+
+    // pixel centers are at half-integer rows, and a sample interpolates
+    // between the rows below and above it
+    if (!(lowest <= highest) || highest <= -0.5f || lowest >= rows + 0.5f) {
+        return {0, 0};
+    }
+    // (one more row on each side, the backprojection accumulates the
+    // positions incrementally and may round differently)
+    auto first = (int)std::max(std::floor(lowest - 0.5f) - 1.0f, 0.0f);
+    auto last = (int)std::min(std::floor(highest - 0.5f) + 3.0f, (float)rows);
+    return {first, last};
+}
+
+void tilt_vectors(const std::vector<astra::SPar3DProjection>& vectors,
+                  std::vector<astra::SPar3DProjection>& result, float rotate,
+                  float translate) {
+    int i = 0;
+    for (auto [rx, ry, rz, dx, dy, dz, pxx, pxy, pxz, pyx, pyy, pyz] :
+         vectors) {
+        auto r = Eigen::Vector3f(rx, ry, rz);
+        auto d = Eigen::Vector3f(dx, dy, dz);
+        auto px = Eigen::Vector3f(pxx, pxy, pxz);
+        auto py = Eigen::Vector3f(pyx, pyy, pyz);
 
+        d += translate * px;
+
+        auto z = px.normalized();
+        auto w = py.normalized();
+        auto axis = z.cross(w);
+        auto rot = Eigen::AngleAxis<float>(rotate * M_PI / 180.0f,
+                                           axis.normalized())
+                       .matrix();
+
+        px = rot * px;
+        py = rot * py;
+
+        result[i] = {r[0],  r[1],  r[2],  d[0],  d[1],  d[2],
+                     px[0], px[1], px[2], py[0], py[1], py[2]};
+        ++i;
+    }
+}
+
+std::unique_ptr<util::detail::FDKScaler>
+fdk_weights(const std::vector<astra::SConeProjection>& vectors,
+            const acquisition::geometry& geometry) {
+    auto coefficients = std::vector<util::detail::FDKScaler::coefficients>();
+
+    for (auto [rx, ry, rz, dx, dy, dz, pxx, pxy, pxz, pyx, pyy, pyz] :
+         vectors) {
+        auto s = Eigen::Vector3d(rx, ry, rz);
+        auto d = Eigen::Vector3d(dx, dy, dz);
+        auto t1 = Eigen::Vector3d(pxx, pxy, pxz);
+        auto t2 = Eigen::Vector3d(pyx, pyy, pyz);
+
+        // FIXME uncentered projections
+        // rho should be the distance between the source and the detector plane
+        // which is not equal to (d - s).norm() for uncentered projections
+        auto a = d - s;
+        coefficients.push_back({(float)a.norm(), (float)a.dot(a),
+                                (float)(2.0 * a.dot(t1)),
+                                (float)(2.0 * a.dot(t2)), (float)t1.dot(t1),
+                                (float)t2.dot(t2), (float)(2.0 * t1.dot(t2))});
+    }
+
+    return std::make_unique<util::detail::FDKScaler>(
+        geometry.rows, geometry.cols, std::move(coefficients));
+}
+
+void upload_received(solver& alg, int buffer_idx, float* data, int rows,
+                     int cols, int proj_id_begin, int proj_id_end,
+                     const char* received, std::vector<float>& scratch) {
+    auto count = proj_id_end - proj_id_begin + 1;
+    if (!received || std::all_of(received, received + count,
+                                 [](char r) { return r != 0; })) {
+        alg.upload(buffer_idx, data, proj_id_begin, proj_id_end);
+        return;
+    }
+
+    for (int first = 0; first < count;) {
+        if (!received[first]) {
+            ++first;
+            continue;
+        }
+        auto last = first;
+        while (last + 1 < count && received[last + 1]) {
+            ++last;
+        }
+
+        // the rows of the run are strided in the sinogram of the group
+        auto run = (size_t)(last - first + 1) * cols;
+        scratch.resize((size_t)rows * run);
+        for (int row = 0; row < rows; ++row) {
+            memcpy(&scratch[row * run],
+                   data + ((size_t)row * count + first) * cols,
+                   run * sizeof(float));
+        }
+        alg.upload(buffer_idx, scratch.data(), proj_id_begin + first,
+                   proj_id_begin + last);
+        first = last + 1;
+    }
+}
+
+void log_slice(orientation x, int buffer_idx) {
     slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
                           << "Reconstructing slice: "
                           << "[" << x[0] << ", " << x[1] << ", " << x[2]
@@ -174,12 +356,150 @@ slice_data parallel_beam_solver::reconstruct_slice(orientation x,
                           << "[" << x[6] << ", " << x[7] << ", " << x[8] << "]"
                           << " buffer (" << buffer_idx << ")"
                           << slicerecon::util::end_log;
+}
 
-    proj_datas_[buffer_idx]->changeGeometry(proj_geom_.get());
-    algs_[buffer_idx]->run();
+// the cost of backprojecting a projection onto a pixel on the GPU, relative
+// to that of interpolating a sample on a single core (a rough estimate, for
+// deciding whether to backproject slices hierarchically)
+constexpr double gpu_backprojection_cost = 0.01;
+
+parallel_beam_solver::parallel_beam_solver(settings parameters,
+                                           acquisition::geometry geometry)
+    : gpu_solver(parameters, geometry) {
+    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                          << "Initializing parallel beam solver"
+                          << slicerecon::util::end_log;
+
+    vectors_ = parallel_vectors(geometry_);
+    original_vectors_ = vectors_;
+    vec_buf_ = vectors_;
+
+    // Projection geometry
+    proj_geom_ = std::make_unique<astra::CParallelVecProjectionGeometry3D>(
+        geometry_.proj_count, geometry_.rows, geometry_.cols, vectors_.data());
+    proj_geom_small_ =
+        std::make_unique<astra::CParallelVecProjectionGeometry3D>(
+            geometry_.proj_count, geometry_.rows, geometry_.cols,
+            vectors_.data());
+
+    allocate_projections_(proj_geom_.get());
+
+    // the projection data on the GPU can not be read back, so the gridding
+    // and the hierarchical backprojection work on a copy, which costs as
+    // much host memory as the GPU buffers
+    auto grid = parameters_.gridrec && parameters_.gpu_gridrec;
+    auto hierarchical = parameters_.hierarchical_tolerance > 0.0f;
+    if (grid || hierarchical) {
+        // slices are reconstructed while projections are processed, so the
+        // pool only takes the cores that the projection processing leaves
+        // free
+        auto cores = std::max((int)std::thread::hardware_concurrency(), 1);
+        auto free_cores = std::vector<int32_t>();
+        for (int core = 0; core < cores; ++core) {
+            auto& pinned = parameters_.pinned_cores;
+            if (!pinned.empty() &&
+                std::find(pinned.begin(), pinned.end(), core) == pinned.end()) {
+                free_cores.push_back(core);
+            }
+        }
+        auto threads = parameters_.pinned_cores.empty()
+                           ? std::max(cores - parameters_.filter_cores, 1)
+                           : std::max((int)free_cores.size(), 1);
+        pool_ = std::make_unique<util::worker_pool>(threads, free_cores);
+        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                              << "Reconstructing slices on the CPU with "
+                              << threads << " threads"
+                              << slicerecon::util::end_log;
+        if (grid) {
+            gridrec_ = std::make_unique<gridrec>(parameters_, geometry_,
+                                                 *vol_geom_, *pool_);
+        }
+        if (hierarchical) {
+            hierarchical_ = std::make_unique<hierarchical_backprojector>(
+                parameters_, geometry_, *vol_geom_, *pool_,
+                gpu_backprojection_cost * pool_->size());
+        }
+        host_buffers_.resize(buffer_count_());
+        for (auto& buffer : host_buffers_) {
+            buffer.assign((std::size_t)geometry_.proj_count * geometry_.rows *
+                              geometry_.cols,
+                          0.0f);
+        }
+    }
+}
+
+void parallel_beam_solver::upload(int buffer_idx, float* data,
+                                  int proj_id_begin, int proj_id_end) {
+    gpu_solver::upload(buffer_idx, data, proj_id_begin, proj_id_end);
+    if (host_buffers_.empty()) {
+        return;
+    }
+
+    auto count = (std::size_t)(proj_id_end - proj_id_begin + 1);
+    auto cols = (std::size_t)geometry_.cols;
+    auto stride = (std::size_t)geometry_.proj_count * cols;
+    auto& buffer = host_buffers_[buffer_idx];
+    for (std::size_t r = 0; r < (std::size_t)geometry_.rows; ++r) {
+        memcpy(&buffer[r * stride + proj_id_begin * cols],
+               data + r * count * cols, count * cols * sizeof(float));
+    }
+}
+
+slice_data parallel_beam_solver::reconstruct_slice(orientation x,
+                                                   int buffer_idx) {
+    auto dt = util::bench_scope("slice");
+
+    // From the ASTRA geometry, get the vectors, modify, and reset them
+    slice_vectors(vectors_, vec_buf_, x, vol_geom_->getWindowMaxX(),
+                  geometry_);
+
+    log_slice(x, buffer_idx);
+
+    // horizontal slices are gridded, which is much cheaper than
+    // backprojecting them for large slices
+    if (gridrec_) {
+        auto m = parameters_.slice_size;
+        auto result = std::vector<float>((std::size_t)m * m);
+        if (gridrec_->reconstruct(vec_buf_, host_buffers_[buffer_idx].data(),
+                                  geometry_.cols,
+                                  (std::size_t)geometry_.proj_count *
+                                      geometry_.cols,
+                                  result.data())) {
+            return {{m, m}, std::move(result)};
+        }
+    }
+
+    // large oblique slices are cheaper to backproject hierarchically, even
+    // on the CPU
+    if (hierarchical_) {
+        auto m = parameters_.slice_size;
+        auto result = std::vector<float>((std::size_t)m * m);
+        if (hierarchical_->reconstruct(vec_buf_,
+                                       host_buffers_[buffer_idx].data(),
+                                       geometry_.cols,
+                                       (std::size_t)geometry_.proj_count *
+                                           geometry_.cols,
+                                       result.data())) {
+            return {{m, m}, std::move(result)};
+        }
+    }
 
     unsigned int n = parameters_.slice_size;
     auto result = std::vector<float>(n * n, 0.0f);
+
+    // a slice that misses the detector is not backprojected at all. The
+    // projections are a CUDA array that is sampled through textures, so
+    // unlike on the CPU, reading fewer rows would not make it cheaper
+    auto rows = detector_rows(*vol_geom_, vec_buf_, geometry_.rows);
+    if (rows.first >= rows.second) {
+        return {{(int)n, (int)n}, std::move(result)};
+    }
+
+    proj_geom_ = std::make_unique<astra::CParallelVecProjectionGeometry3D>(
+        geometry_.proj_count, geometry_.rows, geometry_.cols, vec_buf_.data());
+    proj_datas_[buffer_idx]->changeGeometry(proj_geom_.get());
+    algs_[buffer_idx]->run();
+
     auto pos = astraCUDA3d::SSubDimensions3D{n, n, 1, n, n, n, 1, 0, 0, 0};
     astraCUDA3d::copyFromGPUMemory(result.data(), vol_handle_, pos);
 
@@ -211,11 +531,9 @@ bool parallel_beam_solver::parameter_changed(
     if (parameter == "tilt angle") {
         tilt_changed = true;
         tilt_rotate_ = std::get<float>(value);
-        // TODO rotate geometry vectors
     } else if (parameter == "tilt translate") {
         tilt_changed = true;
         tilt_translate_ = std::get<float>(value);
-        // TODO translate geometry vectors
     }
 
     std::cout << "Rotate to " << tilt_rotate_ << ", translate to"
@@ -223,30 +541,8 @@ bool parallel_beam_solver::parameter_changed(
 
     if (tilt_changed) {
         // From the ASTRA geometry, get the vectors, modify, and reset them
-        int i = 0;
-        for (auto [rx, ry, rz, dx, dy, dz, pxx, pxy, pxz, pyx, pyy, pyz] :
-             original_vectors_) {
-            auto r = Eigen::Vector3f(rx, ry, rz);
-            auto d = Eigen::Vector3f(dx, dy, dz);
-            auto px = Eigen::Vector3f(pxx, pxy, pxz);
-            auto py = Eigen::Vector3f(pyx, pyy, pyz);
-
-            d += tilt_translate_ * px;
-
-            auto z = px.normalized();
-            auto w = py.normalized();
-            auto axis = z.cross(w);
-            auto rot = Eigen::AngleAxis<float>(tilt_rotate_ * M_PI / 180.0f,
-                                               axis.normalized())
-                           .matrix();
-
-            px = rot * px;
-            py = rot * py;
-
-            vectors_[i] = {r[0],  r[1],  r[2],  d[0],  d[1],  d[2],
-                           px[0], px[1], px[2], py[0], py[1], py[2]};
-            ++i;
-        }
+        tilt_vectors(original_vectors_, vectors_, tilt_rotate_,
+                     tilt_translate_);
 
         // TODO if either changed, trigger a new reconstruction. Do we need to
         // do this from reconstructor (since we don't have access to listeners
@@ -267,106 +563,32 @@ parallel_beam_solver::parameters() {
 
 cone_beam_solver::cone_beam_solver(settings parameters,
                                    acquisition::geometry geometry)
-    : solver(parameters, geometry) {
+    : gpu_solver(parameters, geometry) {
     slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
                           << "Initializing cone beam solver"
                           << slicerecon::util::end_log;
 
-    if (!geometry_.vec_geometry) {
-        auto proj_geom = astra::CConeProjectionGeometry3D(
-            geometry_.proj_count, geometry_.rows, geometry_.cols,
-            geometry_.detector_size[0], geometry_.detector_size[1],
-            geometry_.angles.data(), geometry_.source_origin,
-            geometry_.origin_det);
-
-        proj_geom_ = slicerecon::util::proj_to_vec(&proj_geom);
-        proj_geom_small_ = slicerecon::util::proj_to_vec(&proj_geom);
-    } else {
-        auto cone_projs = slicerecon::util::list_to_cone_projections(
-            geometry_.rows, geometry_.cols, geometry_.angles);
-        proj_geom_ = std::make_unique<astra::CConeVecProjectionGeometry3D>(
-            geometry_.proj_count, geometry_.rows, geometry_.cols,
-            cone_projs.data());
-
-        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
-                              << slicerecon::util::info(*proj_geom_)
-                              << slicerecon::util::end_log;
-
-        proj_geom_small_ =
-            std::make_unique<astra::CConeVecProjectionGeometry3D>(
-                geometry_.proj_count, geometry_.rows, geometry_.cols,
-                cone_projs.data());
-    }
-
-    vectors_ = std::vector<astra::SConeProjection>(
-        proj_geom_->getProjectionVectors(),
-        proj_geom_->getProjectionVectors() + geometry_.proj_count);
+    vectors_ = cone_vectors(geometry_);
     vec_buf_ = vectors_;
 
-    auto zeros = std::vector<float>(
-        geometry_.proj_count * geometry_.cols * geometry_.rows, 0.0f);
-
-    // Projection data
-    int nr_handles =
-        parameters.reconstruction_mode == mode::alternating ? 2 : 1;
-    for (int i = 0; i < nr_handles; ++i) {
-        proj_handles_.push_back(astraCUDA3d::createProjectionArrayHandle(
-            zeros.data(), geometry_.cols, geometry_.proj_count,
-            geometry_.rows));
-        proj_datas_.push_back(
-            std::make_unique<astra::CFloat32ProjectionData3DGPU>(
-                proj_geom_.get(), proj_handles_[0]));
-    }
+    proj_geom_ = std::make_unique<astra::CConeVecProjectionGeometry3D>(
+        geometry_.proj_count, geometry_.rows, geometry_.cols, vectors_.data());
+    proj_geom_small_ = std::make_unique<astra::CConeVecProjectionGeometry3D>(
+        geometry_.proj_count, geometry_.rows, geometry_.cols, vectors_.data());
 
-    // Back projection algorithm, link to previously made objects
-    projector_ = std::make_unique<astra::CCudaProjector3D>();
-    for (int i = 0; i < nr_handles; ++i) {
-        algs_.push_back(std::make_unique<astra::CCudaBackProjectionAlgorithm3D>(
-            projector_.get(), proj_datas_[i].get(), vol_data_.get()));
-        algs_small_.push_back(
-            std::make_unique<astra::CCudaBackProjectionAlgorithm3D>(
-                projector_.get(), proj_datas_[i].get(), vol_data_small_.get()));
-    }
+    allocate_projections_(proj_geom_.get());
 }
 
 slice_data cone_beam_solver::reconstruct_slice(orientation x, int buffer_idx) {
     auto dt = util::bench_scope("slice");
-    auto k = vol_geom_->getWindowMaxX();
-
-    auto [delta, rot, scale] = util::slice_transform(
-        {x[6], x[7], x[8]}, {x[0], x[1], x[2]}, {x[3], x[4], x[5]}, k);
 
     // From the ASTRA geometry, get the vectors, modify, and reset them
-    int i = 0;
-    for (auto [rx, ry, rz, dx, dy, dz, pxx, pxy, pxz, pyx, pyy, pyz] :
-         vectors_) {
-        auto s = Eigen::Vector3f(rx, ry, rz);
-        auto d = Eigen::Vector3f(dx, dy, dz);
-        auto t1 = Eigen::Vector3f(pxx, pxy, pxz);
-        auto t2 = Eigen::Vector3f(pyx, pyy, pyz);
-
-        s = scale.cwiseProduct(rot * (s + delta));
-        d = scale.cwiseProduct(rot * (d + delta));
-        t1 = scale.cwiseProduct(rot * t1);
-        t2 = scale.cwiseProduct(rot * t2);
-
-        vec_buf_[i] = {s[0],  s[1],  s[2],  d[0],  d[1],  d[2],
-                       t1[0], t1[1], t1[2], t2[0], t2[1], t2[2]};
-        ++i;
-    }
-
+    slice_vectors(vectors_, vec_buf_, x, vol_geom_->getWindowMaxX(),
+                  geometry_);
     proj_geom_ = std::make_unique<astra::CConeVecProjectionGeometry3D>(
         geometry_.proj_count, geometry_.rows, geometry_.cols, vec_buf_.data());
 
-    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
-                          << "Reconstructing slice: "
-                          << "[" << x[0] << ", " << x[1] << ", " << x[2]
-                          << "], "
-                          << "[" << x[3] << ", " << x[4] << ", " << x[5]
-                          << "], "
-                          << "[" << x[6] << ", " << x[7] << ", " << x[8] << "]"
-                          << " buffer (" << buffer_idx << ")"
-                          << slicerecon::util::end_log;
+    log_slice(x, buffer_idx);
 
     proj_datas_[buffer_idx]->changeGeometry(proj_geom_.get());
     algs_[buffer_idx]->run();
@@ -392,40 +614,15 @@ void cone_beam_solver::reconstruct_preview(std::vector<float>& preview_buffer,
                                    pos);
 }
 
-std::vector<float> cone_beam_solver::fdk_weights() {
-    auto result = std::vector<float>(
-        geometry_.cols * geometry_.rows * geometry_.proj_count, 0.0f);
-
-    int i = 0;
-    for (auto [rx, ry, rz, dx, dy, dz, pxx, pxy, pxz, pyx, pyy, pyz] :
-         vectors_) {
-        auto s = Eigen::Vector3f(rx, ry, rz);
-        auto d = Eigen::Vector3f(dx, dy, dz);
-        auto t1 = Eigen::Vector3f(pxx, pxy, pxz);
-        auto t2 = Eigen::Vector3f(pyx, pyy, pyz);
-
-        // FIXME uncentered projections
-        // rho should be the distance between the source and the detector plane
-        // which is not equal to (d - s).norm() for uncentered projections
-        auto rho = (d - s).norm();
-        for (int r = 0; r < geometry_.rows; ++r) {
-            for (int c = 0; c < geometry_.cols; ++c) {
-                auto y = d + r * t2 + c * t1;
-                auto denum = (y - s).norm();
-                result[(i * geometry_.cols * geometry_.rows) +
-                       (r * geometry_.cols) + c] = rho / denum;
-            }
-        }
-
-        ++i;
-    }
-
-    return result;
+std::unique_ptr<util::detail::FDKScaler> cone_beam_solver::fdk_weights() {
+    return detail::fdk_weights(vectors_, geometry_);
 }
 
 } // namespace detail
 
-reconstructor::reconstructor(settings parameters) : parameters_(parameters) {
+reconstructor::reconstructor(settings parameters)
+    : parameters_(parameters),
+      slice_cache_((std::size_t)std::max(parameters.slice_cache_mb, 0) << 20) {
     float_parameters_["lambda"] = &parameters_.paganin.lambda;
     float_parameters_["delta"] = &parameters_.paganin.delta;
     float_parameters_["beta"] = &parameters_.paganin.beta;
@@ -433,37 +630,62 @@ reconstructor::reconstructor(settings parameters) : parameters_(parameters) {
     bool_parameters_["retrieve phase"] = &parameters_.retrieve_phase;
 }
 
+reconstructor::~reconstructor() { stop_pipeline_(); }
+
 void reconstructor::initialize(acquisition::geometry geom) {
     bool reinitializing = (bool)alg_;
 
+    // projections of the previous geometry that are still in flight are
+    // discarded
+    stop_pipeline_();
+
     geom_ = geom;
+    invalidate_slices_();
 
     // init counts
     pixels_ = geom_.cols * geom_.rows;
 
     // allocate the buffers
-    all_flats_.resize(pixels_ * parameters_.flats);
-    all_darks_.resize(pixels_ * parameters_.darks);
-    dark_.resize(pixels_);
-    flat_fielder_.resize(pixels_, 1.0f);
     update_every_ = parameters_.reconstruction_mode == mode::alternating
                         ? geom_.proj_count
                         : parameters_.group_size;
 
-    buffer_.resize((size_t)update_every_ * (size_t)pixels_);
-    sino_buffer_.resize((size_t)update_every_ * (size_t)pixels_);
+    // the raw projections of a single group are held on to (as received),
+    // and the processed group is stored in one of two sinograms, which are
+    // uploaded to the GPU one group at a time
+    auto group = (size_t)std::min(update_every_, parameters_.group_size);
+    group_.assign(group, {});
+    group_first_ = -1;
+    buffer_.resize(group * (size_t)pixels_);
+    for (auto& sino : sino_buffers_) {
+        sino.resize(group * (size_t)pixels_);
+    }
+    update_count_ = 0;
+    received_flats_ = 0;
 
     small_volume_buffer_.resize(parameters_.preview_size *
                                 parameters_.preview_size *
                                 parameters_.preview_size);
 
+    auto on_cpu = parameters_.backend == solver_backend::cpu;
     if (geom_.parallel) {
         // make reconstruction object par
-        alg_ =
-            std::make_unique<detail::parallel_beam_solver>(parameters_, geom_);
+        if (on_cpu) {
+            alg_ = std::make_unique<detail::cpu_parallel_beam_solver>(
+                parameters_, geom_);
+        } else {
+            alg_ = std::make_unique<detail::parallel_beam_solver>(parameters_,
+                                                                  geom_);
+        }
     } else {
         // make reconstruction object cb
-        alg_ = std::make_unique<detail::cone_beam_solver>(parameters_, geom_);
+        if (on_cpu) {
+            alg_ = std::make_unique<detail::cpu_cone_beam_solver>(parameters_,
+                                                                  geom_);
+        } else {
+            alg_ =
+                std::make_unique<detail::cone_beam_solver>(parameters_, geom_);
+        }
     }
 
     initialized_ = true;
@@ -471,11 +693,8 @@ void reconstructor::initialize(acquisition::geometry geom) {
     projection_processor_ =
         std::make_unique<util::ProjectionProcessor>(parameters_, geom_);
 
-    // add flat fielder
-    projection_processor_->flatfielder =
-        std::make_unique<util::detail::Flatfielder>(util::detail::Flatfielder{
-            {dark_.data(), geom_.rows, geom_.cols},
-            {flat_fielder_.data(), geom_.rows, geom_.cols}});
+    // add flat fielder, the darks and flats are averaged as they come in
+    projection_processor_->flatfielding = true;
 
     // add neg log
     if (!parameters_.already_linear && !parameters_.retrieve_phase) {
@@ -484,21 +703,20 @@ void reconstructor::initialize(acquisition::geometry geom) {
                 util::detail::Neglogger{});
     }
 
-    projection_processor_->filterer = std::make_unique<util::detail::Filterer>(
-        util::detail::Filterer{parameters_, geom_, &buffer_[0]});
+    projection_processor_->filterer =
+        std::make_unique<util::detail::Filterer>(parameters_, geom_);
 
     if (!geom_.parallel) {
-        projection_processor_->fdk_scale =
-            std::make_unique<util::detail::FDKScaler>(util::detail::FDKScaler{
-                ((detail::cone_beam_solver*)(alg_.get()))->fdk_weights()});
+        projection_processor_->fdk_scale = alg_->fdk_weights();
     }
 
     if (parameters_.retrieve_phase) {
         projection_processor_->paganin =
-            std::make_unique<util::detail::Paganin>(
-                util::detail::Paganin{parameters_, geom_, &buffer_[0]});
+            std::make_unique<util::detail::Paganin>(parameters_, geom_);
     }
 
+    start_pipeline_();
+
     if (!reinitializing) {
         for (auto [k, v] : alg_->parameters()) {
             for (auto l : listeners_) {
@@ -514,46 +732,257 @@ void reconstructor::initialize(acquisition::geometry geom) {
 }
 
 /**
- * Copy from a data buffer to a sino buffer, while transposing the data.
- *
- * If an offset is given, it transposes projections [offset, offset+1, ...,
- * proj_end] to the *front* of the sino_buffer_, leaving the remainder of the
- * buffer unused.
- *
- * @param projection_group  Reference to buffered data
- * @param sino_buffer       Reference to the CPU buffer of the projections
- * @param group_size        Number of projections in the group
- *
+ * The index of the first projection in the buffer that belongs to the second
+ * sinogram, if the current buffer wraps around the end of the geometry (in
+ * continuous mode). Returns 0 otherwise.
  */
-void reconstructor::transpose_into_sino_(int proj_offset, int proj_end) {
-    auto dt = util::bench_scope("Transpose sino");
+int reconstructor::sino_split_() {
+    if (parameters_.reconstruction_mode == mode::alternating) {
+        return 0;
+    }
 
-    // major to minor: [i, j, k]
-    // In projection_group we have: [projection_id, rows, cols ]
-    // For sinogram we want: [rows, projection_id, cols]
+    auto begin_wrt_geom = (update_count_ * update_every_) % geom_.proj_count;
+    auto end_wrt_geom = (begin_wrt_geom + update_every_ - 1) % geom_.proj_count;
+    return end_wrt_geom >= begin_wrt_geom ? 0
+                                          : geom_.proj_count - begin_wrt_geom;
+}
+
+int reconstructor::ingest_capacity() const {
+    if (parameters_.ingest_slots > 0) {
+        return parameters_.ingest_slots;
+    }
+    auto group = update_every_ > 0
+                     ? std::min(update_every_, parameters_.group_size)
+                     : parameters_.group_size;
+    return 2 * group;
+}
+
+void reconstructor::start_pipeline_() {
+    ingest_ = std::make_unique<util::ingest_ring>(ingest_capacity());
+
+    uploads_.clear();
+    sino_busy_ = {false, false};
+    sino_index_ = 0;
+    preview_requested_ = false;
+    stopping_ = false;
+    shed_group_ = -1;
+    decimate_until_ = 0;
 
-    auto buffer_size = proj_end - proj_offset + 1;
+    process_thread_ = std::thread([this] { process_loop_(); });
+    upload_thread_ = std::thread([this] { upload_loop_(); });
+    preview_thread_ = std::thread([this] { preview_loop_(); });
+}
+
+void reconstructor::stop_pipeline_() {
+    if (!ingest_) {
+        return;
+    }
 
-    for (int i = 0; i < geom_.rows; ++i) {
-        for (int j = proj_offset; j <= proj_end; ++j) {
-            for (int k = 0; k < geom_.cols; ++k) {
-                sino_buffer_[i * buffer_size * geom_.cols +
-                             (j - proj_offset) * geom_.cols + k] =
-                    buffer_[j * geom_.cols * geom_.rows + i * geom_.cols + k];
+    ingest_->stop();
+    {
+        std::lock_guard<std::mutex> guard(stage_mutex_);
+        stopping_ = true;
+    }
+    stage_cv_.notify_all();
+
+    for (auto thread : {&process_thread_, &upload_thread_, &preview_thread_}) {
+        if (thread->joinable()) {
+            thread->join();
+        }
+    }
+
+    auto stats = ingest_->stats();
+    if (stats.occupancy > 0) {
+        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::warning
+                              << "Discarding " << stats.occupancy
+                              << " unprocessed projections"
+                              << slicerecon::util::end_log;
+    }
+    ingest_.reset();
+}
+
+void reconstructor::process_loop_() {
+    while (auto slot = ingest_->pop()) {
+        consume_(*slot);
+        ingest_->release(slot);
+    }
+
+    for (auto& p : group_) {
+        p.owner.reset();
+    }
+}
+
+/**
+ * Handle a received projection, or batch of projections, on the processing
+ * stage.
+ */
+void reconstructor::consume_(util::ingest_ring::slot& s) {
+    if (s.kind == proj_kind::standard && shed_(s)) {
+        return;
+    }
+
+    auto decimate = s.kind == proj_kind::standard &&
+                    s.position() < decimate_until_;
+    if (s.count == 1) {
+        if (decimate && decimated_(s.idx)) {
+            ingest_->decimate();
+            return;
+        }
+        consume_projection_(s);
+        return;
+    }
+
+    // the projections of a batch only point into it, and share its owner
+    auto bytes = (size_t)pixels_ * dtype_size(s.pixels.type);
+    for (int k = 0; k < s.count; ++k) {
+        auto idx = s.idx + k * s.stride;
+        if (decimate && decimated_(idx)) {
+            ingest_->decimate();
+            continue;
+        }
+
+        auto p = util::received_projection{};
+        p.kind = s.kind;
+        p.idx = idx;
+        p.shape = s.shape;
+        p.pixels = {(const char*)s.pixels.data + k * bytes, s.pixels.type};
+        p.owner = s.owner;
+        consume_projection_(p);
+    }
+}
+
+/**
+ * Shed load when the receiver found the ingest ring full, as set by the
+ * overload policy. Either the oldest queued group is dropped, which is the
+ * group of the first (standard) projection that is popped after the request,
+ * or every other projection that is queued at that moment is decimated.
+ * Returns whether the slot is dropped as a whole.
+ */
+bool reconstructor::shed_(util::ingest_ring::slot& s) {
+    auto ue = update_every_;
+    auto gs = parameters_.group_size;
+    auto group_first = s.idx - ((s.idx % ue) % gs);
+
+    switch (parameters_.overload) {
+    case overload_policy::drop_oldest_group: {
+        if (shed_group_ < 0 && ingest_->take_shed_request()) {
+            shed_group_ = group_first;
+        }
+        if (shed_group_ < 0) {
+            return false;
+        }
+        if (group_first == shed_group_) {
+            ingest_->drop(s.count);
+            return true;
+        }
+        shed_group_ = -1;
+        return false;
+    }
+    case overload_policy::decimate: {
+        if (ingest_->take_shed_request()) {
+            decimate_until_ = std::max(
+                decimate_until_, (uint64_t)ingest_->stats().received);
+        }
+        return false;
+    }
+    default:
+        return false;
+    }
+}
+
+/**
+ * Whether a queued projection is left out when decimating: every other
+ * angle, but never the last projection of a group (or of the buffer), which
+ * completes the group.
+ */
+bool reconstructor::decimated_(int32_t proj_idx) const {
+    auto ue = update_every_;
+    auto gs = parameters_.group_size;
+    auto rel_proj_idx = proj_idx % ue;
+    return proj_idx % 2 == 1 && rel_proj_idx % gs != gs - 1 &&
+           rel_proj_idx != ue - 1;
+}
+
+/**
+ * Handle a single received projection. The projections are collected into
+ * groups, which are processed as soon as they are complete.
+ */
+void reconstructor::consume_projection_(util::received_projection& s) {
+    auto p = parameters_;
+    int ue = update_every_;
+    int gs = p.group_size;
+
+    switch (s.kind) {
+    case proj_kind::standard: {
+        // check if we received a (new) batch of darks/flats, their averages
+        // are already computed, so this only swaps them in
+        if (received_flats_ >= p.darks + p.flats && p.darks > 0 &&
+            p.flats > 0) {
+            projection_processor_->swap_flatfield();
+            received_flats_ = 0;
+        }
+
+        auto rel_proj_idx = s.idx % ue;
+        bool full_group = rel_proj_idx % gs == gs - 1;
+        bool buffer_end_reached = rel_proj_idx == ue - 1;
+
+        // a group that was not completed (projections were lost) is
+        // abandoned as soon as the next one starts
+        auto group_first = s.idx - (rel_proj_idx % gs);
+        if (group_first != group_first_) {
+            for (auto& p : group_) {
+                p.pixels = {};
+                p.owner.reset();
             }
+            group_first_ = group_first;
         }
+
+        // hold on to the incoming projection until its group is processed,
+        // its slot goes back to the ring (with the previous contents of the
+        // group entry, which are released)
+        std::swap(group_[rel_proj_idx % gs], s);
+
+        if (full_group || buffer_end_reached) {
+            // starting idx of this group
+            auto begin_in_buffer = rel_proj_idx - (rel_proj_idx % gs);
+            process_(begin_in_buffer, rel_proj_idx, buffer_end_reached);
+        }
+        break;
+    }
+    case proj_kind::dark: {
+        projection_processor_->add_dark(s.pixels);
+        received_flats_++;
+        break;
+    }
+    case proj_kind::light: {
+        projection_processor_->add_flat(s.pixels);
+        received_flats_++;
+        break;
+    }
+    default:
+        break;
     }
 }
 
 /**
- * In-memory processing the projections [proj_id_begin, ..., proj_id_end]
+ * In-memory processing the projections [proj_id_begin, ..., proj_id_end] of
+ * the current group, into a sinogram that is then handed to the upload stage
  *
  * @param proj_id_begin
  * @param proj_id_end
+ * @param cycle_end Whether this group completes the buffer
  */
-void reconstructor::process_(int proj_id_begin, int proj_id_end) {
-    if (!initialized_) {
-        return;
+void reconstructor::process_(int proj_id_begin, int proj_id_end,
+                             bool cycle_end) {
+    // wait until the upload stage is done with the sinogram we write into,
+    // the other one may still be uploading
+    auto sino = sino_index_;
+    {
+        std::unique_lock<std::mutex> lock(stage_mutex_);
+        stage_cv_.wait(lock, [&] { return !sino_busy_[sino] || stopping_; });
+        if (stopping_) {
+            return;
+        }
     }
 
     slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
@@ -561,53 +990,212 @@ void reconstructor::process_(int proj_id_begin, int proj_id_end) {
                           << " between " << proj_id_begin << "/" << proj_id_end
                           << slicerecon::util::end_log;
 
-    auto data = &buffer_[proj_id_begin * pixels_];
-    projection_processor_->process(data, proj_id_begin, proj_id_end);
+    auto count = proj_id_end - proj_id_begin + 1;
+    auto job = upload_job{sino, proj_id_begin, proj_id_end, 0, cycle_end};
+    if (parameters_.reconstruction_mode == mode::continuous) {
+        // the group is the whole buffer, which is placed at the current
+        // position in the geometry (the filters and FDK weights are those of
+        // that position as well)
+        job.begin = (update_count_ * update_every_) % geom_.proj_count;
+        job.end = (job.begin + update_every_ - 1) % geom_.proj_count;
+        job.split = sino_split_();
+        update_count_++;
+    }
+
+    // the projections are read from where they were received. Missing
+    // projections (lost, dropped or decimated) are neither processed nor
+    // uploaded, so that the solver keeps their previous data. Their scratch
+    // space is zeroed, as phase retrieval transforms it with its batch
+    auto inputs = std::vector<raw_pixels>(count);
+    auto received = std::vector<char>(count, 1);
+    for (int i = 0; i < count; ++i) {
+        inputs[i] = group_[i].pixels;
+        if (!inputs[i].data) {
+            std::fill_n(&buffer_[(size_t)i * pixels_], pixels_, 0.0f);
+            received[i] = 0;
+        }
+    }
+    if (std::find(received.begin(), received.end(), 0) != received.end()) {
+        job.received = std::move(received);
+    }
+
+    // the processed projections are scattered into the sinogram
+    auto target = util::sino_target{sino_buffers_[sino].data(), geom_.rows,
+                                    geom_.cols, count, job.split,
+                                    proj_id_begin};
+    auto geom_id_begin =
+        parameters_.reconstruction_mode == mode::continuous ? job.begin
+                                                            : proj_id_begin;
+    projection_processor_->process(
+        buffer_.data(), proj_id_begin, proj_id_end, geom_id_begin, target,
+        inputs.data(), job.received.empty() ? nullptr : job.received.data());
+
+    for (auto& p : group_) {
+        p.pixels = {};
+        p.owner.reset();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(stage_mutex_);
+        sino_busy_[sino] = true;
+        uploads_.push_back(std::move(job));
+    }
+    stage_cv_.notify_all();
+    sino_index_ = 1 - sino;
+}
+
+void reconstructor::upload_loop_() {
+    while (true) {
+        auto job = upload_job{};
+        {
+            std::unique_lock<std::mutex> lock(stage_mutex_);
+            stage_cv_.wait(lock, [&] { return !uploads_.empty() || stopping_; });
+            if (stopping_) {
+                return;
+            }
+            job = std::move(uploads_.front());
+            uploads_.pop_front();
+        }
+
+        auto received = job.received.empty() ? nullptr : job.received.data();
+        if (parameters_.reconstruction_mode == mode::alternating) {
+            // fill the inactive GPU buffer, and let the reconstructor know it
+            // is ready once it is complete
+            auto gpu_buffer_idx = 1 - active_gpu_buffer_index_;
+            upload_sino_buffer_(job.sino, job.begin, job.end, 0, gpu_buffer_idx,
+                                false, received);
+            if (job.cycle_end) {
+                active_gpu_buffer_index_ = gpu_buffer_idx;
+            }
+        } else { // --continuous mode
+            bool use_gpu_lock = true;
+            int gpu_buffer_idx = 0; // we only have one buffer
+
+            if (job.end >= job.begin) {
+                upload_sino_buffer_(job.sino, job.begin, job.end, 0,
+                                    gpu_buffer_idx, use_gpu_lock, received);
+            } else {
+                // we have gone around in the geometry, the two parts have
+                // been stored as separate sinograms
+                upload_sino_buffer_(job.sino, job.begin, geom_.proj_count - 1,
+                                    0, gpu_buffer_idx, use_gpu_lock, received);
+                upload_sino_buffer_(
+                    job.sino, 0, job.end, (size_t)job.split * pixels_,
+                    gpu_buffer_idx, use_gpu_lock,
+                    received ? received + job.split : nullptr);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(stage_mutex_);
+            sino_busy_[job.sino] = false;
+            if (job.cycle_end) {
+                previews_merged_ += preview_requested_ ? 1 : 0;
+                preview_requested_ = true;
+            }
+        }
+        stage_cv_.notify_all();
+    }
+}
+
+void reconstructor::preview_loop_() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(stage_mutex_);
+            stage_cv_.wait(lock, [&] { return preview_requested_ || stopping_; });
+            if (stopping_) {
+                return;
+            }
+            preview_requested_ = false;
+        }
+
+        // update low-quality 3D reconstruction
+        refresh_data_();
+
+        auto stats = ingest_->stats();
+        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                              << "Ingest ring: " << stats.occupancy << "/"
+                              << stats.capacity << " slots in use (at most "
+                              << stats.max_occupancy << "), "
+                              << stats.received << " received, "
+                              << stats.dropped << " dropped, "
+                              << stats.decimated << " decimated, "
+                              << stats.stalls << " stalls, " << previews_merged_
+                              << " previews merged"
+                              << slicerecon::util::end_log;
+
+        // reported as counters, apart from the timings
+        util::bench.count("ingest queued", stats.occupancy);
+        util::bench.count("ingest dropped", stats.dropped);
+        util::bench.count("ingest decimated", stats.decimated);
+
+        auto cache = slice_cache_.stats();
+        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                              << "Slice cache: " << cache.hits << " hits, "
+                              << cache.misses << " misses, " << cache.entries
+                              << " slices (" << (cache.bytes >> 20) << " MiB), "
+                              << cache.evictions << " evicted"
+                              << slicerecon::util::end_log;
+        util::bench.count("slice cache hits", cache.hits);
+        util::bench.count("slice cache misses", cache.misses);
+    }
 }
 
 /**
- * Upload the CPU sinogram buffer to ASTRA on the GPU
+ * Upload (part of) a CPU sinogram buffer to the solver, i.e. to ASTRA on the
+ * GPU, or to the host buffers of a CPU solver
  *
+ * @param sino The index of the sinogram buffer
  * @param proj_id_begin The starting position of the data in the GPU
  * @param proj_id_end The last position of the data in the GPU
  * @param buffer_begin Position of the to-be-uploaded data in the CPU buffer
  * @param buffer_idx Index of the GPU buffer the sinogram data should be
  * uploaded to
  * @param lock_gpu Whether or not to use gpu_mutex_ to block access to the GPU
+ * @param received Which projections were received, the others are not
+ * uploaded (all of them if this is a null pointer)
  */
-void reconstructor::upload_sino_buffer_(int proj_id_begin, int proj_id_end,
-                                        int buffer_idx, bool lock_gpu) {
+void reconstructor::upload_sino_buffer_(int sino, int proj_id_begin,
+                                        int proj_id_end, size_t buffer_begin,
+                                        int buffer_idx, bool lock_gpu,
+                                        const char* received) {
     if (!initialized_) {
         return;
     }
 
     slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
-                          << "Uploading to buffer (" << active_gpu_buffer_index_
+                          << "Uploading to buffer (" << buffer_idx
                           << ") between " << proj_id_begin << "/" << proj_id_end
                           << slicerecon::util::end_log;
 
     // in continuous mode, there is only one data buffer and it needs to be
     // protected since the reconstruction server has access to it too
-
-    {
-        auto dt = util::bench_scope("GPU upload");
-        if (lock_gpu) {
-            std::lock_guard<std::mutex> guard(gpu_mutex_);
-
-            astra::uploadMultipleProjections(alg_->proj_data(buffer_idx),
-                                             &sino_buffer_[0], proj_id_begin,
-                                             proj_id_end);
-        } else {
-            astra::uploadMultipleProjections(alg_->proj_data(buffer_idx),
-                                             &sino_buffer_[0], proj_id_begin,
-                                             proj_id_end);
-        }
+    auto dt = util::bench_scope("GPU upload");
+    auto data = &sino_buffers_[sino][buffer_begin];
+    auto upload = [&] {
+        detail::upload_received(*alg_, buffer_idx, data, geom_.rows,
+                                geom_.cols, proj_id_begin, proj_id_end,
+                                received, upload_scratch_);
+        ++data_generation_[buffer_idx];
+    };
+    if (lock_gpu) {
+        std::lock_guard<std::mutex> guard(gpu_mutex_);
+        upload();
+    } else {
+        upload();
     }
+}
 
-    // send message to observers that new data is available
-    for (auto l : listeners_) {
-        l->notify(*this);
+/**
+ * Make sure that no slice is sent from the cache that was reconstructed
+ * before now. Slices that are being reconstructed are stored under the
+ * previous generation, and are never found again.
+ */
+void reconstructor::invalidate_slices_() {
+    for (auto& generation : data_generation_) {
+        ++generation;
     }
+    slice_cache_.clear();
 }
 
 void reconstructor::refresh_data_() {
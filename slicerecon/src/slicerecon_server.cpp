@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <functional>
 #include <numeric>
+#include <sstream>
 
 // not required, CLI args parser for testing server settings
 #include "flags/flags.hpp"
@@ -36,10 +40,114 @@ int main(int argc, char** argv)
     auto py_plugin = opts.passed("--pyplugin");
     auto recast_host = opts.arg_or("--recast-host", "localhost");
     auto use_reqrep = opts.passed("--reqrep");
+    // pipelined publishers, with acknowledgements (tomop::publisher with a
+    // ZMQ_DEALER socket)
+    auto use_router = opts.passed("--router");
     auto gaussian_pass = opts.passed("--gaussian");
     auto retrieve_phase = opts.passed("--phase");
     auto bench = opts.passed("--bench");
+    auto compress = opts.passed("--compress");
+    // backproject horizontal parallel beam slices, instead of gridding them
+    auto no_gridrec = opts.passed("--no-gridrec");
+    // grid them on the CPU for the GPU backend as well, which keeps a copy of
+    // the projections in host memory
+    auto gpu_gridrec = opts.passed("--gpu-gridrec");
+    // backproject oblique slices hierarchically (on the CPU, for the GPU
+    // backend from a copy of the projections in host memory), with this error
+    // (in detector pixels) per level. This trades accuracy for speed: `0.25`
+    // is up to 8x faster for large slices, but differs about 1-5% (relative
+    // RMS) from exact backprojection. Zero (the default) is exact
+    auto hierarchical_tolerance =
+    opts.arg_as_or<float>("--hierarchical-tolerance", 0.0f);
     auto filter = opts.arg_or("--filter", "shepp-logan");
+    auto planner_name = opts.arg_or("--fftw-planner", "measure");
+    auto fftw_planner = slicerecon::planner_effort::measure;
+    if (planner_name == "estimate") {
+        fftw_planner = slicerecon::planner_effort::estimate;
+    } else if (planner_name == "patient") {
+        fftw_planner = slicerecon::planner_effort::patient;
+    } else if (planner_name == "exhaustive") {
+        fftw_planner = slicerecon::planner_effort::exhaustive;
+    } else if (planner_name != "measure") {
+        std::cout << opts.usage();
+        std::cout << "ERROR: Unknown FFTW planner " << planner_name << "\n";
+        return -1;
+    }
+    // a comma separated list of cores (or ranges of cores, e.g. `2-9`) for the
+    // projection processing threads
+    auto pinned_cores = std::vector<int32_t>();
+    auto core_text = opts.arg_or("--pin-cores", "");
+    auto core_list = std::stringstream(core_text);
+    auto is_core = [](const std::string& x) {
+        return !x.empty() && x.size() <= 6 &&
+               std::all_of(x.begin(), x.end(),
+                           [](unsigned char c) { return std::isdigit(c); });
+    };
+    for (std::string item; std::getline(core_list, item, ',');) {
+        auto dash = item.find('-');
+        auto first_text = item.substr(0, dash);
+        auto last_text =
+        dash == std::string::npos ? first_text : item.substr(dash + 1);
+        auto valid = is_core(first_text) && is_core(last_text);
+        auto first = valid ? std::stoi(first_text) : 0;
+        auto last = valid ? std::stoi(last_text) : -1;
+        if (first > last) {
+            std::cout << opts.usage();
+            std::cout << "ERROR: Invalid list of cores " << core_text << "\n";
+            return -1;
+        }
+        for (auto core = first; core <= last; ++core) {
+            pinned_cores.push_back(core);
+        }
+    }
+    auto ingest_slots = opts.arg_as_or<int32_t>("--ingest-slots", 0);
+    // the memory (in MiB) for slices that are sent again while their data
+    // is unchanged, zero disables the cache
+    auto slice_cache_mb = opts.arg_as_or<int32_t>("--slice-cache-mb", 64);
+    // what to do when the reconstruction can not keep up: block,
+    // drop-newest (also `--drop-when-full`), drop-oldest-group or decimate
+    auto overload_name =
+    opts.arg_or("--overload", opts.passed("--drop-when-full") ? "drop-newest" : "block");
+    auto overload = slicerecon::overload_policy::block;
+    if (overload_name == "drop-newest") {
+        overload = slicerecon::overload_policy::drop_newest;
+    } else if (overload_name == "drop-oldest-group") {
+        overload = slicerecon::overload_policy::drop_oldest_group;
+    } else if (overload_name == "decimate") {
+        overload = slicerecon::overload_policy::decimate;
+    } else if (overload_name != "block") {
+        std::cout << opts.usage();
+        std::cout << "ERROR: Unknown overload policy " << overload_name << "\n";
+        return -1;
+    }
+    // reconstruct on the GPU (with ASTRA), or on the CPU
+    auto backend_name = opts.arg_or("--backend", "gpu");
+    auto backend = slicerecon::solver_backend::gpu;
+    if (backend_name == "cpu") {
+        backend = slicerecon::solver_backend::cpu;
+    } else if (backend_name != "gpu") {
+        std::cout << opts.usage();
+        std::cout << "ERROR: Unknown backend " << backend_name << "\n";
+        return -1;
+    }
+    auto padding_name = opts.arg_or("--filter-padding", "edge");
+    auto filter_padding = slicerecon::padding::edge;
+    if (padding_name == "zero") {
+        filter_padding = slicerecon::padding::zero;
+    } else if (padding_name != "edge") {
+        std::cout << opts.usage();
+        std::cout << "ERROR: Unknown filter padding " << padding_name << "\n";
+        return -1;
+    }
+
+    // FFTW wisdom is cached so that restarting the server does not require
+    // planning the transforms again
+    auto cache_home = std::getenv("XDG_CACHE_HOME");
+    auto home = std::getenv("HOME");
+    auto default_wisdom_dir =
+    cache_home ? std::string(cache_home) + "/slicerecon"
+               : (home ? std::string(home) + "/.cache/slicerecon" : ""s);
+    auto wisdom_dir = opts.arg_or("--wisdom-dir", default_wisdom_dir);
 
     auto pixel_size = opts.arg_as_or<float>("--pixelsize", 1.0f);
     auto lambda = opts.arg_as_or<float>("--lambda", 1.23984193e-9);
@@ -47,7 +155,9 @@ int main(int argc, char** argv)
     auto beta = opts.arg_as_or<float>("--beta", 1e-10);
     auto distance = opts.arg_as_or<float>("--distance", 40.0f);
 
-    if (slice_size < 0 || preview_size < 0 || group_size < 0 || filter_cores < 0) {
+    if (slice_size < 0 || preview_size < 0 || group_size < 0 ||
+        filter_cores < 0 || ingest_slots < 0 || hierarchical_tolerance < 0.0f ||
+        slice_cache_mb < 0) {
         std::cout << opts.usage();
         std::cout << "ERROR: Negative parameter passed\n";
         return -1;
@@ -61,8 +171,14 @@ int main(int argc, char** argv)
 
     auto params = slicerecon::settings{
     slice_size,     preview_size, group_size, filter_cores,  1, 1, mode, false,
-    retrieve_phase, tilt,         paganin,    gaussian_pass, filter};
+    retrieve_phase, tilt,         paganin,    gaussian_pass, filter,
+    fftw_planner,   wisdom_dir,   filter_padding, pinned_cores,  ingest_slots,
+    overload,       backend,      !no_gridrec,    hierarchical_tolerance,
+    slice_cache_mb, gpu_gridrec};
 
+    // `shm://name` receives from a producer on this host through shared
+    // memory, `shm://name?slot_size=<bytes>` for packets over 32 MiB (i.e.
+    // projections larger than 2048 x 2048 floats)
     auto host = opts.arg_or("--host", "*");
     auto port = opts.arg_as_or<int>("--port", 5558);
 
@@ -77,9 +193,19 @@ int main(int argc, char** argv)
     // 2. listen to projection stream
     // projection callback, push to projection stream
     // all raw data
-    auto proj =
-    slicerecon::projection_server(host, port, *recon, use_reqrep ? ZMQ_REP : ZMQ_PULL);
-    proj.serve();
+    auto proj = std::unique_ptr<slicerecon::projection_server>();
+    try {
+        proj = std::make_unique<slicerecon::projection_server>(
+        host, port, *recon,
+        use_router   ? ZMQ_ROUTER
+        : use_reqrep ? ZMQ_REP
+                     : ZMQ_PULL);
+    } catch (const std::runtime_error& e) {
+        // (e.g. a shared memory ring that is too small for the groups)
+        std::cout << "ERROR: " << e.what() << "\n";
+        return -1;
+    }
+    proj->serve();
 
     // 3. connect with (recast3d) visualization server
     auto viz = slicerecon::visualization_server("slicerecon test",
@@ -88,6 +214,9 @@ int main(int argc, char** argv)
     viz.set_slice_callback(
     [&](auto x, auto idx) { return recon->reconstruct_slice(x); });
     recon->add_listener(&viz);
+    if (compress) {
+        viz.set_compression(tomop::codec::shuffle_lz);
+    }
 
     auto plugin_one =
     slicerecon::plugin("tcp://*:5650", "tcp://localhost:5651");
@@ -0,0 +1,150 @@
+#include <algorithm>
+
+#include "slicerecon/util/futex.hpp"
+#include "slicerecon/util/ingest_ring.hpp"
+
+namespace slicerecon::util {
+
+namespace {
+
+// a few microseconds, projections of a fast detector arrive at least this
+// often, so the consumers rarely have to go to sleep
+constexpr int spin_iterations = 1 << 10;
+
+} // namespace
+
+ingest_ring::ingest_ring(int capacity)
+    : capacity_(std::max(capacity, 1)),
+      slots_(std::make_unique<slot[]>(capacity_)) {
+    // a slot at position p is free for the producer if its sequence equals
+    // p, and filled for the consumers if it equals p + 1
+    for (int i = 0; i < capacity_; ++i) {
+        slots_[i].sequence_.store(i, std::memory_order_relaxed);
+    }
+}
+
+ingest_ring::~ingest_ring() = default;
+
+ingest_ring::slot* ingest_ring::claim(bool wait) {
+    auto& s = slots_[tail_ % capacity_];
+
+    for (int i = 0;; ++i) {
+        if (stop_.load()) {
+            return nullptr;
+        }
+        if (s.sequence_.load(std::memory_order_acquire) == tail_) {
+            return &s;
+        }
+        if (!wait) {
+            return nullptr;
+        }
+        if (i == 0) {
+            stalls_.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (i < spin_iterations) {
+            cpu_relax();
+            continue;
+        }
+
+        // announce that we are going to sleep before checking one last time,
+        // so that a release in between either is seen, or wakes us up
+        producer_waiting_.store(1);
+        auto ticket = freed_.load();
+        if (s.sequence_.load(std::memory_order_acquire) != tail_ &&
+            !stop_.load()) {
+            futex_wait(freed_, ticket);
+        }
+        producer_waiting_.store(0);
+    }
+}
+
+void ingest_ring::publish() {
+    auto& s = slots_[tail_ % capacity_];
+    s.sequence_.store(tail_ + 1, std::memory_order_release);
+    ++tail_;
+    published_tail_.store(tail_, std::memory_order_relaxed);
+
+    auto occupancy = (int)(tail_ - head_.load(std::memory_order_relaxed));
+    if (occupancy > max_occupancy_.load(std::memory_order_relaxed)) {
+        max_occupancy_.store(occupancy, std::memory_order_relaxed);
+    }
+
+    filled_.fetch_add(1);
+    if (consumers_waiting_.load() > 0) {
+        futex_wake(filled_);
+    }
+}
+
+ingest_ring::slot* ingest_ring::pop() {
+    for (int i = 0;; ++i) {
+        if (stop_.load()) {
+            return nullptr;
+        }
+
+        auto position = head_.load(std::memory_order_relaxed);
+        auto& s = slots_[position % capacity_];
+        auto ahead = (int64_t)(s.sequence_.load(std::memory_order_acquire) -
+                               (position + 1));
+        if (ahead == 0) {
+            // filled, try to take it before another consumer does
+            if (head_.compare_exchange_weak(position, position + 1,
+                                            std::memory_order_relaxed)) {
+                s.position_ = position;
+                return &s;
+            }
+            continue;
+        }
+        if (ahead > 0) {
+            // taken by another consumer in the meantime
+            continue;
+        }
+
+        // the ring is empty
+        if (i < spin_iterations) {
+            cpu_relax();
+            continue;
+        }
+        consumers_waiting_.fetch_add(1);
+        auto ticket = filled_.load();
+        if (s.sequence_.load(std::memory_order_acquire) != position + 1 &&
+            !stop_.load()) {
+            futex_wait(filled_, ticket);
+        }
+        consumers_waiting_.fetch_sub(1);
+    }
+}
+
+void ingest_ring::release(slot* s) {
+    s->pixels = {};
+    s->owner.reset();
+    s->sequence_.store(s->position_ + capacity_, std::memory_order_release);
+
+    freed_.fetch_add(1);
+    if (producer_waiting_.load() > 0) {
+        futex_wake(freed_);
+    }
+}
+
+void ingest_ring::stop() {
+    stop_.store(true);
+    filled_.fetch_add(1);
+    freed_.fetch_add(1);
+    futex_wake(filled_);
+    futex_wake(freed_);
+}
+
+ingest_stats ingest_ring::stats() const {
+    auto received = published_tail_.load(std::memory_order_relaxed);
+    auto head = head_.load(std::memory_order_relaxed);
+    auto result = ingest_stats{};
+    result.capacity = capacity_;
+    result.occupancy = received > head ? (int)(received - head) : 0;
+    result.max_occupancy = max_occupancy_.load(std::memory_order_relaxed);
+    result.received = (int64_t)received;
+    result.dropped = dropped_.load(std::memory_order_relaxed);
+    result.decimated = decimated_.load(std::memory_order_relaxed);
+    result.stalls = stalls_.load(std::memory_order_relaxed);
+    return result;
+}
+
+} // namespace slicerecon::util
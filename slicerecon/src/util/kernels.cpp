@@ -0,0 +1,711 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SLICERECON_X86
+#endif
+
+#include "slicerecon/util/kernels.hpp"
+
+namespace slicerecon::util::kernels {
+
+namespace {
+
+template <typename T>
+using kernel_type = void (*)(const T*, float*, const float*, const float*,
+                             const float*, std::size_t);
+
+inline float neglog(float x) { return x <= 0.0f ? 0.0f : -std::log(x); }
+
+// The vectorized logarithms below follow the single precision Cephes `logf`:
+// split x = m * 2^e with m in [sqrt(1/2), sqrt(2)), and approximate log(m)
+// with a degree 9 polynomial. This is accurate to within a few ulp for the
+// (normalized, positive) range we care about.
+constexpr float log_p[] = {7.0376836292e-2f,  -1.1514610310e-1f,
+                           1.1676998740e-1f,  -1.2420140846e-1f,
+                           1.4249322787e-1f,  -1.6668057665e-1f,
+                           2.0000714765e-1f,  -2.4999993993e-1f,
+                           3.3333331174e-1f};
+constexpr float sqrt_half = 0.707106781186547524f;
+constexpr float log_q1 = -2.12194440e-4f;
+constexpr float log_q2 = 0.693359375f;
+
+// a bilinear sample of a projection, with the pixel centers at half-integer
+// coordinates, and zero outside of the detector
+inline float sample(const float* projection, int rows, int cols, float u,
+                    float v) {
+    auto x = u - 0.5f;
+    auto y = v - 0.5f;
+    // (written such that NaN is outside as well)
+    if (!(x > -1.0f && x < (float)cols && y > -1.0f && y < (float)rows)) {
+        return 0.0f;
+    }
+    auto fx = std::floor(x);
+    auto fy = std::floor(y);
+    auto c = (int)fx;
+    auto r = (int)fy;
+    auto at = [&](int row, int col) {
+        return (row >= 0 && row < rows && col >= 0 && col < cols)
+                   ? projection[(std::size_t)row * cols + col]
+                   : 0.0f;
+    };
+    auto top = at(r, c) + (x - fx) * (at(r, c + 1) - at(r, c));
+    auto bottom = at(r + 1, c) + (x - fx) * (at(r + 1, c + 1) - at(r + 1, c));
+    return top + (y - fy) * (bottom - top);
+}
+
+template <bool cone>
+void backproject_scalar(const float* projection, int rows, int cols,
+                        const voxel_line& line, float* out, std::size_t from,
+                        std::size_t n) {
+    for (auto i = from; i < n; ++i) {
+        auto k = (float)i;
+        auto u = line.u + k * line.du;
+        auto v = line.v + k * line.dv;
+        if constexpr (cone) {
+            auto w = line.w + k * line.dw;
+            if (!(w > 0.0f)) {
+                continue;
+            }
+            auto r = 1.0f / w;
+            out[i] += r * r * sample(projection, rows, cols, u * r, v * r);
+        } else {
+            out[i] += sample(projection, rows, cols, u, v);
+        }
+    }
+}
+
+#ifdef SLICERECON_X86
+
+__attribute__((target("avx2,fma"))) inline __m256 log_avx2(__m256 x) {
+    auto one = _mm256_set1_ps(1.0f);
+
+    // avoid denormals, these are clamped by the caller anyway
+    x = _mm256_max_ps(x, _mm256_set1_ps(1.17549435e-38f));
+
+    auto xi = _mm256_castps_si256(x);
+    auto e = _mm256_sub_epi32(_mm256_srli_epi32(xi, 23), _mm256_set1_epi32(126));
+    xi = _mm256_and_si256(xi, _mm256_set1_epi32(0x807fffff));
+    xi = _mm256_or_si256(xi, _mm256_set1_epi32(0x3f000000));
+    auto m = _mm256_castsi256_ps(xi);
+    auto fe = _mm256_cvtepi32_ps(e);
+
+    auto small = _mm256_cmp_ps(m, _mm256_set1_ps(sqrt_half), _CMP_LT_OQ);
+    fe = _mm256_sub_ps(fe, _mm256_and_ps(one, small));
+    m = _mm256_add_ps(_mm256_sub_ps(m, one), _mm256_and_ps(m, small));
+
+    auto z = _mm256_mul_ps(m, m);
+    auto y = _mm256_set1_ps(log_p[0]);
+    for (int i = 1; i < 9; ++i) {
+        y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(log_p[i]));
+    }
+    y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+    y = _mm256_fmadd_ps(fe, _mm256_set1_ps(log_q1), y);
+    y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+    m = _mm256_add_ps(m, y);
+    return _mm256_fmadd_ps(fe, _mm256_set1_ps(log_q2), m);
+}
+
+// Load 8 pixels of a raw projection, converted to float. Unsigned 32-bit
+// integers do not fit the signed conversion, so their high and low halves
+// are converted separately.
+__attribute__((target("avx2,fma"))) inline __m256 load_avx2(const float* in) {
+    return _mm256_loadu_ps(in);
+}
+
+__attribute__((target("avx2,fma"))) inline __m256
+load_avx2(const uint8_t* in) {
+    return _mm256_cvtepi32_ps(
+        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)in)));
+}
+
+__attribute__((target("avx2,fma"))) inline __m256
+load_avx2(const uint16_t* in) {
+    return _mm256_cvtepi32_ps(
+        _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)in)));
+}
+
+__attribute__((target("avx2,fma"))) inline __m256
+load_avx2(const uint32_t* in) {
+    auto x = _mm256_loadu_si256((const __m256i*)in);
+    auto high = _mm256_cvtepi32_ps(_mm256_srli_epi32(x, 16));
+    auto low = _mm256_cvtepi32_ps(
+        _mm256_and_si256(x, _mm256_set1_epi32(0xffff)));
+    return _mm256_fmadd_ps(high, _mm256_set1_ps(65536.0f), low);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma"))) void
+flatfield_neglog_avx2(const T* in, float* out, const float* dark,
+                      const float* reciproc, const float* weights,
+                      std::size_t n) {
+    auto zero = _mm256_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        auto x = _mm256_mul_ps(
+            _mm256_sub_ps(load_avx2(in + i), _mm256_loadu_ps(dark + i)),
+            _mm256_loadu_ps(reciproc + i));
+        auto positive = _mm256_cmp_ps(x, zero, _CMP_GT_OQ);
+        auto y = _mm256_and_ps(_mm256_sub_ps(zero, log_avx2(x)), positive);
+        if (weights) {
+            y = _mm256_mul_ps(y, _mm256_loadu_ps(weights + i));
+        }
+        _mm256_storeu_ps(out + i, y);
+    }
+    for (; i < n; ++i) {
+        auto y = neglog(((float)in[i] - dark[i]) * reciproc[i]);
+        out[i] = weights ? y * weights[i] : y;
+    }
+}
+
+__attribute__((target("avx512f"))) inline __m512 log_avx512(__m512 x) {
+    auto one = _mm512_set1_ps(1.0f);
+
+    x = _mm512_max_ps(x, _mm512_set1_ps(1.17549435e-38f));
+
+    auto xi = _mm512_castps_si512(x);
+    auto e = _mm512_sub_epi32(_mm512_srli_epi32(xi, 23), _mm512_set1_epi32(126));
+    xi = _mm512_and_si512(xi, _mm512_set1_epi32(0x807fffff));
+    xi = _mm512_or_si512(xi, _mm512_set1_epi32(0x3f000000));
+    auto m = _mm512_castsi512_ps(xi);
+    auto fe = _mm512_cvtepi32_ps(e);
+
+    auto small = _mm512_cmp_ps_mask(m, _mm512_set1_ps(sqrt_half), _CMP_LT_OQ);
+    fe = _mm512_mask_sub_ps(fe, small, fe, one);
+    m = _mm512_mask_add_ps(_mm512_sub_ps(m, one), small, _mm512_sub_ps(m, one),
+                           m);
+
+    auto z = _mm512_mul_ps(m, m);
+    auto y = _mm512_set1_ps(log_p[0]);
+    for (int i = 1; i < 9; ++i) {
+        y = _mm512_fmadd_ps(y, m, _mm512_set1_ps(log_p[i]));
+    }
+    y = _mm512_mul_ps(_mm512_mul_ps(y, m), z);
+    y = _mm512_fmadd_ps(fe, _mm512_set1_ps(log_q1), y);
+    y = _mm512_fnmadd_ps(z, _mm512_set1_ps(0.5f), y);
+    m = _mm512_add_ps(m, y);
+    return _mm512_fmadd_ps(fe, _mm512_set1_ps(log_q2), m);
+}
+
+// Load 16 pixels of a raw projection, converted to float.
+__attribute__((target("avx512f"))) inline __m512
+load_avx512(const float* in) {
+    return _mm512_loadu_ps(in);
+}
+
+__attribute__((target("avx512f"))) inline __m512
+load_avx512(const uint8_t* in) {
+    return _mm512_cvtepi32_ps(
+        _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)in)));
+}
+
+__attribute__((target("avx512f"))) inline __m512
+load_avx512(const uint16_t* in) {
+    return _mm512_cvtepi32_ps(
+        _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)in)));
+}
+
+__attribute__((target("avx512f"))) inline __m512
+load_avx512(const uint32_t* in) {
+    return _mm512_cvtepu32_ps(_mm512_loadu_si512(in));
+}
+
+template <typename T>
+__attribute__((target("avx512f"))) void
+flatfield_neglog_avx512(const T* in, float* out, const float* dark,
+                        const float* reciproc, const float* weights,
+                        std::size_t n) {
+    auto zero = _mm512_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto x = _mm512_mul_ps(
+            _mm512_sub_ps(load_avx512(in + i), _mm512_loadu_ps(dark + i)),
+            _mm512_loadu_ps(reciproc + i));
+        auto positive = _mm512_cmp_ps_mask(x, zero, _CMP_GT_OQ);
+        auto y = _mm512_maskz_sub_ps(positive, zero, log_avx512(x));
+        if (weights) {
+            y = _mm512_mul_ps(y, _mm512_loadu_ps(weights + i));
+        }
+        _mm512_storeu_ps(out + i, y);
+    }
+    for (; i < n; ++i) {
+        auto y = neglog(((float)in[i] - dark[i]) * reciproc[i]);
+        out[i] = weights ? y * weights[i] : y;
+    }
+}
+
+__attribute__((target("avx2,fma"))) void
+neglog_scale_avx2(const float* in, float* out, float scale, std::size_t n) {
+    auto zero = _mm256_setzero_ps();
+    auto factor = _mm256_set1_ps(-scale);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        auto x = _mm256_loadu_ps(in + i);
+        auto positive = _mm256_cmp_ps(x, zero, _CMP_GT_OQ);
+        auto y = _mm256_mul_ps(log_avx2(x), factor);
+        _mm256_storeu_ps(out + i, _mm256_and_ps(y, positive));
+    }
+    for (; i < n; ++i) {
+        out[i] = scale * neglog(in[i]);
+    }
+}
+
+__attribute__((target("avx512f"))) void
+neglog_scale_avx512(const float* in, float* out, float scale, std::size_t n) {
+    auto zero = _mm512_setzero_ps();
+    auto factor = _mm512_set1_ps(-scale);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto x = _mm512_loadu_ps(in + i);
+        auto positive = _mm512_cmp_ps_mask(x, zero, _CMP_GT_OQ);
+        auto y = _mm512_maskz_mul_ps(positive, log_avx512(x), factor);
+        _mm512_storeu_ps(out + i, y);
+    }
+    for (; i < n; ++i) {
+        out[i] = scale * neglog(in[i]);
+    }
+}
+
+__attribute__((target("avx2,fma"))) void
+fdk_row_weights_avx2(float rho, float constant, float linear, float quadratic,
+                     float* out, std::size_t n) {
+    auto index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        auto c = _mm256_add_ps(_mm256_set1_ps((float)i), index);
+        auto q = _mm256_fmadd_ps(c, _mm256_set1_ps(quadratic),
+                                 _mm256_set1_ps(linear));
+        q = _mm256_fmadd_ps(c, q, _mm256_set1_ps(constant));
+        _mm256_storeu_ps(out + i, _mm256_div_ps(_mm256_set1_ps(rho),
+                                                _mm256_sqrt_ps(q)));
+    }
+    for (; i < n; ++i) {
+        out[i] = rho / std::sqrt(constant + i * (linear + i * quadratic));
+    }
+}
+
+__attribute__((target("avx512f"))) void
+fdk_row_weights_avx512(float rho, float constant, float linear,
+                       float quadratic, float* out, std::size_t n) {
+    auto index = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+                                14, 15);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto c = _mm512_add_ps(_mm512_set1_ps((float)i), index);
+        auto q = _mm512_fmadd_ps(c, _mm512_set1_ps(quadratic),
+                                 _mm512_set1_ps(linear));
+        q = _mm512_fmadd_ps(c, q, _mm512_set1_ps(constant));
+        _mm512_storeu_ps(out + i, _mm512_div_ps(_mm512_set1_ps(rho),
+                                                _mm512_sqrt_ps(q)));
+    }
+    for (; i < n; ++i) {
+        out[i] = rho / std::sqrt(constant + i * (linear + i * quadratic));
+    }
+}
+
+// The backprojection kernels sample the four neighbouring pixels with
+// (masked) gathers, the pixels outside of the detector are masked out and
+// read as zero.
+__attribute__((target("avx2,fma"))) inline __m256
+gather_avx2(const float* data, __m256i offset, __m256i mask) {
+    return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), data, offset,
+                                    _mm256_castsi256_ps(mask), 4);
+}
+
+template <bool cone>
+__attribute__((target("avx2,fma"))) void
+backproject_avx2(const float* projection, int rows, int cols,
+                 const voxel_line& line, float* out, std::size_t n) {
+    auto index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    auto zero = _mm256_setzero_ps();
+    auto one = _mm256_set1_ps(1.0f);
+    auto half = _mm256_set1_ps(0.5f);
+    auto minus_one = _mm256_set1_ps(-1.0f);
+    auto width = _mm256_set1_ps((float)cols);
+    auto height = _mm256_set1_ps((float)rows);
+    auto stride = _mm256_set1_epi32(cols);
+    auto last_col = _mm256_set1_epi32(cols - 1);
+    auto last_row = _mm256_set1_epi32(rows - 1);
+    auto before = _mm256_set1_epi32(-1);
+    auto step = _mm256_set1_epi32(1);
+
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        auto k = _mm256_add_ps(_mm256_set1_ps((float)i), index);
+        auto x = _mm256_fmadd_ps(k, _mm256_set1_ps(line.du),
+                                 _mm256_set1_ps(line.u));
+        auto y = _mm256_fmadd_ps(k, _mm256_set1_ps(line.dv),
+                                 _mm256_set1_ps(line.v));
+        auto weight = one;
+        auto inside = _mm256_cmp_ps(one, one, _CMP_EQ_OQ);
+        if constexpr (cone) {
+            auto w = _mm256_fmadd_ps(k, _mm256_set1_ps(line.dw),
+                                     _mm256_set1_ps(line.w));
+            auto r = _mm256_div_ps(one, w);
+            x = _mm256_mul_ps(x, r);
+            y = _mm256_mul_ps(y, r);
+            weight = _mm256_mul_ps(r, r);
+            inside = _mm256_cmp_ps(w, zero, _CMP_GT_OQ);
+        }
+        x = _mm256_sub_ps(x, half);
+        y = _mm256_sub_ps(y, half);
+        inside = _mm256_and_ps(
+            inside,
+            _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, minus_one, _CMP_GT_OQ),
+                                        _mm256_cmp_ps(x, width, _CMP_LT_OQ)),
+                          _mm256_and_ps(_mm256_cmp_ps(y, minus_one, _CMP_GT_OQ),
+                                        _mm256_cmp_ps(y, height, _CMP_LT_OQ))));
+        if (_mm256_movemask_ps(inside) == 0) {
+            continue;
+        }
+
+        // the lanes outside are not sampled, but keep their conversion sane
+        x = _mm256_blendv_ps(zero, x, inside);
+        y = _mm256_blendv_ps(zero, y, inside);
+        auto fx = _mm256_floor_ps(x);
+        auto fy = _mm256_floor_ps(y);
+        auto ax = _mm256_sub_ps(x, fx);
+        auto ay = _mm256_sub_ps(y, fy);
+        auto c = _mm256_cvttps_epi32(fx);
+        auto r = _mm256_cvttps_epi32(fy);
+
+        auto valid = _mm256_castps_si256(inside);
+        auto row_0 = _mm256_and_si256(valid, _mm256_cmpgt_epi32(r, before));
+        auto row_1 = _mm256_and_si256(valid, _mm256_cmpgt_epi32(last_row, r));
+        auto col_0 = _mm256_cmpgt_epi32(c, before);
+        auto col_1 = _mm256_cmpgt_epi32(last_col, c);
+
+        auto at = _mm256_add_epi32(_mm256_mullo_epi32(r, stride), c);
+        auto p00 = gather_avx2(projection, at, _mm256_and_si256(row_0, col_0));
+        auto p01 = gather_avx2(projection, _mm256_add_epi32(at, step),
+                               _mm256_and_si256(row_0, col_1));
+        at = _mm256_add_epi32(at, stride);
+        auto p10 = gather_avx2(projection, at, _mm256_and_si256(row_1, col_0));
+        auto p11 = gather_avx2(projection, _mm256_add_epi32(at, step),
+                               _mm256_and_si256(row_1, col_1));
+
+        auto top = _mm256_fmadd_ps(ax, _mm256_sub_ps(p01, p00), p00);
+        auto bottom = _mm256_fmadd_ps(ax, _mm256_sub_ps(p11, p10), p10);
+        auto value = _mm256_fmadd_ps(ay, _mm256_sub_ps(bottom, top), top);
+        if constexpr (cone) {
+            value = _mm256_and_ps(_mm256_mul_ps(value, weight), inside);
+        }
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), value));
+    }
+    backproject_scalar<cone>(projection, rows, cols, line, out, i, n);
+}
+
+template <bool cone>
+__attribute__((target("avx512f"))) void
+backproject_avx512(const float* projection, int rows, int cols,
+                   const voxel_line& line, float* out, std::size_t n) {
+    auto index = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+                                14, 15);
+    auto zero = _mm512_setzero_ps();
+    auto one = _mm512_set1_ps(1.0f);
+    auto half = _mm512_set1_ps(0.5f);
+    auto minus_one = _mm512_set1_ps(-1.0f);
+    auto width = _mm512_set1_ps((float)cols);
+    auto height = _mm512_set1_ps((float)rows);
+    auto stride = _mm512_set1_epi32(cols);
+    auto last_col = _mm512_set1_epi32(cols - 1);
+    auto last_row = _mm512_set1_epi32(rows - 1);
+    auto before = _mm512_set1_epi32(-1);
+    auto step = _mm512_set1_epi32(1);
+
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto k = _mm512_add_ps(_mm512_set1_ps((float)i), index);
+        auto x = _mm512_fmadd_ps(k, _mm512_set1_ps(line.du),
+                                 _mm512_set1_ps(line.u));
+        auto y = _mm512_fmadd_ps(k, _mm512_set1_ps(line.dv),
+                                 _mm512_set1_ps(line.v));
+        auto weight = one;
+        __mmask16 inside = 0xffff;
+        if constexpr (cone) {
+            auto w = _mm512_fmadd_ps(k, _mm512_set1_ps(line.dw),
+                                     _mm512_set1_ps(line.w));
+            auto r = _mm512_div_ps(one, w);
+            x = _mm512_mul_ps(x, r);
+            y = _mm512_mul_ps(y, r);
+            weight = _mm512_mul_ps(r, r);
+            inside = _mm512_cmp_ps_mask(w, zero, _CMP_GT_OQ);
+        }
+        x = _mm512_sub_ps(x, half);
+        y = _mm512_sub_ps(y, half);
+        inside &= _mm512_cmp_ps_mask(x, minus_one, _CMP_GT_OQ) &
+                  _mm512_cmp_ps_mask(x, width, _CMP_LT_OQ) &
+                  _mm512_cmp_ps_mask(y, minus_one, _CMP_GT_OQ) &
+                  _mm512_cmp_ps_mask(y, height, _CMP_LT_OQ);
+        if (inside == 0) {
+            continue;
+        }
+
+        x = _mm512_maskz_mov_ps(inside, x);
+        y = _mm512_maskz_mov_ps(inside, y);
+        auto fx = _mm512_roundscale_ps(x, _MM_FROUND_TO_NEG_INF);
+        auto fy = _mm512_roundscale_ps(y, _MM_FROUND_TO_NEG_INF);
+        auto ax = _mm512_sub_ps(x, fx);
+        auto ay = _mm512_sub_ps(y, fy);
+        auto c = _mm512_cvttps_epi32(fx);
+        auto r = _mm512_cvttps_epi32(fy);
+
+        auto row_0 = _mm512_mask_cmpgt_epi32_mask(inside, r, before);
+        auto row_1 = _mm512_mask_cmpgt_epi32_mask(inside, last_row, r);
+        auto col_0 = _mm512_cmpgt_epi32_mask(c, before);
+        auto col_1 = _mm512_cmpgt_epi32_mask(last_col, c);
+
+        auto at = _mm512_add_epi32(_mm512_mullo_epi32(r, stride), c);
+        auto p00 = _mm512_mask_i32gather_ps(zero, row_0 & col_0, at,
+                                            projection, 4);
+        auto p01 = _mm512_mask_i32gather_ps(
+            zero, row_0 & col_1, _mm512_add_epi32(at, step), projection, 4);
+        at = _mm512_add_epi32(at, stride);
+        auto p10 = _mm512_mask_i32gather_ps(zero, row_1 & col_0, at,
+                                            projection, 4);
+        auto p11 = _mm512_mask_i32gather_ps(
+            zero, row_1 & col_1, _mm512_add_epi32(at, step), projection, 4);
+
+        auto top = _mm512_fmadd_ps(ax, _mm512_sub_ps(p01, p00), p00);
+        auto bottom = _mm512_fmadd_ps(ax, _mm512_sub_ps(p11, p10), p10);
+        auto value = _mm512_fmadd_ps(ay, _mm512_sub_ps(bottom, top), top);
+        if constexpr (cone) {
+            value = _mm512_maskz_mul_ps(inside, value, weight);
+        }
+        _mm512_storeu_ps(out + i, _mm512_add_ps(_mm512_loadu_ps(out + i), value));
+    }
+    backproject_scalar<cone>(projection, rows, cols, line, out, i, n);
+}
+
+#endif
+
+void fdk_row_weights_scalar(float rho, float constant, float linear,
+                            float quadratic, float* out, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = rho / std::sqrt(constant + i * (linear + i * quadratic));
+    }
+}
+
+void neglog_scale_scalar(const float* in, float* out, float scale,
+                         std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = scale * neglog(in[i]);
+    }
+}
+
+using neglog_kernel_type = void (*)(const float*, float*, float, std::size_t);
+
+neglog_kernel_type select_neglog_scale() {
+#ifdef SLICERECON_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return neglog_scale_avx512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return neglog_scale_avx2;
+    }
+#endif
+    return neglog_scale_scalar;
+}
+
+using weights_kernel_type = void (*)(float, float, float, float, float*,
+                                     std::size_t);
+
+weights_kernel_type select_fdk_row_weights() {
+#ifdef SLICERECON_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return fdk_row_weights_avx512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return fdk_row_weights_avx2;
+    }
+#endif
+    return fdk_row_weights_scalar;
+}
+
+using backproject_kernel_type = void (*)(const float*, int, int,
+                                         const voxel_line&, float*,
+                                         std::size_t);
+
+template <bool cone>
+void backproject_scalar_(const float* projection, int rows, int cols,
+                         const voxel_line& line, float* out, std::size_t n) {
+    backproject_scalar<cone>(projection, rows, cols, line, out, 0, n);
+}
+
+template <bool cone>
+backproject_kernel_type select_backproject() {
+#ifdef SLICERECON_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return backproject_avx512<cone>;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return backproject_avx2<cone>;
+    }
+#endif
+    return backproject_scalar_<cone>;
+}
+
+template <typename T>
+void flatfield_neglog_scalar_(const T* in, float* out, const float* dark,
+                              const float* reciproc, const float* weights,
+                              std::size_t n) {
+    if (weights) {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] =
+                weights[i] * neglog(((float)in[i] - dark[i]) * reciproc[i]);
+        }
+    } else {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = neglog(((float)in[i] - dark[i]) * reciproc[i]);
+        }
+    }
+}
+
+template <typename T>
+kernel_type<T> select_flatfield_neglog() {
+#ifdef SLICERECON_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return flatfield_neglog_avx512<T>;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return flatfield_neglog_avx2<T>;
+    }
+#endif
+    return flatfield_neglog_scalar_<T>;
+}
+
+template <typename T>
+void flatfield_neglog_(const T* in, float* out, const float* dark,
+                       const float* reciproc, const float* weights,
+                       std::size_t n) {
+    static const auto kernel = select_flatfield_neglog<T>();
+    kernel(in, out, dark, reciproc, weights, n);
+}
+
+} // namespace
+
+void flatfield_neglog_scalar(const float* in, float* out, const float* dark,
+                             const float* reciproc, const float* weights,
+                             std::size_t n) {
+    flatfield_neglog_scalar_(in, out, dark, reciproc, weights, n);
+}
+
+void flatfield_neglog_scalar(const uint16_t* in, float* out,
+                             const float* dark, const float* reciproc,
+                             const float* weights, std::size_t n) {
+    flatfield_neglog_scalar_(in, out, dark, reciproc, weights, n);
+}
+
+void flatfield_neglog(const float* in, float* out, const float* dark,
+                      const float* reciproc, const float* weights,
+                      std::size_t n) {
+    flatfield_neglog_(in, out, dark, reciproc, weights, n);
+}
+
+void flatfield_neglog(const uint8_t* in, float* out, const float* dark,
+                      const float* reciproc, const float* weights,
+                      std::size_t n) {
+    flatfield_neglog_(in, out, dark, reciproc, weights, n);
+}
+
+void flatfield_neglog(const uint16_t* in, float* out, const float* dark,
+                      const float* reciproc, const float* weights,
+                      std::size_t n) {
+    flatfield_neglog_(in, out, dark, reciproc, weights, n);
+}
+
+void flatfield_neglog(const uint32_t* in, float* out, const float* dark,
+                      const float* reciproc, const float* weights,
+                      std::size_t n) {
+    flatfield_neglog_(in, out, dark, reciproc, weights, n);
+}
+
+void neglog_scale(const float* in, float* out, float scale, std::size_t n) {
+    static const auto kernel = select_neglog_scale();
+    kernel(in, out, scale, n);
+}
+
+void fdk_row_weights(float rho, float constant, float linear, float quadratic,
+                     float* out, std::size_t n) {
+    static const auto kernel = select_fdk_row_weights();
+    kernel(rho, constant, linear, quadratic, out, n);
+}
+
+void backproject_parallel(const float* projection, int rows, int cols,
+                          const voxel_line& line, float* out, std::size_t n) {
+    static const auto kernel = select_backproject<false>();
+    if (n == 0) {
+        return;
+    }
+    // the detector coordinates are linear along the line, so whether it
+    // misses the detector altogether follows from its end points
+    auto last = (float)(n - 1);
+    auto u_end = line.u + last * line.du;
+    auto v_end = line.v + last * line.dv;
+    if (std::max(line.u, u_end) <= -0.5f ||
+        std::min(line.u, u_end) >= cols + 0.5f ||
+        std::max(line.v, v_end) <= -0.5f ||
+        std::min(line.v, v_end) >= rows + 0.5f) {
+        return;
+    }
+    kernel(projection, rows, cols, line, out, n);
+}
+
+void backproject_cone(const float* projection, int rows, int cols,
+                      const voxel_line& line, float* out, std::size_t n) {
+    static const auto kernel = select_backproject<true>();
+    kernel(projection, rows, cols, line, out, n);
+}
+
+void stream_copy(const float* src, float* dst, std::size_t n) {
+#ifdef SLICERECON_X86
+    // the (SSE) streaming stores need an aligned destination
+    std::size_t i = 0;
+    for (; i < n && ((std::uintptr_t)(dst + i) & 15) != 0; ++i) {
+        dst[i] = src[i];
+    }
+    for (; i + 16 <= n; i += 16) {
+        auto a = _mm_loadu_ps(src + i);
+        auto b = _mm_loadu_ps(src + i + 4);
+        auto c = _mm_loadu_ps(src + i + 8);
+        auto d = _mm_loadu_ps(src + i + 12);
+        _mm_stream_ps(dst + i, a);
+        _mm_stream_ps(dst + i + 4, b);
+        _mm_stream_ps(dst + i + 8, c);
+        _mm_stream_ps(dst + i + 12, d);
+    }
+    for (; i < n; ++i) {
+        dst[i] = src[i];
+    }
+#else
+    std::memcpy(dst, src, n * sizeof(float));
+#endif
+}
+
+void stream_fence() {
+#ifdef SLICERECON_X86
+    _mm_sfence();
+#endif
+}
+
+std::string instruction_set() {
+#ifdef SLICERECON_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return "avx512";
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return "avx2";
+    }
+#endif
+    return "scalar";
+}
+
+} // namespace slicerecon::util::kernels
@@ -3,50 +3,70 @@
 #include <algorithm>
 #include <cmath>
 #include <complex>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
 
 #include "slicerecon/util/bench.hpp"
-#include "slicerecon/util/processing.hpp"
+#include "slicerecon/util/kernels.hpp"
 #include "slicerecon/util/log.hpp"
+#include "slicerecon/util/processing.hpp"
 
 namespace slicerecon::util {
 
 namespace filter {
 
-std::vector<float> ram_lak(int cols)
+int smooth_size(int size)
 {
-    auto result = std::vector<float>(cols);
-    auto mid = (cols + 1) / 2;
-    for (int i = 0; i < mid; ++i) {
-        result[i] = i;
+    // FFTW is fastest on these sizes
+    for (int n = std::max(size + size % 2, 2);; n += 2) {
+        auto m = n;
+        for (auto p : {2, 3, 5, 7}) {
+            while (m % p == 0) {
+                m /= p;
+            }
+        }
+        if (m == 1) {
+            return n;
+        }
     }
-    for (int j = mid; j < cols; ++j) {
-        result[j] = 2 * mid - j;
+}
+
+int padded_size(int cols)
+{
+    // padding to twice the width avoids the wrap-around of the (circular)
+    // convolution
+    return smooth_size(2 * std::max(cols, 1));
+}
+
+std::vector<float> ram_lak(int n)
+{
+    auto result = std::vector<float>(n / 2 + 1);
+    auto nyquist = (float)(n / 2);
+    for (int i = 0; i <= n / 2; ++i) {
+        result[i] = i / nyquist;
     }
     return result;
 }
 
-std::vector<float> shepp_logan(int cols)
+std::vector<float> shepp_logan(int n)
 {
-    auto result = std::vector<float>(cols);
-    auto mid = (cols + 1) / 2;
+    auto result = std::vector<float>(n / 2 + 1);
+    auto nyquist = (float)(n / 2);
 
     auto filter_weight = [=](auto i) {
-        auto norm_freq = (i / (float)mid);
+        auto norm_freq = (i / nyquist);
         return norm_freq * std::sin(M_PI * norm_freq) / (M_PI * norm_freq);
     };
 
-    for (int i = 1; i < mid; ++i) {
+    for (int i = 1; i <= n / 2; ++i) {
         result[i] = filter_weight(i);
     }
-    for (int j = mid; j < cols; ++j) {
-        result[j] = filter_weight(2 * mid - j);
-    }
     return result;
 }
 
-std::vector<float> from_file(std::string filename, int cols, int proj_count)
+std::vector<float> from_file(std::string filename, int cols, int proj_count, int n)
 {
     auto result = std::vector<float>();
 
@@ -81,50 +101,62 @@ std::vector<float> from_file(std::string filename, int cols, int proj_count)
             << LOG_FILE << slicerecon::util::lvl::warning
             << "Problem reading filter file, using Shepp-Logan filter instead"
             << slicerecon::util::end_log;
-        return shepp_logan(cols);
+        return shepp_logan(n);
     }
-    return result;
+
+    // the file stores full spectra of `cols` bins, we resample the positive
+    // frequencies onto the half spectrum of the padded length
+    auto half = n / 2 + 1;
+    auto count = (int)(result.size() / cols);
+    auto resampled = std::vector<float>((size_t)half * count);
+    for (int p = 0; p < count; ++p) {
+        auto spectrum = &result[(size_t)p * cols];
+        for (int i = 0; i < half; ++i) {
+            auto x = std::min(i * (float)cols / n, (float)(cols / 2));
+            auto j = std::min((int)x, cols / 2);
+            auto k = std::min(j + 1, cols / 2);
+            auto t = x - j;
+            resampled[(size_t)p * half + i] = (1.0f - t) * spectrum[j] + t * spectrum[k];
+        }
+    }
+    return resampled;
 }
 
-std::vector<float> gaussian(int cols, float sigma)
+std::vector<float> gaussian(int n, float sigma)
 {
-    auto result = std::vector<float>(cols);
-    auto mid = (cols + 1) / 2;
+    auto result = std::vector<float>(n / 2 + 1);
+    auto nyquist = (float)(n / 2);
 
     auto filter_weight = [=](auto i) {
-        auto norm_freq = (i / (float)mid);
+        auto norm_freq = (i / nyquist);
         return std::exp(-(norm_freq * norm_freq) / (2.0f * sigma * sigma));
     };
 
-    for (int i = 1; i < mid; ++i) {
+    for (int i = 0; i <= n / 2; ++i) {
         result[i] = filter_weight(i);
     }
-    for (int j = mid; j < cols; ++j) {
-        result[j] = filter_weight(2 * mid - j);
-    }
     return result;
 }
 
 std::vector<float>
 paganin(int rows, int cols, float pixel_size, float lambda, float delta, float beta, float distance)
 {
-    auto filter = std::vector<float>(rows * cols);
+    auto freq_cols = cols / 2 + 1;
+    auto filter = std::vector<float>((size_t)rows * freq_cols);
 
-    auto dx = pixel_size / (2.0f * M_PI);
-    auto dy = dx;
-    auto mid_x = (cols + 1) / 2;
-    auto mid_y = (rows + 1) / 2;
+    // angular frequencies k = 2 pi f. The frequencies along the columns (the
+    // first dimension) wrap around to negative values halfway, the half
+    // spectrum only holds the non-negative frequencies along the rows
+    auto dk_x = 2.0 * M_PI / (cols * (double)pixel_size);
+    auto dk_y = 2.0 * M_PI / (rows * (double)pixel_size);
+    auto alpha = distance * lambda * delta / (4.0 * M_PI * beta);
 
     for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            // TODO Is this is FFTW convention compared to numpy?
-            auto x = i < mid_x ? i : (2 * mid_x - i);
-            auto y = j < mid_y ? j : (2 * mid_y - j);
-            auto k_x = x * dx;
-            auto k_y = y * dy;
-            auto k_squared = k_x * k_x + k_y * k_y;
-            filter[i * cols + j] =
-            (4.0f * beta * M_PI) / 1.0f + distance * lambda * delta * k_squared;
+        auto k_y = (i <= rows / 2 ? i : i - rows) * dk_y;
+        for (int j = 0; j < freq_cols; ++j) {
+            auto k_x = j * dk_x;
+            filter[(size_t)i * freq_cols + j] =
+            (float)(1.0 / (1.0 + alpha * (k_x * k_x + k_y * k_y)));
         }
     }
     return filter;
@@ -134,13 +166,161 @@ paganin(int rows, int cols, float pixel_size, float lambda, float delta, float b
 
 namespace detail {
 
-void Flatfielder::apply(Projection proj) const
+namespace {
+
+/** Call `f` with the pixels of `in` as a pointer of their native type. */
+template <typename F>
+void visit_pixels(raw_pixels in, F&& f)
 {
-    for (int i = 0; i < proj.rows * proj.cols; ++i) {
-        proj.data[i] = (proj.data[i] - dark.data[i]) * reciproc.data[i];
+    switch (in.type) {
+    case dtype::u8:
+        f((const uint8_t*)in.data);
+        break;
+    case dtype::u16:
+        f((const uint16_t*)in.data);
+        break;
+    case dtype::u32:
+        f((const uint32_t*)in.data);
+        break;
+    default:
+        f((const float*)in.data);
+        break;
     }
 }
 
+} // namespace
+
+unsigned planner_flags(const settings& parameters)
+{
+    switch (parameters.fftw_planner) {
+    case planner_effort::estimate:
+        return FFTW_ESTIMATE;
+    case planner_effort::patient:
+        return FFTW_PATIENT;
+    case planner_effort::exhaustive:
+        return FFTW_EXHAUSTIVE;
+    default:
+        return FFTW_MEASURE;
+    }
+}
+
+std::string wisdom_file(const settings& parameters, std::string kind, int n, int batch)
+{
+    if (parameters.wisdom_dir.empty()) {
+        return "";
+    }
+
+    auto dir = std::filesystem::path(parameters.wisdom_dir);
+    auto ec = std::error_code{};
+    std::filesystem::create_directories(dir, ec);
+    if (ec) {
+        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::warning
+                              << "Could not create FFTW wisdom directory ("
+                              << parameters.wisdom_dir << "): " << ec.message()
+                              << slicerecon::util::end_log;
+        return "";
+    }
+
+    // plans depend on the transform size, the batch size and the number of
+    // threads that are executing them concurrently
+    auto name = kind + "_" + std::to_string(n) + "_" + std::to_string(batch) +
+                "_" + std::to_string(parameters.filter_cores) + ".wisdom";
+    return (dir / name).string();
+}
+
+void Flatfielder::apply(raw_pixels in, Projection proj) const
+{
+    visit_pixels(in, [&](auto pixels) {
+        for (int i = 0; i < proj.rows * proj.cols; ++i) {
+            proj.data[i] = ((float)pixels[i] - dark.data[i]) * reciproc.data[i];
+        }
+    });
+}
+
+void Flatfielder::apply_neglog(raw_pixels in, Projection proj, const float* weights) const
+{
+    visit_pixels(in, [&](auto pixels) {
+        kernels::flatfield_neglog(pixels, proj.data, dark.data, reciproc.data,
+                                  weights, (size_t)proj.rows * proj.cols);
+    });
+}
+
+void convert(raw_pixels in, Projection proj)
+{
+    if (in.data == proj.data) {
+        return;
+    }
+    visit_pixels(in, [&](auto pixels) {
+        std::copy(pixels, pixels + (size_t)proj.rows * proj.cols, proj.data);
+    });
+}
+
+FlatfieldAccumulator::FlatfieldAccumulator(size_t pixels) : pixels_(pixels)
+{
+    reset_();
+}
+
+void FlatfieldAccumulator::reset_()
+{
+    dark_.assign(pixels_, 0.0f);
+    flat_.assign(pixels_, 0.0f);
+    reciproc_.assign(pixels_, 1.0f);
+    darks_ = 0;
+    flats_ = 0;
+}
+
+void FlatfieldAccumulator::add_dark(raw_pixels data, worker_pool& pool)
+{
+    add_(data, dark_, darks_, pool);
+}
+
+void FlatfieldAccumulator::add_flat(raw_pixels data, worker_pool& pool)
+{
+    add_(data, flat_, flats_, pool);
+}
+
+void FlatfieldAccumulator::add_(raw_pixels data, std::vector<float>& mean,
+                                int& count, worker_pool& pool)
+{
+    count += 1;
+    auto weight = 1.0f / count;
+    bool complete = darks_ > 0 && flats_ > 0;
+
+    // update the running mean, and while the chunk is in cache, the
+    // reciprocal that depends on it
+    constexpr size_t chunk = 1 << 14;
+    auto chunks = (int)((pixels_ + chunk - 1) / chunk);
+    pool.run(chunks, [&](int c, int) {
+        auto begin = c * chunk;
+        auto end = std::min(begin + chunk, pixels_);
+
+        auto m = mean.data();
+        visit_pixels(data, [&](auto pixels) {
+            for (auto i = begin; i < end; ++i) {
+                m[i] += ((float)pixels[i] - m[i]) * weight;
+            }
+        });
+
+        if (complete) {
+            auto dark = dark_.data();
+            auto flat = flat_.data();
+            auto reciproc = reciproc_.data();
+            for (auto i = begin; i < end; ++i) {
+                auto range = flat[i] - dark[i];
+                reciproc[i] = range == 0.0f ? 1.0f : 1.0f / range;
+            }
+        }
+    });
+}
+
+std::shared_ptr<FlatfieldSet> FlatfieldAccumulator::take()
+{
+    auto result = std::make_shared<FlatfieldSet>(
+    FlatfieldSet{std::move(dark_), std::move(reciproc_)});
+    reset_();
+    return result;
+}
+
 void Neglogger::apply(Projection proj) const
 {
     for (int i = 0; i < proj.rows * proj.cols; ++i) {
@@ -148,147 +328,539 @@ void Neglogger::apply(Projection proj) const
     }
 }
 
-void FDKScaler::apply(Projection proj, int proj_idx) const
+void Flatfielder::apply_neglog_row(raw_pixels in, Projection proj, int row,
+                                   const float* weights) const
 {
-    auto offset = proj_idx * proj.cols * proj.rows;
-    for (int i = 0; i < proj.rows * proj.cols; ++i) {
-        proj.data[i] *= weights[offset + i];
+    auto offset = (size_t)row * proj.cols;
+    visit_pixels(in, [&](auto pixels) {
+        kernels::flatfield_neglog(pixels + offset, proj.data + offset,
+                                  dark.data + offset, reciproc.data + offset,
+                                  weights, proj.cols);
+    });
+}
+
+FDKScaler::FDKScaler(int rows, int cols, std::vector<coefficients> projections)
+    : rows_(rows), cols_(cols), projections_(std::move(projections))
+{
+    if (projections_.empty()) {
+        return;
+    }
+
+    // for circular geometries, the projections are rotations of each other,
+    // and all the inner products (and therefore the weights) are the same.
+    // Each coefficient is compared relative to its largest contribution to
+    // the squared distance, so that the weights agree to about 1e-6
+    auto& first = projections_[0];
+    double c = cols_, r = rows_;
+    auto extent = std::array<double, 7>{1.0, 1.0, c, r, c * c, r * r, r * c};
+    bool shared = std::all_of(projections_.begin(), projections_.end(), [&](auto& p) {
+        if (std::abs(p[0] - first[0]) > 1.0e-6 * std::abs(first[0])) {
+            return false;
+        }
+        for (size_t i = 1; i < p.size(); ++i) {
+            if (std::abs(p[i] - first[i]) * extent[i] > 1.0e-6 * std::abs(first[1])) {
+                return false;
+            }
+        }
+        return true;
+    });
+
+    if (shared) {
+        plane_.resize((size_t)rows_ * cols_);
+        for (int r = 0; r < rows_; ++r) {
+            row_weights(0, r, &plane_[(size_t)r * cols_]);
+        }
     }
+
+    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                          << "FDK weights are "
+                          << (shared ? "shared by all projections"
+                                     : "computed per projection")
+                          << slicerecon::util::end_log;
 }
 
-Paganin::Paganin(settings parameters, acquisition::geometry geom, float* data)
+void FDKScaler::row_weights(int proj_idx, int row, float* out) const
 {
-    proj_freq_buffer_ = std::vector<std::vector<std::complex<float>>>(
-    parameters.filter_cores, std::vector<std::complex<float>>(geom.cols * geom.rows));
-    fft2d_plan_ =
-    fftwf_plan_dft_r2c_2d(geom.cols, geom.rows, data,
-                          reinterpret_cast<fftwf_complex*>(&proj_freq_buffer_[0][0]),
-                          FFTW_ESTIMATE);
-    ffti2d_plan_ =
-    fftwf_plan_dft_c2r_2d(geom.cols, geom.rows,
-                          reinterpret_cast<fftwf_complex*>(&proj_freq_buffer_[0][0]),
-                          data, FFTW_ESTIMATE);
-    paganin_filter_ =
-    util::filter::paganin(geom.rows, geom.cols, parameters.paganin.pixel_size,
-                          parameters.paganin.lambda, parameters.paganin.delta,
-                          parameters.paganin.beta, parameters.paganin.distance);
+    auto [rho, aa, at1, at2, t1t1, t2t2, t1t2] = projections_[proj_idx];
+
+    // |a + r t2 + c t1|^2 = (aa + r at2 + r^2 t2t2) + c (at1 + r t1t2) + c^2 t1t1,
+    // the terms that are constant along the row are computed in double
+    // precision, since the distance can be large compared to the variation
+    double r = row;
+    auto constant = (float)(aa + r * at2 + r * r * t2t2);
+    auto linear = (float)(at1 + r * t1t2);
+    kernels::fdk_row_weights(rho, constant, linear, t1t1, out, cols_);
+}
 
-    paganin_ = parameters.paganin;
+void FDKScaler::apply(Projection proj, int proj_idx, float* weights) const
+{
+    if (shared()) {
+        for (int i = 0; i < proj.rows * proj.cols; ++i) {
+            proj.data[i] *= plane_[i];
+        }
+        return;
+    }
+
+    for (int row = 0; row < proj.rows; ++row) {
+        row_weights(proj_idx, row, weights);
+        auto data = &proj.data[(size_t)row * proj.cols];
+        for (int c = 0; c < proj.cols; ++c) {
+            data[c] *= weights[c];
+        }
+    }
 }
 
-void Paganin::apply(Projection proj, int s)
+Paganin::Paganin(settings parameters, acquisition::geometry geom)
+    : rows_(geom.rows), cols_(geom.cols), ny_(padded_size_(geom.rows)),
+      nx_(padded_size_(geom.cols)), freq_cols_(nx_ / 2 + 1)
 {
-    // take fft of proj
-    fftwf_execute_dft_r2c(fft2d_plan_, proj.data,
-                          reinterpret_cast<fftwf_complex*>(&proj_freq_buffer_[s][0]));
+    // batching amortizes the overhead of the FFTs on small projections, but
+    // it should not leave workers idle, or blow up the scratch space. A batch
+    // (real and complex buffers) is at most 32 MB per worker, unless a single
+    // projection is larger
+    auto padded = (size_t)ny_ * nx_;
+    auto bytes = padded * sizeof(float) +
+                 (size_t)ny_ * freq_cols_ * sizeof(std::complex<float>);
+    auto budget = (int)std::max(((size_t)32 << 20) / bytes, (size_t)1);
+    auto per_worker = parameters.group_size / std::max(parameters.filter_cores, 1);
+    batch_ = std::clamp(std::min(budget, per_worker), 1, 8);
+
+    auto spectrum = (size_t)ny_ * freq_cols_;
+    for (int s = 0; s < parameters.filter_cores; ++s) {
+        real_buffer_.push_back(fftw_alloc<float>(batch_ * padded));
+        freq_buffer_.push_back(fftw_alloc<std::complex<float>>(batch_ * spectrum));
+    }
 
-    // filter the proj in 2D
-    for (int i = 0; i < proj.rows * proj.cols; ++i) {
-        proj_freq_buffer_[s][i] *= paganin_filter_[i];
+    auto wisdom =
+    wisdom_file(parameters, "paganin_" + std::to_string(ny_), nx_, batch_);
+    if (!wisdom.empty() && fftwf_import_wisdom_from_filename(wisdom.c_str())) {
+        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                              << "Loaded FFTW wisdom from " << wisdom
+                              << slicerecon::util::end_log;
     }
 
-    // ifft the proj
-    fftwf_execute_dft_c2r(ffti2d_plan_,
-                          reinterpret_cast<fftwf_complex*>(&proj_freq_buffer_[s][0]),
-                          proj.data);
+    auto dt = bulk::util::timer();
+    auto flags = planner_flags(parameters);
+    int n[] = {ny_, nx_};
+    auto real = real_buffer_[0].get();
+    auto freq = reinterpret_cast<fftwf_complex*>(freq_buffer_[0].get());
+    fft_plan_ = fftwf_plan_many_dft_r2c(2, n, batch_, real, nullptr, 1, padded,
+                                        freq, nullptr, 1, spectrum, flags);
+    ffti_plan_ = fftwf_plan_many_dft_c2r(2, n, batch_, freq, nullptr, 1,
+                                         spectrum, real, nullptr, 1, padded, flags);
+    fft_single_plan_ = fftwf_plan_many_dft_r2c(2, n, 1, real, nullptr, 1, padded,
+                                               freq, nullptr, 1, spectrum, flags);
+    ffti_single_plan_ = fftwf_plan_many_dft_c2r(2, n, 1, freq, nullptr, 1, spectrum,
+                                                real, nullptr, 1, padded, flags);
+
+    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                          << "Planned phase retrieval FFTs (" << batch_
+                          << " x " << ny_ << " x " << nx_ << ", padded from "
+                          << rows_ << " x " << cols_ << ") in " << dt.get()
+                          << " ms" << slicerecon::util::end_log;
+
+    if (!wisdom.empty() && !fftwf_export_wisdom_to_filename(wisdom.c_str())) {
+        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::warning
+                              << "Could not store FFTW wisdom in " << wisdom
+                              << slicerecon::util::end_log;
+    }
 
-    // log and scale
-    for (int i = 0; i < proj.rows * proj.cols; ++i) {
-        proj.data[i] = proj.data[i] <= 0.0f ? 0.0f : -std::log(proj.data[i]);
-        proj.data[i] *= paganin_.lambda / (4.0 * M_PI * paganin_.beta);
+    set_parameters(parameters.paganin);
+}
+
+Paganin::~Paganin()
+{
+    fftwf_destroy_plan(fft_plan_);
+    fftwf_destroy_plan(ffti_plan_);
+    fftwf_destroy_plan(fft_single_plan_);
+    fftwf_destroy_plan(ffti_single_plan_);
+}
+
+void Paganin::set_parameters(paganin_settings paganin)
+{
+    constexpr size_t max_cached = 4;
+
+    auto same = [&](const paganin_settings& other) {
+        return other.pixel_size == paganin.pixel_size &&
+               other.lambda == paganin.lambda && other.delta == paganin.delta &&
+               other.beta == paganin.beta && other.distance == paganin.distance;
+    };
+
+    std::lock_guard<std::mutex> guard(cache_mutex_);
+
+    auto entry = std::shared_ptr<filter_set>();
+    auto it = std::find_if(cache_.begin(), cache_.end(),
+                           [&](const auto& x) { return same(x->paganin); });
+    if (it != cache_.end()) {
+        entry = *it;
+        cache_.erase(it);
     }
+    else {
+        auto dt = bulk::util::timer();
+        entry = std::make_shared<filter_set>(filter_set{
+        paganin,
+        filter::paganin(ny_, nx_, paganin.pixel_size, paganin.lambda,
+                        paganin.delta, paganin.beta, paganin.distance),
+        (float)(paganin.lambda / (4.0 * M_PI * paganin.beta))});
+
+        // the inverse transform is unnormalized
+        auto normalization = 1.0f / ((float)ny_ * nx_);
+        for (auto& x : entry->filter) {
+            x *= normalization;
+        }
+
+        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                              << "Computed Paganin filter (delta = "
+                              << paganin.delta << ", beta = " << paganin.beta
+                              << ", distance = " << paganin.distance << ") in "
+                              << dt.get() << " ms" << slicerecon::util::end_log;
+    }
+
+    // most recently used first
+    cache_.insert(cache_.begin(), entry);
+    if (cache_.size() > max_cached) {
+        cache_.pop_back();
+    }
+    std::atomic_store(&filter_, entry);
 }
 
-Filterer::Filterer(settings parameters, acquisition::geometry geom, float* data)
+int Paganin::padded_size_(int size)
 {
-    freq_buffer_ = std::vector<std::vector<std::complex<float>>>(
-    parameters.filter_cores, std::vector<std::complex<float>>(geom.cols));
-    fft_plan_ =
-    fftwf_plan_dft_r2c_1d(geom.cols, data,
-                          reinterpret_cast<fftwf_complex*>(&freq_buffer_[0][0]),
-                          FFTW_ESTIMATE);
-    ffti_plan_ =
-    fftwf_plan_dft_c2r_1d(geom.cols,
-                          reinterpret_cast<fftwf_complex*>(&freq_buffer_[0][0]),
-                          data, FFTW_ESTIMATE);
+    // the (low pass) kernel of the filter decays quickly, so unlike for the
+    // ramp filter, a margin that keeps the opposite edges apart suffices,
+    // rather than twice the size
+    return filter::smooth_size(size + std::max(size / 8, 16));
+}
+
+void Paganin::pad_(const float* proj, float* padded) const
+{
+    // the padding is circular, like that of the filtered rows: the first
+    // half of the tail continues the end, the second half precedes the start.
+    // Repeating the edges (rather than padding with zeros) avoids a jump in
+    // the intensity, which would ring through the whole projection
+    auto half_cols = (nx_ - cols_) / 2;
+    for (int row = 0; row < rows_; ++row) {
+        auto in = &proj[(size_t)row * cols_];
+        auto out = &padded[(size_t)row * nx_];
+        std::copy(in, in + cols_, out);
+        std::fill(out + cols_, out + cols_ + half_cols, in[cols_ - 1]);
+        std::fill(out + cols_ + half_cols, out + nx_, in[0]);
+    }
+
+    auto half_rows = (ny_ - rows_) / 2;
+    auto last = &padded[(size_t)(rows_ - 1) * nx_];
+    for (int row = rows_; row < ny_; ++row) {
+        auto from = (row < rows_ + half_rows) ? last : padded;
+        std::copy(from, from + nx_, &padded[(size_t)row * nx_]);
+    }
+}
+
+void Paganin::apply(Projection proj, int count, int s)
+{
+    // the filter is kept alive for this batch, even if the parameters are
+    // changed concurrently
+    auto current = std::atomic_load(&filter_);
+
+    auto pixels = (size_t)rows_ * cols_;
+    auto padded = (size_t)ny_ * nx_;
+    auto spectrum = (size_t)ny_ * freq_cols_;
+    auto real = real_buffer_[s].get();
+    auto freq = freq_buffer_[s].get();
+    auto freq_ptr = reinterpret_cast<fftwf_complex*>(freq);
+
+    auto retrieve = [&](fftwf_plan fft, fftwf_plan ffti, int first, int n) {
+        for (int p = 0; p < n; ++p) {
+            pad_(&proj.data[(first + p) * pixels], &real[p * padded]);
+        }
+
+        fftwf_execute_dft_r2c(fft, real, freq_ptr);
+        for (int p = 0; p < n; ++p) {
+            auto spectrum_p = &freq[p * spectrum];
+            for (size_t i = 0; i < spectrum; ++i) {
+                spectrum_p[i] *= current->filter[i];
+            }
+        }
+        fftwf_execute_dft_c2r(ffti, freq_ptr, real);
+
+        // crop, take the log and scale to a thickness, in a single pass
+        for (int p = 0; p < n; ++p) {
+            for (int row = 0; row < rows_; ++row) {
+                kernels::neglog_scale(&real[p * padded + (size_t)row * nx_],
+                                      &proj.data[(first + p) * pixels +
+                                                 (size_t)row * cols_],
+                                      current->scale, cols_);
+            }
+        }
+    };
+
+    // a partial batch is transformed one by one, always from the start of
+    // the buffers (which is what the plans are aligned for)
+    if (count == batch_) {
+        retrieve(fft_plan_, ffti_plan_, 0, batch_);
+    }
+    else {
+        for (int p = 0; p < count; ++p) {
+            retrieve(fft_single_plan_, ffti_single_plan_, p, 1);
+        }
+    }
+}
+
+Filterer::Filterer(settings parameters, acquisition::geometry geom)
+    : rows_(geom.rows), cols_(geom.cols), n_(filter::padded_size(geom.cols)),
+      freq_cols_(n_ / 2 + 1), padding_(parameters.filter_padding)
+{
+    for (int s = 0; s < parameters.filter_cores; ++s) {
+        real_buffer_.push_back(fftw_alloc<float>((size_t)rows_ * n_));
+        freq_buffer_.push_back(
+        fftw_alloc<std::complex<float>>((size_t)rows_ * freq_cols_));
+    }
 
+    // all the (padded) rows of a projection are transformed in one batched
+    // call, on the buffers of the calling thread
+    auto wisdom = wisdom_file(parameters, "filter", n_, rows_);
+    if (!wisdom.empty() && fftwf_import_wisdom_from_filename(wisdom.c_str())) {
+        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                              << "Loaded FFTW wisdom from " << wisdom
+                              << slicerecon::util::end_log;
+    }
+
+    auto dt = bulk::util::timer();
+    auto flags = planner_flags(parameters);
+    auto freq = reinterpret_cast<fftwf_complex*>(freq_buffer_[0].get());
+    fft_plan_ = fftwf_plan_many_dft_r2c(1, &n_, rows_, real_buffer_[0].get(),
+                                        nullptr, 1, n_, freq, nullptr, 1,
+                                        freq_cols_, flags);
+    ffti_plan_ = fftwf_plan_many_dft_c2r(1, &n_, rows_, freq, nullptr, 1,
+                                         freq_cols_, real_buffer_[0].get(),
+                                         nullptr, 1, n_, flags);
+
+    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                          << "Planned filter FFTs (" << rows_ << " x " << n_
+                          << ", padded from " << cols_ << ") in " << dt.get()
+                          << " ms" << slicerecon::util::end_log;
+
+    if (!wisdom.empty() && !fftwf_export_wisdom_to_filename(wisdom.c_str())) {
+        slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::warning
+                              << "Could not store FFTW wisdom in " << wisdom
+                              << slicerecon::util::end_log;
+    }
+
+    auto filter = std::vector<float>();
     if (!parameters.filter.empty()){
         if (!parameters.filter.compare("shepp-logan")){
-            filter_ = util::filter::shepp_logan(geom.cols);
+            filter = util::filter::shepp_logan(n_);
         }else if(!parameters.filter.compare("ram-lak")){
-            filter_ = util::filter::ram_lak(geom.cols);
+            filter = util::filter::ram_lak(n_);
         }else{
-            filter_ = util::filter::from_file(parameters.filter, geom.cols, geom.proj_count);
+            filter = util::filter::from_file(parameters.filter, geom.cols, geom.proj_count, n_);
         }
     }else{
-        filter_ = util::filter::shepp_logan(geom.cols);
+        filter = util::filter::shepp_logan(n_);
     }
     if (parameters.gaussian_pass) {
-        auto filter_lowpass = util::filter::gaussian(geom.cols, 0.06f);
-        for (int i = 0; i < geom.cols; ++i) {
-            filter_[i] *= filter_lowpass[i];
+        auto filter_lowpass = util::filter::gaussian(n_, 0.06f);
+        for (size_t i = 0; i < filter.size(); ++i) {
+            filter[i] *= filter_lowpass[i % freq_cols_];
         }
     }
+    set_filter(std::move(filter));
+}
+
+Filterer::~Filterer()
+{
+    fftwf_destroy_plan(fft_plan_);
+    fftwf_destroy_plan(ffti_plan_);
+}
+
+void Filterer::set_filter(std::vector<float> filter)
+{
+    // the inverse transform is unnormalized, we scale such that the filtered
+    // projections are as large as they were before padding was introduced
+    auto scale = (float)cols_ / n_;
+    for (auto& x : filter) {
+        x *= scale;
+    }
+    filter_ = std::move(filter);
 }
 
-void Filterer::apply(Projection proj, int s, int proj_idx)
+void Filterer::pad_(const float* row, float* padded) const
 {
-    bool filter2d = filter_.size() > (size_t)proj.cols;
-    // filter the rows
+    std::copy(row, row + cols_, padded);
+
+    auto tail = padded + cols_;
+    auto tail_size = n_ - cols_;
+    if (padding_ == padding::zero || cols_ == 0) {
+        std::fill(tail, tail + tail_size, 0.0f);
+        return;
+    }
+
+    // the padding is circular: the first half of the tail continues the end
+    // of the row, the second half precedes its start
+    auto half = tail_size / 2;
+    std::fill(tail, tail + half, row[cols_ - 1]);
+    std::fill(tail + half, tail + tail_size, row[0]);
+}
+
+void Filterer::apply(Projection proj, int s, int proj_idx, float* out, size_t out_stride)
+{
+    auto real = real_buffer_[s].get();
     for (int row = 0; row < proj.rows; ++row) {
-        fftwf_execute_dft_r2c(fft_plan_, &proj.data[row * proj.cols],
-                              reinterpret_cast<fftwf_complex*>(&freq_buffer_[s][0]));
-        if (filter2d){
-            int offset = proj_idx*proj.cols;
-            for (int i = 0; i < proj.cols; ++i) {
-                freq_buffer_[s][i] *= filter_[offset + i];
-            }
-        }else{
-            for (int i = 0; i < proj.cols; ++i) {
-                freq_buffer_[s][i] *= filter_[i];
-            }
+        pad_(&proj.data[(size_t)row * cols_], &real[(size_t)row * n_]);
+    }
+
+    auto freq = freq_buffer_[s].get();
+    fftwf_execute_dft_r2c(fft_plan_, real, reinterpret_cast<fftwf_complex*>(freq));
+
+    // filter the rows, optionally with a different filter for each projection
+    bool filter2d = filter_.size() > (size_t)freq_cols_;
+    auto filter = filter2d ? &filter_[(size_t)proj_idx * freq_cols_] : filter_.data();
+    for (int row = 0; row < proj.rows; ++row) {
+        auto freq_row = &freq[(size_t)row * freq_cols_];
+        for (int i = 0; i < freq_cols_; ++i) {
+            freq_row[i] *= filter[i];
         }
+    }
+
+    fftwf_execute_dft_c2r(ffti_plan_, reinterpret_cast<fftwf_complex*>(freq), real);
 
-        fftwf_execute_dft_c2r(ffti_plan_,
-                              reinterpret_cast<fftwf_complex*>(&freq_buffer_[s][0]),
-                              &proj.data[row * proj.cols]);
+    for (int row = 0; row < proj.rows; ++row) {
+        kernels::stream_copy(&real[(size_t)row * n_], out + row * out_stride, cols_);
     }
 }
 
 } // namespace detail
 
-void ProjectionProcessor::process(float* data, int proj_id_begin, int proj_id_end)
+ProjectionProcessor::ProjectionProcessor(settings param, acquisition::geometry geom)
+    : param_(param), geom_(geom), pool_(param.filter_cores, param.pinned_cores),
+      accumulator_((size_t)geom.rows * geom.cols),
+      weight_rows_((size_t)pool_.size() * geom.cols)
+{
+    // until darks and flats come in, flat fielding does nothing
+    auto pixels = (size_t)geom_.rows * geom_.cols;
+    flatfield_ = std::make_shared<detail::FlatfieldSet>(detail::FlatfieldSet{
+    std::vector<float>(pixels, 0.0f), std::vector<float>(pixels, 1.0f)});
+}
+
+void ProjectionProcessor::swap_flatfield()
+{
+    slicerecon::util::log << LOG_FILE << slicerecon::util::lvl::info
+                          << "Using new flat field set (" << darks()
+                          << " darks, " << flats() << " flats)"
+                          << slicerecon::util::end_log;
+
+    std::atomic_store(&flatfield_, accumulator_.take());
+}
+
+void ProjectionProcessor::process(float* data, int proj_id_begin, int proj_id_end,
+                                  int geom_id_begin, sino_target target,
+                                  const raw_pixels* inputs,
+                                  const char* received)
 {
     auto proj_count = proj_id_end - proj_id_begin + 1;
     auto dt = bulk::util::timer();
-    env_.spawn(param_.filter_cores, [&](auto& world) {
-        auto s = world.rank();
-        auto p = world.active_processors();
-        auto pixels = geom_.rows * geom_.cols;
-
-        // we parallelize over projections, and apply the necessary
-        // transformations
-        for (auto proj_idx = s; proj_idx < proj_count; proj_idx += p) {
-            auto proj =
-            detail::Projection{&data[proj_idx * pixels], geom_.rows, geom_.cols};
+    auto pixels = geom_.rows * geom_.cols;
+
+    // the flat field set is kept alive for this group, even if a new one is
+    // swapped in concurrently
+    auto flatfield = std::atomic_load(&flatfield_);
+    auto flatfielder = flatfielding
+                       ? std::optional<detail::Flatfielder>(detail::Flatfielder{
+                         {flatfield->dark.data(), geom_.rows, geom_.cols},
+                         {flatfield->reciproc.data(), geom_.rows, geom_.cols}})
+                       : std::nullopt;
+
+    // phase retrieval transforms a batch of projections at once, all other
+    // stages work on a single projection
+    auto batch = paganin ? paganin->batch() : 1;
+    auto tasks = (proj_count + batch - 1) / batch;
+
+    // the batches are handed out to the (persistent) workers one by one,
+    // idle workers steal from busy ones to balance out uneven loads
+    pool_.run(tasks, [&](int task, int s) {
+        auto first = task * batch;
+        auto count = std::min(batch, proj_count - first);
+        auto projection = [&](int proj_idx) {
+            return detail::Projection{&data[(size_t)proj_idx * pixels],
+                                      geom_.rows, geom_.cols};
+        };
+        auto input = [&](int proj_idx) {
+            return (inputs && inputs[proj_idx].data)
+                   ? inputs[proj_idx]
+                   : raw_pixels{projection(proj_idx).data, dtype::f32};
+        };
+
+        // the first stage reads the raw projection from its input, later
+        // stages work in place
+        auto load = [&](int proj_idx) {
+            auto proj = projection(proj_idx);
             if (flatfielder) {
-                flatfielder->apply(proj);
+                flatfielder->apply(input(proj_idx), proj);
+            }
+            else {
+                detail::convert(input(proj_idx), proj);
             }
-            if (paganin) {
-                paganin->apply(proj, world.rank());
+        };
+
+        if (paganin) {
+            for (int i = first; i < first + count; ++i) {
+                if (!received || received[i]) {
+                    load(i);
+                }
             }
-            else if (neglog) {
-                neglog->apply(proj);
+            paganin->apply(projection(first), count, s);
+        }
+
+        for (int proj_idx = first; proj_idx < first + count; ++proj_idx) {
+            if (received && !received[proj_idx]) {
+                continue;
             }
+
+            auto proj = projection(proj_idx);
+            auto proj_id = proj_id_begin + proj_idx;
+            auto geom_id = (geom_id_begin + proj_idx) % geom_.proj_count;
+
+            // the FDK (cosine) weights are applied before the ramp filter
+            if (flatfielder && neglog && !paganin) {
+                // fused single pass over the projection
+                auto in = input(proj_idx);
+                if (!fdk_scale || fdk_scale->shared()) {
+                    flatfielder->apply_neglog(
+                    in, proj, fdk_scale ? fdk_scale->shared_plane() : nullptr);
+                }
+                else {
+                    // the weights of a row are computed right before they are used
+                    auto weights = weight_row_(s);
+                    for (int row = 0; row < proj.rows; ++row) {
+                        fdk_scale->row_weights(geom_id, row, weights);
+                        flatfielder->apply_neglog_row(in, proj, row, weights);
+                    }
+                }
+            }
+            else {
+                if (!paganin) {
+                    load(proj_idx);
+                }
+                if (neglog && !paganin) {
+                    neglog->apply(proj);
+                }
+                if (fdk_scale) {
+                    fdk_scale->apply(proj, geom_id, weight_row_(s));
+                }
+            }
+
+            // the last stage scatters the rows into the sinogram
+            auto [out, stride] = target.rows_of(proj_id);
             if (filterer) {
-                filterer->apply(proj, world.rank(), proj_id_begin + proj_idx);
+                filterer->apply(proj, s, geom_id, out, stride);
             }
-            if (fdk_scale) {
-                fdk_scale->apply(proj, proj_idx);
+            else {
+                for (int row = 0; row < proj.rows; ++row) {
+                    kernels::stream_copy(&proj.data[(size_t)row * proj.cols],
+                                         out + row * stride, proj.cols);
+                }
             }
         }
-
-        world.barrier();
+        kernels::stream_fence();
     });
     bench.insert("process", dt.get());
 }
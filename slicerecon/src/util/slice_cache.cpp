@@ -0,0 +1,98 @@
+#include <cmath>
+#include <functional>
+
+#include "slicerecon/util/slice_cache.hpp"
+
+namespace slicerecon::util {
+
+namespace {
+
+// orientations are given in volume coordinates (in `[-1, 1]`), this is far
+// below a voxel of any slice, but the same request always maps onto the same
+// key
+constexpr float orientation_quantum = 1.0e-5f;
+
+std::size_t bytes_of(const slice_data& slice) {
+    return slice.second.size() * sizeof(float);
+}
+
+} // namespace
+
+slice_key::slice_key(const slicerecon::orientation& x, int32_t slice_size,
+                     int32_t buffer_idx, uint64_t data_generation)
+    : size(slice_size), buffer(buffer_idx), generation(data_generation) {
+    for (auto i = 0u; i < x.size(); ++i) {
+        orientation[i] = (int32_t)std::lround(x[i] / orientation_quantum);
+    }
+}
+
+std::size_t slice_cache::key_hash::operator()(const slice_key& key) const {
+    auto result = std::hash<uint64_t>{}(key.generation);
+    auto combine = [&](std::size_t h) {
+        result ^= h + 0x9e3779b9 + (result << 6) + (result >> 2);
+    };
+    for (auto x : key.orientation) {
+        combine(std::hash<int32_t>{}(x));
+    }
+    combine(std::hash<int32_t>{}(key.size));
+    combine(std::hash<int32_t>{}(key.buffer));
+    return result;
+}
+
+slice_cache::slice_cache(std::size_t capacity) : capacity_(capacity) {}
+
+std::optional<slice_data> slice_cache::find(const slice_key& key) {
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        ++stats_.misses;
+        return std::nullopt;
+    }
+
+    ++stats_.hits;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->second;
+}
+
+void slice_cache::insert(const slice_key& key, const slice_data& slice) {
+    auto bytes = bytes_of(slice);
+    if (bytes > capacity_) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    // (the slice may have been reconstructed twice at the same time)
+    if (index_.find(key) != index_.end()) {
+        return;
+    }
+
+    while (!entries_.empty() && stats_.bytes + bytes > capacity_) {
+        auto& oldest = entries_.back();
+        stats_.bytes -= bytes_of(oldest.second);
+        index_.erase(oldest.first);
+        entries_.pop_back();
+        ++stats_.evictions;
+    }
+
+    entries_.emplace_front(key, slice);
+    index_.emplace(key, entries_.begin());
+    stats_.bytes += bytes;
+    stats_.entries = (int64_t)entries_.size();
+}
+
+void slice_cache::clear() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    index_.clear();
+    entries_.clear();
+    stats_.bytes = 0;
+    stats_.entries = 0;
+}
+
+slice_cache_stats slice_cache::stats() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return stats_;
+}
+
+} // namespace slicerecon::util
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "slicerecon/util/futex.hpp"
+#include "slicerecon/util/log.hpp"
+#include "slicerecon/util/worker_pool.hpp"
+
+namespace slicerecon::util {
+
+namespace {
+
+// roughly tens of microseconds of spinning before an idle thread sleeps,
+// which covers the gap between consecutive groups of a fast stream
+constexpr int max_spin_iterations = 1 << 14;
+
+constexpr uint64_t pack(uint32_t begin, uint32_t end) {
+    return ((uint64_t)begin << 32) | end;
+}
+
+constexpr uint32_t begin_of(uint64_t range) { return range >> 32; }
+constexpr uint32_t end_of(uint64_t range) { return (uint32_t)range; }
+
+} // namespace
+
+worker_pool::worker_pool(int workers, std::vector<int32_t> cores)
+    : workers_(std::max(workers, 1)),
+      queues_(std::make_unique<queue[]>(workers_)) {
+    // spinning only pays off if every worker has a hardware thread of its own,
+    // otherwise it takes time away from the workers that do have work
+    auto hardware = (int)std::thread::hardware_concurrency();
+    spin_iterations_ = (hardware == 0 || workers_ <= hardware) ? max_spin_iterations : 0;
+
+    for (int w = 1; w < workers_; ++w) {
+        threads_.emplace_back([this, w, cores] { loop_(w, cores); });
+    }
+}
+
+worker_pool::~worker_pool() {
+    stop_.store(true);
+    generation_.fetch_add(1);
+    futex_wake(generation_);
+
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void worker_pool::run_(int tasks, task_fn fn, void* ctx) {
+    if (tasks <= 0) {
+        return;
+    }
+
+    // nothing to distribute, avoid waking up the workers at all
+    if (workers_ == 1 || tasks == 1) {
+        for (int task = 0; task < tasks; ++task) {
+            fn(ctx, task, 0);
+        }
+        return;
+    }
+
+    fn_ = fn;
+    ctx_ = ctx;
+    error_ = nullptr;
+    for (int w = 0; w < workers_; ++w) {
+        auto begin = (uint32_t)((int64_t)tasks * w / workers_);
+        auto end = (uint32_t)((int64_t)tasks * (w + 1) / workers_);
+        queues_[w].range.store(pack(begin, end), std::memory_order_relaxed);
+    }
+    finished_.store(0, std::memory_order_relaxed);
+
+    // publish the batch, sleeping workers need an explicit wake up
+    generation_.fetch_add(1);
+    if (sleepers_.load() > 0) {
+        futex_wake(generation_);
+    }
+
+    work_(0);
+
+    // wait for the other workers, which may still be executing stolen tasks
+    auto others = (uint32_t)(workers_ - 1);
+    for (int i = 0; finished_.load(std::memory_order_acquire) != others; ++i) {
+        if (i < spin_iterations_) {
+            cpu_relax();
+            continue;
+        }
+        waiting_.store(true);
+        auto done = finished_.load();
+        if (done != others) {
+            futex_wait(finished_, done);
+        }
+        waiting_.store(false);
+    }
+
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+void worker_pool::loop_(int worker, std::vector<int32_t> cores) {
+#ifdef __linux__
+    if (!cores.empty()) {
+        auto core = cores[(worker - 1) % cores.size()];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            util::log << LOG_FILE << util::lvl::warning
+                      << "Could not pin worker " << worker << " to core "
+                      << core << util::end_log;
+        }
+    }
+#else
+    (void)cores;
+#endif
+
+    auto seen = 0u;
+    while (true) {
+        // spin for a while before going to sleep
+        auto current = generation_.load(std::memory_order_acquire);
+        for (int i = 0; current == seen && i < spin_iterations_; ++i) {
+            cpu_relax();
+            current = generation_.load(std::memory_order_acquire);
+        }
+        while (current == seen) {
+            sleepers_.fetch_add(1);
+            futex_wait(generation_, seen);
+            sleepers_.fetch_sub(1);
+            current = generation_.load(std::memory_order_acquire);
+        }
+        seen = current;
+
+        if (stop_.load()) {
+            return;
+        }
+
+        work_(worker);
+
+        auto done = finished_.fetch_add(1) + 1;
+        if (done == (uint32_t)(workers_ - 1) && waiting_.load()) {
+            futex_wake(finished_);
+        }
+    }
+}
+
+void worker_pool::work_(int worker) {
+    auto& own = queues_[worker].range;
+
+    while (true) {
+        // take tasks from the front of our own range
+        auto range = own.load(std::memory_order_acquire);
+        while (begin_of(range) < end_of(range)) {
+            auto task = begin_of(range);
+            if (own.compare_exchange_weak(range, pack(task + 1, end_of(range)),
+                                          std::memory_order_acq_rel)) {
+                execute_(task, worker);
+                range = own.load(std::memory_order_acquire);
+            }
+        }
+
+        // steal the back half of the range of another worker. Our own range
+        // is empty, so no one will modify it until we store the stolen range
+        auto stolen = false;
+        for (int k = 1; k < workers_ && !stolen; ++k) {
+            auto& victim = queues_[(worker + k) % workers_].range;
+            auto theirs = victim.load(std::memory_order_acquire);
+            while (begin_of(theirs) < end_of(theirs)) {
+                auto begin = begin_of(theirs);
+                auto end = end_of(theirs);
+                auto mid = begin + (end - begin) / 2;
+                if (victim.compare_exchange_weak(theirs, pack(begin, mid),
+                                                 std::memory_order_acq_rel)) {
+                    own.store(pack(mid, end), std::memory_order_release);
+                    steals_.fetch_add(1, std::memory_order_relaxed);
+                    stolen = true;
+                    break;
+                }
+            }
+        }
+
+        if (!stolen) {
+            return;
+        }
+    }
+}
+
+void worker_pool::execute_(int task, int worker) {
+    try {
+        fn_(ctx_, task, worker);
+    } catch (...) {
+        std::lock_guard<std::mutex> guard(error_mutex_);
+        if (!error_) {
+            error_ = std::current_exception();
+        }
+    }
+}
+
+} // namespace slicerecon::util
@@ -0,0 +1,202 @@
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include "slicerecon/reconstruction/reconstructor.hpp"
+#include "slicerecon/util/processing.hpp"
+
+/**
+ * Checks of the reconstruction pipeline that do not need a GPU: projections
+ * that were not received (lost, dropped or decimated) leave the data of
+ * their angles as it was, and batches with invalid indices are rejected.
+ */
+
+using namespace slicerecon;
+
+namespace {
+
+void require(bool condition, const char* what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << "\n";
+        std::exit(1);
+    }
+}
+
+constexpr int rows = 3;
+constexpr int cols = 4;
+constexpr int proj_count = 8;
+
+acquisition::geometry test_geometry() {
+    auto geom = acquisition::geometry{};
+    geom.rows = rows;
+    geom.cols = cols;
+    geom.proj_count = proj_count;
+    geom.parallel = true;
+    geom.angles = std::vector<float>(proj_count, 0.0f);
+    return geom;
+}
+
+settings test_settings() {
+    auto params = settings{4, 4, 4, 2, 0, 0, mode::alternating, false,
+                           false, false, {}, false, "shepp-logan"};
+    params.backend = solver_backend::cpu;
+    return params;
+}
+
+/** A solver that only stores what is uploaded, as `[projections][rows][cols]`. */
+class recording_solver : public detail::solver {
+  public:
+    recording_solver(settings parameters, acquisition::geometry geometry)
+        : solver(parameters, geometry),
+          stored((size_t)proj_count * rows * cols, -1.0f) {}
+
+    slice_data reconstruct_slice(orientation, int) override { return {}; }
+    void reconstruct_preview(std::vector<float>&, int) override {}
+
+    void upload(int, float* data, int proj_id_begin,
+                int proj_id_end) override {
+        auto count = proj_id_end - proj_id_begin + 1;
+        for (int i = 0; i < count; ++i) {
+            for (int r = 0; r < rows; ++r) {
+                for (int c = 0; c < cols; ++c) {
+                    stored[((size_t)(proj_id_begin + i) * rows + r) * cols +
+                           c] = data[((size_t)r * count + i) * cols + c];
+                }
+            }
+        }
+        ++uploads;
+    }
+
+    float at(int proj, int row, int col) const {
+        return stored[((size_t)proj * rows + row) * cols + col];
+    }
+
+    std::vector<float> stored;
+    int uploads = 0;
+};
+
+// the value of a pixel of a (processed) projection of the test
+float pixel(int proj, int row, int col) {
+    return 100.0f * proj + 10.0f * row + col;
+}
+
+/**
+ * A group of projections 2 to 7 of which every other one was decimated,
+ * except the last: the decimated angles keep their previous data.
+ */
+void test_decimated_upload() {
+    auto solver = recording_solver(test_settings(), test_geometry());
+
+    auto first = 2;
+    auto count = 6;
+    auto sino = std::vector<float>((size_t)rows * count * cols);
+    for (int r = 0; r < rows; ++r) {
+        for (int i = 0; i < count; ++i) {
+            for (int c = 0; c < cols; ++c) {
+                sino[((size_t)r * count + i) * cols + c] =
+                    pixel(first + i, r, c);
+            }
+        }
+    }
+    auto received = std::vector<char>{1, 0, 1, 0, 1, 1};
+
+    auto scratch = std::vector<float>();
+    detail::upload_received(solver, 0, sino.data(), rows, cols, first,
+                            first + count - 1, received.data(), scratch);
+
+    require(solver.uploads == 3, "a run of received projections per upload");
+    for (int p = 0; p < proj_count; ++p) {
+        auto uploaded =
+            p >= first && p < first + count && received[p - first] != 0;
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                require(solver.at(p, r, c) ==
+                            (uploaded ? pixel(p, r, c) : -1.0f),
+                        uploaded ? "received angles are uploaded"
+                                 : "other angles are left unchanged");
+            }
+        }
+    }
+
+    // a complete group is uploaded at once
+    solver.uploads = 0;
+    detail::upload_received(solver, 0, sino.data(), rows, cols, first,
+                            first + count - 1, nullptr, scratch);
+    require(solver.uploads == 1, "complete group in a single upload");
+    require(solver.at(first + 1, 0, 0) == pixel(first + 1, 0, 0),
+            "complete group is uploaded");
+}
+
+/** Decimated projections are not processed into the sinogram. */
+void test_decimated_processing() {
+    auto geom = test_geometry();
+    auto processor = util::ProjectionProcessor(test_settings(), geom);
+
+    auto count = 4;
+    auto pixels = (size_t)rows * cols;
+    auto projections = std::vector<float>(count * pixels);
+    for (int i = 0; i < count; ++i) {
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                projections[i * pixels + r * cols + c] = pixel(i, r, c);
+            }
+        }
+    }
+    auto inputs = std::vector<raw_pixels>(count);
+    auto received = std::vector<char>{1, 0, 1, 1};
+    for (int i = 0; i < count; ++i) {
+        if (received[i]) {
+            inputs[i] = {&projections[i * pixels], dtype::f32};
+        }
+    }
+
+    auto scratch = std::vector<float>(count * pixels, 0.0f);
+    auto sino = std::vector<float>(count * pixels, -1.0f);
+    auto target = util::sino_target{sino.data(), rows, cols, count};
+    processor.process(scratch.data(), 0, count - 1, 0, target, inputs.data(),
+                      received.data());
+
+    for (int i = 0; i < count; ++i) {
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                auto value = sino[((size_t)r * count + i) * cols + c];
+                require(value == (received[i] ? pixel(i, r, c) : -1.0f),
+                        received[i] ? "received projection is processed"
+                                    : "decimated projection is skipped");
+            }
+        }
+    }
+}
+
+/** Batches whose indices are negative, or not increasing, are rejected. */
+void test_malformed_batch() {
+    auto recon = reconstructor(test_settings());
+    recon.initialize(test_geometry());
+
+    auto pixels = std::vector<float>(2 * rows * cols, 1.0f);
+    auto push = [&](int32_t first, int32_t stride, int32_t count) {
+        return recon.push_projections(proj_kind::standard, first, stride,
+                                      count, {rows, cols},
+                                      {pixels.data(), dtype::f32}, nullptr);
+    };
+
+    require(push(0, 1, 2), "valid batch is accepted");
+    require(push(4, 0, 1), "stride of a single projection is ignored");
+    require(!push(-2, 1, 2), "negative first index is rejected");
+    require(!push(0, 0, 2), "zero stride is rejected");
+    require(!push(2, -1, 2), "negative stride is rejected");
+    require(!push(std::numeric_limits<int32_t>::max(), 1, 2),
+            "overflowing last index is rejected");
+    require(!push(0, 1, 0), "empty batch is rejected");
+}
+
+} // namespace
+
+int main() {
+    test_decimated_upload();
+    test_decimated_processing();
+    test_malformed_batch();
+    std::cout << "All pipeline tests passed\n";
+    return 0;
+}
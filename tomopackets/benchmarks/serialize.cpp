@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tomop/tomop.hpp"
+
+using namespace tomop;
+
+namespace {
+
+/**
+ * The element by element sizing and copying that the serialization used
+ * before vectors were copied in bulk, as a reference.
+ */
+struct elementwise_scale {
+    std::size_t size = 0;
+
+    template <typename T>
+    void operator|(T&) {
+        size += sizeof(T);
+    }
+
+    void operator|(std::string& str) { size += str.size() + 1; }
+
+    template <typename T>
+    void operator|(std::vector<T>& xs) {
+        size += sizeof(int);
+        for (auto x : xs) {
+            (*this) | x;
+        }
+    }
+};
+
+struct elementwise_span {
+    char* data = nullptr;
+    std::size_t index = 0;
+
+    template <typename T>
+    void operator<<(const T& value) {
+        memcpy(data + index, &value, sizeof(T));
+        index += sizeof(T);
+    }
+
+    template <typename T>
+    void operator>>(T& value) {
+        memcpy(&value, data + index, sizeof(T));
+        index += sizeof(T);
+    }
+
+    void operator<<(std::string& str) {
+        for (auto c : str) {
+            (*this) << c;
+        }
+        (*this) << '\0';
+    }
+
+    void operator>>(std::string& str) {
+        str = std::string(data + index);
+        index += str.size() + 1;
+    }
+
+    template <typename T>
+    void operator<<(std::vector<T>& xs) {
+        (*this) << (int)xs.size();
+        for (auto& x : xs) {
+            (*this) << x;
+        }
+    }
+
+    template <typename T>
+    void operator>>(std::vector<T>& xs) {
+        int size = 0;
+        (*this) >> size;
+        xs.resize(size);
+        for (auto& x : xs) {
+            (*this) >> x;
+        }
+    }
+};
+
+template <typename F>
+double best_ms(int repeats, F f) {
+    auto result = 0.0;
+    for (int r = 0; r < repeats; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto ms = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+        result = (r == 0) ? ms : std::min(result, ms);
+    }
+    return result;
+}
+
+template <typename P>
+void run(std::string name, P packet, int repeats) {
+    auto bytes = (double)packet.size();
+    auto buffer = std::vector<char>((std::size_t)bytes);
+    auto copy = P{};
+
+    auto report = [&](std::string method, std::string step, double ms) {
+        std::cout << name << ", " << method << ", " << step << ": " << ms
+                  << " ms, " << bytes / (ms * 1.0e3) << " MB/s\n";
+    };
+
+    // reference
+    auto size = std::size_t{0};
+    report("elementwise", "size", best_ms(repeats, [&] {
+               elementwise_scale total;
+               total | P::desc;
+               fill(packet, total);
+               size = total.size;
+           }));
+    report("elementwise", "serialize", best_ms(repeats, [&] {
+               elementwise_span span{buffer.data()};
+               auto im = Packet::imembuf<elementwise_span>(span);
+               im | P::desc;
+               fill(packet, im);
+           }));
+    report("elementwise", "deserialize", best_ms(repeats, [&] {
+               elementwise_span span{buffer.data()};
+               auto om = Packet::omembuf<elementwise_span>(span);
+               packet_desc dummy;
+               om | dummy;
+               fill(copy, om);
+           }));
+
+    report("bulk", "size", best_ms(repeats, [&] { size = packet.size(); }));
+    report("bulk", "serialize", best_ms(repeats, [&] {
+               memory_span span(buffer.size(), buffer.data());
+               auto im = Packet::imembuf<memory_span>(span);
+               im | P::desc;
+               fill(packet, im);
+           }));
+    report("bulk", "deserialize", best_ms(repeats, [&] {
+               memory_span span(buffer.size(), buffer.data());
+               auto om = Packet::omembuf<memory_span>(span);
+               packet_desc dummy;
+               om | dummy;
+               fill(copy, om);
+           }));
+
+    if (size != buffer.size()) {
+        std::cout << name << ": size mismatch\n";
+    }
+}
+
+/**
+ * Sends a typed projection of 16-bit pixels compressed, and checks that it
+ * arrives intact with its pixels shuffled as 16-bit elements. Reports the
+ * compression ratio, against that of shuffling single bytes. Returns false
+ * if the check fails.
+ */
+bool check_compression(int size) {
+    auto pixels = std::vector<uint16_t>((std::size_t)size * size);
+    auto noise = 12345u;
+    for (int i = 0; i < size; ++i) {
+        for (int j = 0; j < size; ++j) {
+            // a smooth detector image, with a few bits of noise
+            noise = noise * 1103515245u + 12345u;
+            pixels[(std::size_t)i * size + j] =
+                (uint16_t)(20000 + 10 * ((i + j) % 1000) + (noise >> 28));
+        }
+    }
+    auto bytes = pixels.size() * sizeof(uint16_t);
+    auto data = std::vector<uint8_t>(bytes);
+    memcpy(data.data(), pixels.data(), bytes);
+    auto packet = TypedProjectionPacket(2, 0, {size, size}, (int32_t)dtype::u16,
+                                        std::move(data));
+
+    auto context = zmq::context_t(1);
+    auto sender = zmq::socket_t(context, ZMQ_PAIR);
+    auto receiver = zmq::socket_t(context, ZMQ_PAIR);
+    sender.bind("inproc://compression");
+    receiver.connect("inproc://compression");
+
+    // the frames as they are sent
+    packet.send(sender, framing::multipart, nullptr, codec::shuffle_lz);
+    auto header = zmq::message_t();
+    auto frame = zmq::message_t();
+    receiver.recv(&header);
+    receiver.recv(&frame);
+    auto info = detail::compressed_frame_header{};
+    memcpy(&info, frame.data(), sizeof(info));
+    auto bytewise = compress_array((const char*)packet.data.data(),
+                                   bytes, 1);
+
+    // and as they are received
+    packet.send(sender, framing::multipart, nullptr, codec::shuffle_lz);
+    auto message = multipart_message();
+    message.recv(receiver);
+    auto copy = TypedProjectionPacket();
+    copy.deserialize(message);
+
+    std::cout << "typed projection (u16), compression ratio "
+              << (double)bytes / frame.size() << " (shuffled by byte "
+              << (double)bytes / bytewise.size() << ")\n";
+    if (info.element_size != sizeof(uint16_t) || copy.data != packet.data) {
+        std::cout << "typed projection (u16): compression round trip failed\n";
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+/**
+ * Measures the throughput of sizing, serializing and deserializing the
+ * packets with large arrays, with the bulk copies of the serialization and
+ * with the element by element copies they replaced. The compression of a
+ * projection of 16-bit pixels is checked as well.
+ *
+ * Usage: bench_serialize [preview size] [slice size] [repeats]
+ */
+int main(int argc, char** argv) {
+    auto preview = argc > 1 ? std::stoi(argv[1]) : 256;
+    auto slice = argc > 2 ? std::stoi(argv[2]) : 1024;
+    auto repeats = argc > 3 ? std::stoi(argv[3]) : 5;
+
+    auto values = [](std::size_t n) {
+        auto xs = std::vector<float>(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            xs[i] = (float)(i % 1021);
+        }
+        return xs;
+    };
+
+    run("volume data", VolumeDataPacket(0, {preview, preview, preview},
+                                        values((std::size_t)preview * preview *
+                                               preview)),
+        repeats);
+    run("slice data",
+        SliceDataPacket(0, 0, {slice, slice},
+                        values((std::size_t)slice * slice), false),
+        repeats);
+    run("projection",
+        ProjectionPacket(0, 0, {slice, slice},
+                         values((std::size_t)slice * slice)),
+        repeats);
+    run("projection data",
+        ProjectionDataPacket(0, 0, {0.0f, 0.0f, 0.0f}, {}, {slice, slice},
+                             values((std::size_t)slice * slice)),
+        repeats);
+    run("parallel beam geometry",
+        ParallelBeamGeometryPacket(0, slice, slice, 4 * slice,
+                                   values(4 * (std::size_t)slice)),
+        repeats);
+
+    return check_compression(slice) ? 0 : -1;
+}
@@ -0,0 +1,496 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <zmq.hpp>
+
+namespace tomop {
+
+/**
+ * How the array frames of a packet sent with multipart framing are
+ * compressed. The codec is recorded in the header frame.
+ */
+enum class codec : int32_t {
+    none = 0,
+    // the bytes of the elements are grouped by significance (byte-shuffle),
+    // and every chunk is compressed with a small LZ77 codec
+    shuffle_lz = 1,
+};
+
+namespace detail {
+
+// the chunks of an array are compressed independently (and concurrently),
+// a multiple of every element size
+constexpr std::size_t compression_chunk = std::size_t{1} << 18;
+
+// marks a chunk that is stored as is, because it did not compress
+constexpr uint32_t stored_chunk = 0x80000000u;
+
+struct compressed_frame_header {
+    uint64_t bytes;
+    uint32_t element_size;
+    uint32_t chunk_bytes;
+    uint32_t chunks;
+    uint32_t reserved;
+};
+
+// an upper bound on the compression ratio of a frame, which bounds the
+// memory a malformed frame can claim. The codec itself approaches 255:1 at
+// most (a match length byte of 255 for every 255 repeated bytes), this
+// leaves a wide margin
+constexpr std::size_t max_compression_ratio = 1024;
+
+// frames of fewer chunks are (de)compressed on the calling thread
+constexpr std::size_t parallel_min_chunks = 4;
+
+/**
+ * A few long-lived threads that (de)compress the chunks of a frame together
+ * with the calling thread, so that frames do not spawn threads. A frame
+ * that arrives while the pool is busy with another one is handled on its
+ * own calling thread instead of waiting.
+ */
+class chunk_pool {
+  public:
+    explicit chunk_pool(std::size_t workers) {
+        for (std::size_t t = 1; t < workers; ++t) {
+            threads_.emplace_back([this] { loop_(); });
+        }
+    }
+
+    ~chunk_pool() {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        start_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    chunk_pool(const chunk_pool&) = delete;
+    chunk_pool& operator=(const chunk_pool&) = delete;
+
+    /**
+     * Call `f(i)` for `i` in `[0, count)`, and wait for all of them. Returns
+     * false, without calling `f`, if the pool is in use.
+     */
+    template <typename F>
+    bool try_run(std::size_t count, F& f) {
+        std::unique_lock<std::mutex> busy(run_mutex_, std::try_to_lock);
+        if (!busy.owns_lock()) {
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            fn_ = [](void* ctx, std::size_t i) { (*static_cast<F*>(ctx))(i); };
+            ctx_ = &f;
+            count_ = count;
+            next_ = 0;
+            error_ = nullptr;
+            pending_ = threads_.size();
+            ++generation_;
+        }
+        start_.notify_all();
+
+        work_();
+
+        std::unique_lock<std::mutex> guard(mutex_);
+        done_.wait(guard, [this] { return pending_ == 0; });
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        return true;
+    }
+
+  private:
+    void loop_() {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> guard(mutex_);
+                start_.wait(guard,
+                            [&] { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+            }
+
+            work_();
+
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (--pending_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+    void work_() {
+        try {
+            for (auto i = next_++; i < count_; i = next_++) {
+                fn_(ctx_, i);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(error_mutex_);
+            error_ = std::current_exception();
+            // the other threads run out of chunks
+            next_ = count_;
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::mutex run_mutex_;
+
+    // the current frame
+    void (*fn_)(void*, std::size_t) = nullptr;
+    void* ctx_ = nullptr;
+    std::size_t count_ = 0;
+    std::atomic<std::size_t> next_ = {0};
+    std::exception_ptr error_;
+    std::mutex error_mutex_;
+
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    uint64_t generation_ = 0;
+    std::size_t pending_ = 0;
+    bool stop_ = false;
+};
+
+/** The pool of the codec, started when it is first used. */
+inline chunk_pool& codec_pool() {
+    static chunk_pool pool(std::min<std::size_t>(
+        std::max(std::thread::hardware_concurrency(), 1u), 8));
+    return pool;
+}
+
+/** Run `f(i)` for `i` in `[0, count)`, on the codec pool for large frames. */
+template <typename F>
+void parallel_chunks(std::size_t count, F&& f) {
+    if (count < parallel_min_chunks || !codec_pool().try_run(count, f)) {
+        for (std::size_t i = 0; i < count; ++i) {
+            f(i);
+        }
+    }
+}
+
+/** Group byte `b` of every element of `count` elements. */
+inline void shuffle(const char* in, char* out, std::size_t count,
+                    std::size_t element_size) {
+    for (std::size_t b = 0; b < element_size; ++b) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[b * count + i] = in[i * element_size + b];
+        }
+    }
+}
+
+inline void unshuffle(const char* in, char* out, std::size_t count,
+                      std::size_t element_size) {
+    for (std::size_t b = 0; b < element_size; ++b) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i * element_size + b] = in[b * count + i];
+        }
+    }
+}
+
+// LZ77 in the spirit of LZ4: a sequence is a token with the number of
+// literals (high nibble) and the match length minus 4 (low nibble), longer
+// lengths continue in extra bytes of 255, followed by the literals, and a
+// 16-bit offset of the match. The last sequence only has literals.
+
+inline void lz_put_length(uint8_t*& out, std::size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8_t)length;
+}
+
+/**
+ * Compress `n` bytes into `out`, which has room for `capacity` bytes.
+ * Returns the compressed size, or 0 if it does not fit.
+ */
+inline std::size_t lz_compress(const uint8_t* in, std::size_t n, uint8_t* out,
+                               std::size_t capacity) {
+    constexpr int hash_bits = 13;
+    constexpr std::size_t min_match = 4;
+    // the last bytes are always literals, so matches can be read in words
+    constexpr std::size_t margin = 12;
+
+    auto read32 = [](const uint8_t* p) {
+        uint32_t x;
+        memcpy(&x, p, sizeof(x));
+        return x;
+    };
+    auto hash = [](uint32_t x) {
+        return (x * 2654435761u) >> (32 - hash_bits);
+    };
+
+    std::vector<uint32_t> table(std::size_t{1} << hash_bits, 0);
+    auto start = out;
+    auto end = out + capacity;
+    std::size_t anchor = 0;
+    std::size_t i = 0;
+
+    auto emit = [&](std::size_t literals, std::size_t match,
+                    std::size_t offset) {
+        // the worst case size of this sequence
+        if ((std::size_t)(end - out) <
+            1 + literals + literals / 255 + 3 + match / 255 + 1) {
+            return false;
+        }
+        auto token = out++;
+        *token = (uint8_t)(std::min<std::size_t>(literals, 15) << 4);
+        if (literals >= 15) {
+            lz_put_length(out, literals - 15);
+        }
+        memcpy(out, in + anchor, literals);
+        out += literals;
+        if (match > 0) {
+            *out++ = (uint8_t)(offset & 0xff);
+            *out++ = (uint8_t)(offset >> 8);
+            auto m = match - min_match;
+            *token |= (uint8_t)std::min<std::size_t>(m, 15);
+            if (m >= 15) {
+                lz_put_length(out, m - 15);
+            }
+        }
+        return true;
+    };
+
+    if (n > margin) {
+        while (i + margin < n) {
+            auto x = read32(in + i);
+            auto& slot = table[hash(x)];
+            auto candidate = (std::size_t)slot;
+            slot = (uint32_t)i;
+
+            if (candidate >= i || i - candidate > 0xffff ||
+                read32(in + candidate) != x) {
+                ++i;
+                continue;
+            }
+
+            auto length = min_match;
+            while (i + length + margin < n &&
+                   in[candidate + length] == in[i + length]) {
+                ++length;
+            }
+            if (!emit(i - anchor, length, i - candidate)) {
+                return 0;
+            }
+            i += length;
+            anchor = i;
+        }
+    }
+
+    if (!emit(n - anchor, 0, 0)) {
+        return 0;
+    }
+    return (std::size_t)(out - start);
+}
+
+/**
+ * Decompress `n` bytes into exactly `size` bytes at `out`. Returns false if
+ * the input is malformed.
+ */
+inline bool lz_decompress(const uint8_t* in, std::size_t n, uint8_t* out,
+                          std::size_t size) {
+    auto in_end = in + n;
+    std::size_t o = 0;
+
+    auto get_length = [&](std::size_t& length) {
+        uint8_t b = 255;
+        while (b == 255) {
+            if (in == in_end) {
+                return false;
+            }
+            b = *in++;
+            length += b;
+        }
+        return true;
+    };
+
+    while (in < in_end) {
+        auto token = *in++;
+        std::size_t literals = token >> 4;
+        if (literals == 15 && !get_length(literals)) {
+            return false;
+        }
+        if (literals > (std::size_t)(in_end - in) || literals > size - o) {
+            return false;
+        }
+        memcpy(out + o, in, literals);
+        in += literals;
+        o += literals;
+
+        if (in == in_end) {
+            break;
+        }
+
+        if (in_end - in < 2) {
+            return false;
+        }
+        std::size_t offset = in[0] | ((std::size_t)in[1] << 8);
+        in += 2;
+        std::size_t match = token & 0xf;
+        if (match == 15 && !get_length(match)) {
+            return false;
+        }
+        match += 4;
+        if (offset == 0 || offset > o || match > size - o) {
+            return false;
+        }
+        // byte by byte, the match may overlap with its own output
+        for (std::size_t k = 0; k < match; ++k, ++o) {
+            out[o] = out[o - offset];
+        }
+    }
+    return o == size;
+}
+
+} // namespace detail
+
+/**
+ * Compress the `bytes` bytes of an array of elements of `element_size`
+ * bytes into a frame.
+ */
+inline zmq::message_t compress_array(const char* data, std::size_t bytes,
+                                     std::size_t element_size) {
+    using namespace detail;
+
+    element_size = std::max<std::size_t>(element_size, 1);
+    auto chunks = (bytes + compression_chunk - 1) / compression_chunk;
+    auto scratch = std::vector<char>(bytes);
+    auto sizes = std::vector<uint32_t>(chunks);
+
+    parallel_chunks(chunks, [&](std::size_t c) {
+        auto begin = c * compression_chunk;
+        auto n = std::min(compression_chunk, bytes - begin);
+        auto shuffled = std::vector<char>(n);
+        if (element_size > 1 && n % element_size == 0) {
+            shuffle(data + begin, shuffled.data(), n / element_size,
+                    element_size);
+        } else {
+            memcpy(shuffled.data(), data + begin, n);
+        }
+
+        auto size =
+            lz_compress((const uint8_t*)shuffled.data(), n,
+                        (uint8_t*)scratch.data() + begin, n - 1);
+        if (size == 0) {
+            memcpy(scratch.data() + begin, data + begin, n);
+            sizes[c] = (uint32_t)n | stored_chunk;
+        } else {
+            sizes[c] = (uint32_t)size;
+        }
+    });
+
+    auto total = sizeof(compressed_frame_header) + chunks * sizeof(uint32_t);
+    for (auto size : sizes) {
+        total += size & ~stored_chunk;
+    }
+
+    auto frame = zmq::message_t(total);
+    auto out = (char*)frame.data();
+    auto header = compressed_frame_header{bytes, (uint32_t)element_size,
+                                          (uint32_t)compression_chunk,
+                                          (uint32_t)chunks, 0};
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    if (chunks > 0) {
+        memcpy(out, sizes.data(), chunks * sizeof(uint32_t));
+        out += chunks * sizeof(uint32_t);
+    }
+    for (std::size_t c = 0; c < chunks; ++c) {
+        auto size = sizes[c] & ~stored_chunk;
+        memcpy(out, scratch.data() + c * compression_chunk, size);
+        out += size;
+    }
+    return frame;
+}
+
+/**
+ * Decompress a frame made by `compress_array` into `array`. Returns false
+ * if the frame is malformed.
+ */
+inline bool decompress_array(const zmq::message_t& frame,
+                             zmq::message_t& array) {
+    using namespace detail;
+
+    auto in = (const char*)frame.data();
+    auto n = frame.size();
+    compressed_frame_header header;
+    if (n < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, in, sizeof(header));
+
+    auto chunk_bytes = (std::size_t)header.chunk_bytes;
+    auto element_size = (std::size_t)header.element_size;
+    if (chunk_bytes == 0 || element_size == 0 ||
+        header.bytes / max_compression_ratio > n ||
+        header.chunks != (header.bytes + chunk_bytes - 1) / chunk_bytes ||
+        header.chunks > (n - sizeof(header)) / sizeof(uint32_t)) {
+        return false;
+    }
+
+    auto sizes = std::vector<uint32_t>(header.chunks);
+    if (!sizes.empty()) {
+        memcpy(sizes.data(), in + sizeof(header),
+               sizes.size() * sizeof(uint32_t));
+    }
+    auto offsets = std::vector<std::size_t>(header.chunks);
+    auto offset = sizeof(header) + sizes.size() * sizeof(uint32_t);
+    for (std::size_t c = 0; c < sizes.size(); ++c) {
+        offsets[c] = offset;
+        offset += sizes[c] & ~stored_chunk;
+    }
+    if (offset != n) {
+        return false;
+    }
+
+    array.rebuild(header.bytes);
+    auto out = (char*)array.data();
+    std::atomic<bool> valid = {true};
+    parallel_chunks(sizes.size(), [&](std::size_t c) {
+        auto begin = c * chunk_bytes;
+        auto raw = std::min<std::size_t>(chunk_bytes, header.bytes - begin);
+        auto size = (std::size_t)(sizes[c] & ~stored_chunk);
+        if (sizes[c] & stored_chunk) {
+            if (size != raw) {
+                valid = false;
+                return;
+            }
+            memcpy(out + begin, in + offsets[c], size);
+            return;
+        }
+
+        auto shuffled = std::vector<char>(raw);
+        if (!lz_decompress((const uint8_t*)in + offsets[c], size,
+                           (uint8_t*)shuffled.data(), raw)) {
+            valid = false;
+            return;
+        }
+        if (element_size > 1 && raw % element_size == 0) {
+            unshuffle(shuffled.data(), out + begin, raw / element_size,
+                      element_size);
+        } else {
+            memcpy(out + begin, shuffled.data(), raw);
+        }
+    });
+    return valid;
+}
+
+} // namespace tomop
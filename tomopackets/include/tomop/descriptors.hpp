@@ -26,6 +26,8 @@ enum class packet_desc : int {
     projection_data = 0x307,
     partial_projection_data = 0x308,
     projection = 0x309,
+    typed_projection = 0x30a,
+    projection_batch = 0x30b,
 
     // PARTITIONING
     set_part = 0x401,
@@ -38,4 +40,17 @@ enum class packet_desc : int {
     benchmark = 0x505,
 };
 
+/**
+ * Set on the descriptor of a packet whose arrays are compressed, so that
+ * readers that do not support compression do not recognize the packet.
+ */
+constexpr int compressed_packet_flag = 0x10000;
+
+/**
+ * The capabilities of a visualization server, which follow the scene id in
+ * its reply to a `MakeScenePacket`. A server that only replies with the
+ * scene id has none of them.
+ */
+constexpr int32_t capability_compression = 0x1;
+
 } // namespace tomop
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tomop {
+
+/**
+ * The pixel type of a typed projection. Detectors typically produce 8, 12 or
+ * 16-bit integers, which are sent as is rather than converted to float.
+ */
+enum class dtype : int32_t { u8 = 0, u16 = 1, u32 = 2, f32 = 3 };
+
+/** The size of a pixel of type `type` in bytes, or zero if it is unknown. */
+inline std::size_t dtype_size(dtype type) {
+    switch (type) {
+    case dtype::u8:
+        return 1;
+    case dtype::u16:
+        return 2;
+    case dtype::u32:
+    case dtype::f32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+/** The size of a pixel with `dtype` tag `type`, as it is sent in a packet. */
+inline std::size_t dtype_size(int32_t type) { return dtype_size((dtype)type); }
+
+} // namespace tomop
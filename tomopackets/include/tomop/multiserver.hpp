@@ -80,7 +80,13 @@ class multiserver {
 
     // DONE: send to a specific socket
     void send(const Packet& packet, int32_t server_id) {
-        packet.send(sockets_[server_id]);
+        send(packet, server_id, framing::single);
+    }
+
+    /** Send `packet` with the given framing, see `Packet::send`. */
+    void send(const Packet& packet, int32_t server_id, framing f,
+              std::shared_ptr<const void> owner = nullptr) {
+        packet.send(sockets_[server_id], f, std::move(owner));
         zmq::message_t reply;
         sockets_[server_id].recv(&reply);
     }
@@ -190,17 +196,17 @@ class multiserver {
             socket.bind("tcp://*:5557");
 
             while (true) {
-                zmq::message_t request;
+                multipart_message request;
 
                 //  Wait for next request from client
-                socket.recv(&request);
+                request.recv(socket);
 
                 zmq::message_t reply(sizeof(int));
                 int success = 1;
                 memcpy(reply.data(), &success, sizeof(int));
                 socket.send(reply);
 
-                auto desc = ((packet_desc*)request.data())[0];
+                auto desc = request.desc();
 
                 switch (desc) {
                 case packet_desc::projection_data: {
@@ -248,10 +254,11 @@ class multiserver {
         auto result = slice_data_callback_(orientation, slice_id);
 
         if (!result.first.empty()) {
-            auto data_packet =
-                SliceDataPacket(scene_ids_[server_idx], slice_id, result.first,
-                                std::move(result.second), false);
-            send(data_packet, server_idx);
+            // the slice is sent without copying it
+            auto data_packet = std::make_shared<SliceDataPacket>(
+                scene_ids_[server_idx], slice_id, result.first,
+                std::move(result.second), false);
+            send(*data_packet, server_idx, framing::multipart, data_packet);
         }
     }
 
@@ -2,9 +2,14 @@
 
 #include <zmq.hpp>
 
+#include <cstring>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
+#include "compression.hpp"
 #include "descriptors.hpp"
+#include "dtype.hpp"
 #include "serialize.hpp"
 
 #include <boost/hana.hpp>
@@ -12,6 +17,107 @@ namespace hana = boost::hana;
 
 namespace tomop {
 
+/**
+ * How a packet is split into ZeroMQ message frames. By default, the whole
+ * (serialized) packet is a single frame. With multipart framing, the first
+ * frame holds the descriptor and the fields of the packet, and every array
+ * of numbers is sent as raw bytes in a frame of its own. Array frames can be
+ * sent from the memory of the packet, and be used where they are received,
+ * without copying them.
+ */
+enum class framing { single, multipart };
+
+/**
+ * A packet as it was received, in one or more frames. The array frames of a
+ * multipart packet can be used (or taken over) as is.
+ */
+struct multipart_message {
+    zmq::message_t header;
+    std::vector<zmq::message_t> arrays;
+
+    /**
+     * Receive all frames of the next packet on `socket`, returns false if
+     * receiving failed.
+     */
+    bool recv(zmq::socket_t& socket) {
+        arrays.clear();
+        if (!socket.recv(&header)) {
+            return false;
+        }
+        auto more = header.more();
+        while (more) {
+            arrays.emplace_back();
+            if (!socket.recv(&arrays.back())) {
+                return false;
+            }
+            more = arrays.back().more();
+        }
+        decompress_();
+        return true;
+    }
+
+    packet_desc desc() const {
+        packet_desc result;
+        memcpy(&result, header.data(), sizeof(packet_desc));
+        return result;
+    }
+
+    bool multipart() const { return !arrays.empty(); }
+
+  private:
+    /**
+     * Decompress the arrays of a compressed packet, and remove the codec
+     * from its header. If the codec is unknown or the frames are malformed,
+     * the packet is left as is, with a descriptor that no reader knows.
+     */
+    void decompress_() {
+        auto flagged = (int)desc();
+        auto offset = sizeof(packet_desc) + sizeof(int32_t);
+        if (!(flagged & compressed_packet_flag) || header.size() < offset) {
+            return;
+        }
+
+        int32_t id = 0;
+        memcpy(&id, (char*)header.data() + sizeof(packet_desc), sizeof(id));
+        if (id != (int32_t)codec::shuffle_lz) {
+            return;
+        }
+
+        auto decompressed = std::vector<zmq::message_t>(arrays.size());
+        for (std::size_t i = 0; i < arrays.size(); ++i) {
+            if (!decompress_array(arrays[i], decompressed[i])) {
+                return;
+            }
+        }
+
+        auto plain = flagged & ~compressed_packet_flag;
+        auto stripped = zmq::message_t(header.size() - sizeof(int32_t));
+        memcpy(stripped.data(), &plain, sizeof(packet_desc));
+        memcpy((char*)stripped.data() + sizeof(packet_desc),
+               (char*)header.data() + offset, header.size() - offset);
+        header = std::move(stripped);
+        arrays = std::move(decompressed);
+    }
+};
+
+namespace detail {
+
+// frees the owner of an array frame that was sent without copying it
+inline void release_owner(void*, void* hint) {
+    delete (std::shared_ptr<const void>*)hint;
+}
+
+// packets whose array of bytes holds pixels of the type given by their
+// `dtype` tag (typed projections and batches of them)
+template <typename P, typename = void>
+struct has_dtype : std::false_type {};
+
+template <typename P>
+struct has_dtype<P, std::void_t<decltype(std::declval<P&>().dtype)>>
+    : std::true_type {};
+
+} // namespace detail
+
 struct Packet {
     template <typename BufferT>
     struct omembuf {
@@ -44,6 +150,30 @@ struct Packet {
         socket.send(request);
     }
 
+    /**
+     * Send the packet with the given framing. With multipart framing, the
+     * arrays are sent straight from the memory of this packet if `owner` is
+     * given, which has to keep the packet alive (e.g. a shared pointer to
+     * it) until ZeroMQ releases it. Otherwise, they are copied.
+     *
+     * If a codec is given, the packet is sent with multipart framing, and
+     * its arrays are compressed. Only receivers that use `multipart_message`
+     * can read it, others do not recognize its descriptor.
+     */
+    void send(zmq::socket_t& socket, framing f,
+              std::shared_ptr<const void> owner = nullptr,
+              codec c = codec::none) const {
+        if (f == framing::single && c == codec::none) {
+            send(socket);
+        } else {
+            send_multipart(socket, std::move(owner), c);
+        }
+    }
+
+    virtual void send_multipart(zmq::socket_t& socket,
+                                std::shared_ptr<const void> owner,
+                                codec c = codec::none) const = 0;
+
     virtual std::size_t size() const = 0;
     virtual memory_buffer serialize(int size) const = 0;
     virtual void deserialize(memory_buffer buffer) = 0;
@@ -51,6 +181,9 @@ struct Packet {
     virtual void serialize(zmq::message_t& request) const = 0;
     virtual void deserialize(zmq::message_t& request) = 0;
 
+    /** Deserialize a packet that was received with either framing. */
+    virtual void deserialize(multipart_message& message) = 0;
+
     virtual ~Packet() = default;
 };
 
@@ -103,6 +236,79 @@ struct PacketBase : public Packet {
         om | dummy;
         fill(*(Derived*)this, om);
     }
+
+    void send_multipart(zmq::socket_t& socket,
+                        std::shared_ptr<const void> owner,
+                        codec c = codec::none) const override {
+        // a compressed packet has a flagged descriptor, followed by the codec
+        auto desc = Derived::desc;
+        auto id = (int32_t)c;
+        if (c != codec::none) {
+            desc = (packet_desc)((int)desc | compressed_packet_flag);
+        }
+
+        header_scale total;
+        total | desc;
+        if (c != codec::none) {
+            total | id;
+        }
+        fill(*(Derived*)this, total);
+
+        zmq::message_t header(total.size);
+        header_span buffer(header.size(), (char*)header.data());
+        auto im = imembuf<header_span>(buffer);
+        im | desc;
+        if (c != codec::none) {
+            im | id;
+        }
+        fill(*(Derived*)this, im);
+
+        // the bytes of pixels are shuffled by the size of their type
+        if constexpr (detail::has_dtype<Derived>::value) {
+            auto pixel_size = dtype_size(((const Derived*)this)->dtype);
+            for (auto& element_size : buffer.element_sizes) {
+                if (element_size == 1 && pixel_size > 0) {
+                    element_size = pixel_size;
+                }
+            }
+        }
+
+        auto frames = buffer.arrays.size();
+        socket.send(header, frames > 0 ? ZMQ_SNDMORE : 0);
+        for (std::size_t i = 0; i < frames; ++i) {
+            auto flags = i + 1 < frames ? ZMQ_SNDMORE : 0;
+            auto data = buffer.arrays[i].first;
+            auto bytes = buffer.arrays[i].second;
+            if (c != codec::none) {
+                auto frame =
+                    compress_array(data, bytes, buffer.element_sizes[i]);
+                socket.send(frame, flags);
+            } else if (owner && bytes > 0) {
+                zmq::message_t frame((void*)data, bytes, detail::release_owner,
+                                     new std::shared_ptr<const void>(owner));
+                socket.send(frame, flags);
+            } else {
+                zmq::message_t frame(data, bytes);
+                socket.send(frame, flags);
+            }
+        }
+    }
+
+    void deserialize(multipart_message& message) override {
+        if (!message.multipart()) {
+            deserialize(message.header);
+            return;
+        }
+
+        header_span buffer(message.header.size(), (char*)message.header.data());
+        for (auto& frame : message.arrays) {
+            buffer.arrays.push_back({(const char*)frame.data(), frame.size()});
+        }
+        auto om = omembuf<header_span>(buffer);
+        packet_desc dummy;
+        om | dummy;
+        fill(*(Derived*)this, om);
+    }
 };
 
 } // namespace tomop
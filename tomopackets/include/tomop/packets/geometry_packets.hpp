@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
+#include "../dtype.hpp"
 #include "../packets.hpp"
 
 namespace tomop {
@@ -137,4 +139,53 @@ struct ProjectionPacket : public PacketBase<ProjectionPacket> {
                              (std::vector<float>, data));
 };
 
+/**
+ * A projection in its native pixel type. The pixels are stored as raw
+ * (native endian) bytes, `shape[0] * shape[1] * dtype_size(dtype)` of them.
+ */
+struct TypedProjectionPacket : public PacketBase<TypedProjectionPacket> {
+    static constexpr auto desc = packet_desc::typed_projection;
+    TypedProjectionPacket() = default;
+    TypedProjectionPacket(int32_t type_, int32_t projection_id_,
+                          std::array<int32_t, 2> shape_, int32_t dtype_,
+                          std::vector<uint8_t> data_)
+        : type(type_), projection_id(projection_id_), shape(shape_),
+          dtype(dtype_), data(data_) {}
+    BOOST_HANA_DEFINE_STRUCT(TypedProjectionPacket,
+                             // NOTE: the fields up to the data are in the same
+                             // order as for `ProjectionPacket`
+                             (int32_t, type),
+                             (int32_t, projection_id),
+                             (std::array<int32_t, 2>, shape),
+                             // one of `tomop::dtype`
+                             (int32_t, dtype),
+                             (std::vector<uint8_t>, data));
+};
+
+/**
+ * A batch of `count` projections of the same kind, with projection ids
+ * `first_id`, `first_id + stride`, .... The pixels of the projections are
+ * stored one after the other, as for `TypedProjectionPacket`. Sending many
+ * (small) projections in a single message saves the per-message overhead.
+ */
+struct ProjectionBatchPacket : public PacketBase<ProjectionBatchPacket> {
+    static constexpr auto desc = packet_desc::projection_batch;
+    ProjectionBatchPacket() = default;
+    ProjectionBatchPacket(int32_t type_, int32_t first_id_, int32_t stride_,
+                          int32_t count_, std::array<int32_t, 2> shape_,
+                          int32_t dtype_, std::vector<uint8_t> data_)
+        : type(type_), first_id(first_id_), stride(stride_), count(count_),
+          shape(shape_), dtype(dtype_), data(data_) {}
+    BOOST_HANA_DEFINE_STRUCT(ProjectionBatchPacket,
+                             // 0 dark, 1 flat, 2 standard
+                             (int32_t, type),
+                             (int32_t, first_id),
+                             (int32_t, stride),
+                             (int32_t, count),
+                             (std::array<int32_t, 2>, shape),
+                             // one of `tomop::dtype`
+                             (int32_t, dtype),
+                             (std::vector<uint8_t>, data));
+};
+
 } // namespace tomop
@@ -1,35 +1,99 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <string>
 
 #include <zmq.hpp>
 
 #include "exceptions.hpp"
 #include "packets.hpp"
+#include "shm.hpp"
 
 namespace tomop {
 
+/**
+ * Sends packets to a single receiver.
+ *
+ * With a `ZMQ_PUSH` socket (the default) packets are sent without any
+ * confirmation, and with a `ZMQ_REQ` socket every packet waits for a reply.
+ * With a `ZMQ_DEALER` socket, packets are pipelined to a `ZMQ_ROUTER`
+ * receiver: every packet is preceded by a frame with its sequence number
+ * (starting at 1, as a `uint64_t`), and the receiver replies with the
+ * sequence number up to which it has consumed all packets. At most `window`
+ * packets are in flight, after which `send` waits for an acknowledgement.
+ *
+ * The receiver can also grant credits, by following the acknowledged
+ * sequence number with the sequence number up to which the publisher may
+ * send. Once the receiver has granted credits, `send` waits until it has
+ * credits left.
+ */
 class publisher {
   public:
+    static constexpr std::size_t default_window = 64;
+
     publisher(std::string hostname = "localhost", int32_t port = 5555,
               int32_t type = ZMQ_PUSH)
         : context_(1), socket_(context_, type), type_(type) {
         using namespace std::string_literals;
         using namespace std::chrono_literals;
 
+        // packets for a receiver on the same host are written straight into
+        // its shared memory ring
+        if (shm_ring::is_address(hostname)) {
+            address_ = hostname;
+            ring_ = shm_ring::open(hostname);
+            return;
+        }
+
         address_ = "tcp://"s + hostname + ":"s + std::to_string(port);
         socket_.setsockopt(ZMQ_LINGER, 200);
         socket_.connect(address_);
     }
 
     ~publisher() {
+        // give the packets in flight a chance to arrive
+        if (type_ == ZMQ_DEALER) {
+            flush(std::chrono::milliseconds(1000));
+        }
         socket_.close();
         context_.close();
     }
 
-    void send(const Packet& packet) {
-        packet.send(socket_);
+    void send(const Packet& packet) { send(packet, framing::single); }
+
+    /** Send `packet` with the given framing, see `Packet::send`. */
+    void send(const Packet& packet, framing f,
+              std::shared_ptr<const void> owner = nullptr) {
+        if (ring_) {
+            ring_->send(packet);
+            return;
+        }
+
+        if (type_ == ZMQ_DEALER) {
+            while (sent_ - acknowledged_ >= window_ ||
+                   (limited_ && sent_ >= limit_)) {
+                receive_ack_(-1);
+            }
+
+            auto sequence = sent_ + 1;
+            zmq::message_t header(&sequence, sizeof(sequence));
+            socket_.send(header, ZMQ_SNDMORE);
+            packet.send(socket_, f, std::move(owner), codec_);
+            sent_ = sequence;
+
+            // the acknowledgements that have arrived in the meantime
+            zmq::message_t ack;
+            while (socket_.recv(&ack, ZMQ_DONTWAIT)) {
+                read_ack_(ack);
+            }
+            return;
+        }
+
+        packet.send(socket_, f, std::move(owner), codec_);
 
         if (type_ == ZMQ_REQ) {
             zmq::message_t reply;
@@ -37,13 +101,108 @@ class publisher {
         }
     }
 
+    /**
+     * Compress the arrays of every packet that is sent with `c`. The
+     * receiver has to support the codec, so this is off by default. Packets
+     * written into a shared memory ring are never compressed.
+     */
+    void set_compression(codec c) { codec_ = c; }
+
+    /** Set the number of packets that can be in flight (`ZMQ_DEALER`). */
+    void set_window(std::size_t window) {
+        window_ = std::max<std::size_t>(window, 1);
+    }
+
+    /**
+     * Wait until the receiver has acknowledged every packet that was sent,
+     * or until `timeout` has passed (if it is not negative). Returns whether
+     * every packet was acknowledged. Only waits for a `ZMQ_DEALER` socket.
+     */
+    bool flush(std::chrono::milliseconds timeout =
+                   std::chrono::milliseconds(-1)) {
+        using namespace std::chrono;
+
+        if (type_ != ZMQ_DEALER) {
+            return true;
+        }
+        auto deadline = steady_clock::now() + timeout;
+        while (acknowledged_ < sent_) {
+            auto left = -1l;
+            if (timeout.count() >= 0) {
+                left = (long)duration_cast<milliseconds>(deadline -
+                                                         steady_clock::now())
+                           .count();
+                if (left < 0) {
+                    return false;
+                }
+            }
+            receive_ack_(left);
+        }
+        return true;
+    }
+
+    /** The sequence number of the last packet that was sent. */
+    uint64_t sent() const { return sent_; }
+
+    /** The sequence number up to which all packets were acknowledged. */
+    uint64_t acknowledged() const { return acknowledged_; }
+
+    /** The number of packets that can be sent without waiting. */
+    uint64_t credits() const {
+        auto in_flight = sent_ - acknowledged_;
+        auto result = (uint64_t)window_ - std::min<uint64_t>(window_, in_flight);
+        if (limited_) {
+            result = std::min(result, limit_ - std::min(limit_, sent_));
+        }
+        return result;
+    }
+
   private:
+    /**
+     * Receive an acknowledgement, waiting at most `timeout` ms (or forever,
+     * if negative). Returns whether one was received.
+     */
+    bool receive_ack_(long timeout) {
+        zmq::pollitem_t items[] = {{socket_, 0, ZMQ_POLLIN, 0}};
+        if (zmq::poll(items, 1, timeout) <= 0) {
+            return false;
+        }
+        zmq::message_t ack;
+        socket_.recv(&ack);
+        read_ack_(ack);
+        return true;
+    }
+
+    void read_ack_(const zmq::message_t& ack) {
+        uint64_t sequences[2] = {};
+        if (ack.size() != sizeof(uint64_t) && ack.size() != sizeof(sequences)) {
+            return;
+        }
+        memcpy(sequences, ack.data(), ack.size());
+        acknowledged_ = std::max(acknowledged_, std::min(sequences[0], sent_));
+        if (ack.size() == sizeof(sequences)) {
+            limit_ = std::max(limit_, sequences[1]);
+            limited_ = true;
+        }
+    }
+
     // publisher connection
     zmq::context_t context_;
     zmq::socket_t socket_;
 
     int type_;
     std::string address_;
+    std::shared_ptr<shm_ring> ring_;
+    codec codec_ = codec::none;
+
+    // pipelined (dealer) connection
+    std::size_t window_ = default_window;
+    uint64_t sent_ = 0;
+    uint64_t acknowledged_ = 0;
+    // the sequence number up to which packets may be sent, once the
+    // receiver has granted credits
+    uint64_t limit_ = 0;
+    bool limited_ = false;
 };
 
 } // namespace tomop
@@ -3,9 +3,31 @@
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "exceptions.hpp"
 
 namespace tomop {
 
+/**
+ * Vectors of these types are (de)serialized with a single copy of their
+ * elements, which is equivalent to copying the elements one by one.
+ * `std::vector<bool>` does not store its elements contiguously.
+ */
+template <typename T>
+constexpr bool is_contiguous_v =
+    std::is_trivially_copyable_v<T> && !std::is_same_v<T, bool>;
+
+/**
+ * Arrays of these types are sent in a frame of their own when a packet is
+ * sent with multipart framing.
+ */
+template <typename T>
+constexpr bool is_bulk_v = std::is_arithmetic_v<T> && !std::is_same_v<T, bool>;
+
 struct scale {
     std::size_t size = 0;
 
@@ -21,8 +43,12 @@ struct scale {
     template <typename T>
     void operator|(std::vector<T>& xs) {
         size += sizeof(int);
-        for (auto x : xs) {
-            (*this) | x;
+        if constexpr (is_contiguous_v<T>) {
+            size += xs.size() * sizeof(T);
+        } else {
+            for (auto& x : xs) {
+                (*this) | x;
+            }
         }
     }
 };
@@ -48,10 +74,8 @@ struct memory_span {
     }
 
     void operator<<(std::string& str) {
-        for (auto c : str) {
-            (*this) << c;
-        }
-        (*this) << '\0';
+        memcpy(data + index, str.c_str(), (str.size() + 1) * sizeof(char));
+        index += (str.size() + 1) * sizeof(char);
     }
 
     void operator>>(std::string& str) {
@@ -62,8 +86,12 @@ struct memory_span {
     template <typename T>
     void operator<<(std::vector<T>& xs) {
         (*this) << (int)xs.size();
-        for (auto& x : xs) {
-            (*this) << x;
+        if constexpr (is_contiguous_v<T>) {
+            write(xs.data(), xs.size() * sizeof(T));
+        } else {
+            for (auto& x : xs) {
+                (*this) << x;
+            }
         }
     }
 
@@ -72,9 +100,27 @@ struct memory_span {
         int size = 0;
         (*this) >> size;
         xs.resize(size);
-        for (auto& x : xs) {
-            (*this) >> x;
+        if constexpr (is_contiguous_v<T>) {
+            read(xs.data(), xs.size() * sizeof(T));
+        } else {
+            for (auto& x : xs) {
+                (*this) >> x;
+            }
+        }
+    }
+
+    void write(const void* source, std::size_t bytes) {
+        if (bytes > 0) {
+            memcpy(data + index, source, bytes);
         }
+        index += bytes;
+    }
+
+    void read(void* target, std::size_t bytes) {
+        if (bytes > 0) {
+            memcpy(target, data + index, bytes);
+        }
+        index += bytes;
     }
 };
 
@@ -94,4 +140,96 @@ struct memory_buffer : public memory_span {
     std::unique_ptr<char[]> buffer;
 };
 
+/**
+ * Sizes the header frame of a packet with multipart framing, in which arrays
+ * of numbers only take the space of their length.
+ */
+struct header_scale {
+    std::size_t size = 0;
+
+    template <typename T>
+    void operator|(T&) {
+        size += sizeof(T);
+    }
+
+    void operator|(std::string& str) {
+        size += (str.size() + 1) * sizeof(char);
+    }
+
+    template <typename T>
+    void operator|(std::vector<T>& xs) {
+        size += sizeof(int);
+        if constexpr (is_bulk_v<T>) {
+            // the elements are in a frame of their own
+        } else if constexpr (is_contiguous_v<T>) {
+            size += xs.size() * sizeof(T);
+        } else {
+            for (auto& x : xs) {
+                (*this) | x;
+            }
+        }
+    }
+};
+
+/**
+ * The header frame of a packet with multipart framing. This is laid out as
+ * a single frame packet, except that arrays of numbers are only stored by
+ * their length. Their elements are in frames of their own, which are
+ * collected in `arrays` (in order) when writing, and taken from `arrays`
+ * when reading.
+ */
+struct header_span {
+    header_span(std::size_t size, char* data) : span(size, data) {}
+
+    memory_span span;
+    std::vector<std::pair<const char*, std::size_t>> arrays;
+    std::vector<std::size_t> element_sizes;
+    std::size_t next_array = 0;
+
+    template <typename T>
+    void operator<<(const T& value) {
+        span << value;
+    }
+
+    template <typename T>
+    void operator>>(T& value) {
+        span >> value;
+    }
+
+    void operator<<(std::string& str) { span << str; }
+    void operator>>(std::string& str) { span >> str; }
+
+    template <typename T>
+    void operator<<(std::vector<T>& xs) {
+        if constexpr (is_bulk_v<T>) {
+            span << (int)xs.size();
+            arrays.push_back({(const char*)xs.data(), xs.size() * sizeof(T)});
+            element_sizes.push_back(sizeof(T));
+        } else {
+            span << xs;
+        }
+    }
+
+    template <typename T>
+    void operator>>(std::vector<T>& xs) {
+        if constexpr (is_bulk_v<T>) {
+            int size = 0;
+            span >> size;
+            auto bytes = (std::size_t)size * sizeof(T);
+            if (size < 0 || next_array >= arrays.size() ||
+                arrays[next_array].second != bytes) {
+                throw server_error(
+                    "Array frame does not match the packet header");
+            }
+            xs.resize(size);
+            if (bytes > 0) {
+                memcpy(xs.data(), arrays[next_array].first, bytes);
+            }
+            ++next_array;
+        } else {
+            span >> xs;
+        }
+    }
+};
+
 } // namespace tomop
@@ -96,8 +96,12 @@ class server {
         }
     }
 
-    void send(const Packet& packet) {
-        packet.send(socket_);
+    void send(const Packet& packet) { send(packet, framing::single); }
+
+    /** Send `packet` with the given framing, see `Packet::send`. */
+    void send(const Packet& packet, framing f,
+              std::shared_ptr<const void> owner = nullptr) {
+        packet.send(socket_, f, std::move(owner));
         zmq::message_t reply;
         socket_.recv(&reply);
     }
@@ -194,17 +198,17 @@ class server {
             socket.bind("tcp://*:5557");
 
             while (true) {
-                zmq::message_t request;
+                multipart_message request;
 
                 //  Wait for next request from client
-                socket.recv(&request);
+                request.recv(socket);
 
                 zmq::message_t reply(sizeof(int));
                 int success = 1;
                 memcpy(reply.data(), &success, sizeof(int));
                 socket.send(reply);
 
-                auto desc = ((packet_desc*)request.data())[0];
+                auto desc = request.desc();
 
                 switch (desc) {
                 case packet_desc::projection_data: {
@@ -249,10 +253,11 @@ class server {
         auto result = slice_data_callback_(orientation, slice_id);
 
         if (!result.first.empty()) {
-            auto data_packet =
-                SliceDataPacket(scene_id_, slice_id, result.first,
-                                std::move(result.second), false);
-            send(data_packet);
+            // the slice is sent without copying it
+            auto data_packet = std::make_shared<SliceDataPacket>(
+                scene_id_, slice_id, result.first, std::move(result.second),
+                false);
+            send(*data_packet, framing::multipart, data_packet);
         }
     }
 
@@ -0,0 +1,391 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <zmq.hpp>
+
+#include "exceptions.hpp"
+#include "packets.hpp"
+
+namespace tomop {
+
+namespace detail {
+
+// futex words shared between processes, so not FUTEX_PRIVATE
+inline void shared_futex_wait(std::atomic<uint32_t>& word, uint32_t expected) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT,
+            expected, nullptr, nullptr, 0);
+#else
+    (void)word;
+    (void)expected;
+    std::this_thread::yield();
+#endif
+}
+
+inline void shared_futex_wake(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX,
+            nullptr, nullptr, 0);
+#else
+    (void)word;
+#endif
+}
+
+} // namespace detail
+
+/**
+ * A ring of packet slots in shared memory, for sending packets between a
+ * producer and a consumer on the same host without going through a socket.
+ *
+ * The consumer creates the ring, under a name such as `/recast3d`, and the
+ * producer opens it. The producer serializes a packet straight into the
+ * next free slot. The consumer receives it as a message that points into
+ * the slot, and the slot is freed when that message is released, which may
+ * happen out of order. Like `slicerecon::util::ingest_ring`, every slot
+ * carries a sequence number that tells whether it is free or filled, and a
+ * side that finds nothing to do spins briefly, and then sleeps on a futex.
+ *
+ * A ring has a single producer and a single consumer. Rings are addressed
+ * as `shm://name`, optionally followed by `?slots=<count>` and
+ * `&slot_size=<bytes>`, which are used when creating the ring. A packet
+ * that does not fit in a slot can not be sent. The default of 32 MiB fits a
+ * 2048 x 2048 projection of floats, larger detectors need a larger
+ * `slot_size`. The mapping is sparse, so unused slot space costs no memory.
+ */
+class shm_ring : public std::enable_shared_from_this<shm_ring> {
+  public:
+    static constexpr uint32_t default_slots = 32;
+    static constexpr std::size_t default_slot_size = std::size_t{32} << 20;
+    // bounds on the address parameters, so that the ring size can not overflow
+    static constexpr uint32_t max_slots = 1u << 16;
+    static constexpr std::size_t max_slot_size = std::size_t{1} << 32;
+
+    /** Whether `address` refers to a shared memory ring. */
+    static bool is_address(const std::string& address) {
+        return address.rfind("shm://", 0) == 0;
+    }
+
+    /**
+     * Create a ring as the consumer, replacing an existing ring. The ring
+     * has `slots` slots, unless the address asks for a number of them.
+     */
+    static std::shared_ptr<shm_ring> create(const std::string& address,
+                                            uint32_t slots = default_slots) {
+        auto name = path_(address);
+        slots = std::max((uint32_t)parameter_(address, "slots", slots,
+                                              max_slots),
+                         uint32_t{1});
+        auto slot_size = (std::size_t)parameter_(
+            address, "slot_size", default_slot_size, max_slot_size);
+        slot_size = (slot_size + alignment - 1) / alignment * alignment;
+
+        shm_unlink(name.c_str());
+        auto fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            throw server_error("Could not create shared memory ring " + name);
+        }
+        auto bytes = sizeof(ring_header) + slots * (sizeof(slot_header) +
+                                                     slot_size);
+        if (ftruncate(fd, bytes) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw server_error("Could not size shared memory ring " + name);
+        }
+
+        auto ring = std::shared_ptr<shm_ring>(new shm_ring(name, fd, bytes));
+        ring->owner_ = true;
+
+        auto header = new (ring->memory_) ring_header;
+        header->slots = slots;
+        header->slot_size = slot_size;
+        for (uint32_t i = 0; i < slots; ++i) {
+            auto s = new (ring->slot_(i)) slot_header;
+            s->sequence.store(i, std::memory_order_relaxed);
+        }
+        // publish the ring to producers that open it
+        header->magic.store(magic, std::memory_order_release);
+        return ring;
+    }
+
+    /** Open the ring at `address` as the producer. */
+    static std::shared_ptr<shm_ring> open(const std::string& address) {
+        auto name = path_(address);
+        auto fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0) {
+            throw server_error("No shared memory ring " + name +
+                               ", is the receiver running?");
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 ||
+            (std::size_t)info.st_size < sizeof(ring_header)) {
+            close(fd);
+            throw server_error("Invalid shared memory ring " + name);
+        }
+
+        auto ring = std::shared_ptr<shm_ring>(
+            new shm_ring(name, fd, (std::size_t)info.st_size));
+        auto& header = ring->header_();
+        if (header.magic.load(std::memory_order_acquire) != magic ||
+            sizeof(ring_header) + header.slots * (sizeof(slot_header) +
+                                                  header.slot_size) >
+                ring->bytes_) {
+            throw server_error("Invalid shared memory ring " + name);
+        }
+        return ring;
+    }
+
+    ~shm_ring() {
+        if (memory_ != nullptr) {
+            munmap(memory_, bytes_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+        if (owner_) {
+            shm_unlink(name_.c_str());
+        }
+    }
+
+    shm_ring(const shm_ring&) = delete;
+    shm_ring& operator=(const shm_ring&) = delete;
+
+    /**
+     * Serialize `packet` into the next free slot, waiting for one if the
+     * ring is full, and hand it to the consumer.
+     */
+    void send(const Packet& packet) {
+        auto& header = header_();
+        auto size = packet.size();
+        if (size > header.slot_size) {
+            throw server_error("Packet of " + std::to_string(size) +
+                               " bytes does not fit in a shared memory slot "
+                               "of " +
+                               std::to_string(header.slot_size) + " bytes");
+        }
+
+        auto position = header.tail.load(std::memory_order_relaxed);
+        auto& s = *slot_(position % header.slots);
+        wait_(s.sequence, position, header.freed, header.producer_waiting);
+        if (stop_.load()) {
+            return;
+        }
+
+        // a message without a free function, the slot stays ours
+        zmq::message_t target(data_(s), size, nullptr);
+        packet.serialize(target);
+        s.size = size;
+        s.sequence.store(position + 1, std::memory_order_release);
+        header.tail.store(position + 1, std::memory_order_relaxed);
+
+        header.filled.fetch_add(1);
+        if (header.consumer_waiting.load() > 0) {
+            detail::shared_futex_wake(header.filled);
+        }
+    }
+
+    /**
+     * Receive the next packet, waiting for one if the ring is empty. The
+     * header frame of `message` points into the slot, which is freed when
+     * the frame is released. Returns false once the ring is stopped.
+     */
+    bool recv(multipart_message& message) {
+        auto& header = header_();
+        auto position = header.head.load(std::memory_order_relaxed);
+        auto& s = *slot_(position % header.slots);
+        wait_(s.sequence, position + 1, header.filled,
+              header.consumer_waiting);
+        if (stop_.load()) {
+            return false;
+        }
+        header.head.store(position + 1, std::memory_order_relaxed);
+
+        message.arrays.clear();
+        message.header = zmq::message_t(
+            data_(s), s.size, release_,
+            new release_hint{shared_from_this(), position});
+        return true;
+    }
+
+    /** The number of slots of the ring. */
+    uint32_t slots() { return header_().slots; }
+
+    /** Wake up and turn away the waiting side of this process. */
+    void stop() {
+        stop_.store(true);
+        auto& header = header_();
+        header.filled.fetch_add(1);
+        header.freed.fetch_add(1);
+        detail::shared_futex_wake(header.filled);
+        detail::shared_futex_wake(header.freed);
+    }
+
+  private:
+    static constexpr uint32_t magic = 0x746f6d6f; // "tomo"
+    static constexpr std::size_t alignment = 64;
+    static constexpr int spin_iterations = 1 << 10;
+
+    struct alignas(64) ring_header {
+        std::atomic<uint32_t> magic = {0};
+        uint32_t slots = 0;
+        uint64_t slot_size = 0;
+
+        // the next position to fill, and to receive
+        alignas(64) std::atomic<uint64_t> tail = {0};
+        alignas(64) std::atomic<uint64_t> head = {0};
+
+        // doorbells, bumped on every send and release respectively
+        alignas(64) std::atomic<uint32_t> filled = {0};
+        std::atomic<uint32_t> consumer_waiting = {0};
+        alignas(64) std::atomic<uint32_t> freed = {0};
+        std::atomic<uint32_t> producer_waiting = {0};
+    };
+
+    // a slot at position p is free for the producer if its sequence equals
+    // p, and filled for the consumer if it equals p + 1
+    struct alignas(64) slot_header {
+        std::atomic<uint64_t> sequence = {0};
+        uint64_t size = 0;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                      std::atomic<uint32_t>::is_always_lock_free,
+                  "atomics in shared memory have to be lock free");
+
+    struct release_hint {
+        std::shared_ptr<shm_ring> ring;
+        uint64_t position;
+    };
+
+    shm_ring(std::string name, int fd, std::size_t bytes)
+        : name_(std::move(name)), fd_(fd), bytes_(bytes) {
+        auto memory =
+            mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (memory == MAP_FAILED) {
+            close(fd_);
+            throw server_error("Could not map shared memory ring " + name_);
+        }
+        memory_ = (char*)memory;
+    }
+
+    static std::string path_(const std::string& address) {
+        auto end = address.find('?');
+        auto name = address.substr(6, end == std::string::npos
+                                          ? std::string::npos
+                                          : end - 6);
+        if (name.empty() || name.find('/') != std::string::npos) {
+            throw server_error("Invalid shared memory address: " + address);
+        }
+        return "/" + name;
+    }
+
+    /** A positive number `key=<value>` of the address, at most `max`. */
+    static unsigned long long parameter_(const std::string& address,
+                                         const std::string& key,
+                                         unsigned long long fallback,
+                                         unsigned long long max) {
+        auto query = address.find('?');
+        if (query == std::string::npos) {
+            return fallback;
+        }
+        auto start = address.find(key + "=", query);
+        while (start != std::string::npos) {
+            auto before = address[start - 1];
+            if (before == '?' || before == '&') {
+                auto first = address.data() + start + key.size() + 1;
+                auto last = address.data() + address.size();
+                auto value = 0ull;
+                auto [end, error] = std::from_chars(first, last, value);
+                if (error != std::errc{} || end == first || value == 0 ||
+                    value > max ||
+                    (end != last && *end != '&')) {
+                    throw server_error("Invalid value for " + key +
+                                       " in shared memory address: " +
+                                       address);
+                }
+                return value;
+            }
+            start = address.find(key + "=", start + 1);
+        }
+        return fallback;
+    }
+
+    static void release_(void*, void* hint) {
+        auto h = (release_hint*)hint;
+        auto& header = h->ring->header_();
+        auto& s = *h->ring->slot_(h->position % header.slots);
+        s.sequence.store(h->position + header.slots,
+                         std::memory_order_release);
+
+        header.freed.fetch_add(1);
+        if (header.producer_waiting.load() > 0) {
+            detail::shared_futex_wake(header.freed);
+        }
+        delete h;
+    }
+
+    /** Wait until `sequence` equals `expected`, or the ring is stopped. */
+    void wait_(std::atomic<uint64_t>& sequence, uint64_t expected,
+               std::atomic<uint32_t>& doorbell,
+               std::atomic<uint32_t>& waiting) {
+        for (int i = 0;; ++i) {
+            if (stop_.load() ||
+                sequence.load(std::memory_order_acquire) == expected) {
+                return;
+            }
+            if (i < spin_iterations) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // announce that we are going to sleep before checking one last
+            // time, so that a doorbell in between is either seen, or wakes us
+            waiting.fetch_add(1);
+            auto ticket = doorbell.load();
+            if (sequence.load(std::memory_order_acquire) != expected &&
+                !stop_.load()) {
+                detail::shared_futex_wait(doorbell, ticket);
+            }
+            waiting.fetch_sub(1);
+        }
+    }
+
+    ring_header& header_() { return *(ring_header*)memory_; }
+
+    slot_header* slot_(uint64_t index) {
+        return (slot_header*)(memory_ + sizeof(ring_header) +
+                              index * (sizeof(slot_header) +
+                                       header_().slot_size));
+    }
+
+    char* data_(slot_header& s) { return (char*)&s + sizeof(slot_header); }
+
+    std::string name_;
+    int fd_ = -1;
+    std::size_t bytes_ = 0;
+    char* memory_ = nullptr;
+    bool owner_ = false;
+    std::atomic<bool> stop_ = {false};
+};
+
+} // namespace tomop
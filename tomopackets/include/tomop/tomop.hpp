@@ -1,9 +1,12 @@
 #include "descriptors.hpp"
+#include "dtype.hpp"
 #include "packets.hpp"
 #include "publisher.hpp"
 #include "serialize.hpp"
 #include "server.hpp"
+#include "shm.hpp"
 #include "multiserver.hpp"
+#include "view.hpp"
 
 #include "packets/geometry_packets.hpp"
 #include "packets/partitioning_packets.hpp"
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "exceptions.hpp"
+#include "packets.hpp"
+#include "serialize.hpp"
+
+namespace tomop {
+
+/** A read-only view of `size` elements of type `T`, stored elsewhere. */
+template <typename T>
+struct array_view {
+    array_view() = default;
+    array_view(const T* data, std::size_t size) : data_(data), size_(size) {}
+
+    const T* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    const T* begin() const { return data_; }
+    const T* end() const { return data_ + size_; }
+    const T& operator[](std::size_t i) const { return data_[i]; }
+
+  private:
+    const T* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+/**
+ * Reads a packet from a received message, but leaves the arrays of numbers
+ * where they are. Their location is recorded instead, by the offset of the
+ * array (member) in the packet.
+ */
+struct view_span {
+    struct array {
+        std::ptrdiff_t member;
+        const char* data;
+        std::size_t bytes;
+    };
+
+    view_span(multipart_message& message, const char* packet)
+        : span(message.header.size(), (char*)message.header.data()),
+          size(message.header.size()), packet(packet) {
+        for (auto& frame : message.arrays) {
+            frames.push_back({(const char*)frame.data(), frame.size()});
+        }
+    }
+
+    memory_span span;
+    std::size_t size;
+    const char* packet;
+    std::vector<std::pair<const char*, std::size_t>> frames;
+    std::size_t next_frame = 0;
+    std::vector<array> arrays;
+
+    template <typename T>
+    void operator>>(T& value) {
+        check_(sizeof(T));
+        span >> value;
+    }
+
+    void operator>>(std::string& str) {
+        check_(0);
+        check_(strnlen(span.data + span.index, size - span.index) + 1);
+        span >> str;
+    }
+
+    template <typename T>
+    void operator>>(std::vector<T>& xs) {
+        if constexpr (is_bulk_v<T>) {
+            int count = 0;
+            (*this) >> count;
+            auto bytes = (std::size_t)count * sizeof(T);
+            if (count < 0) {
+                throw server_error("Negative array length in packet");
+            }
+
+            const char* data = nullptr;
+            if (!frames.empty()) {
+                if (next_frame >= frames.size() ||
+                    frames[next_frame].second != bytes) {
+                    throw server_error(
+                        "Array frame does not match the packet header");
+                }
+                data = frames[next_frame++].first;
+            } else {
+                check_(bytes);
+                data = span.data + span.index;
+                span.index += bytes;
+            }
+            arrays.push_back({(const char*)&xs - packet, data, bytes});
+        } else {
+            int count = 0;
+            (*this) >> count;
+            if (count < 0) {
+                throw server_error("Negative array length in packet");
+            }
+            xs.resize(count);
+            for (auto& x : xs) {
+                (*this) >> x;
+            }
+        }
+    }
+
+  private:
+    void check_(std::size_t bytes) const {
+        if (span.index > size || bytes > size - span.index) {
+            throw server_error("Packet is shorter than its fields");
+        }
+    }
+};
+
+/**
+ * A packet of type `P` that is read straight from the message it was
+ * received in. Its fields are deserialized as usual, but its arrays of
+ * numbers are left empty: `array` returns a view into the message instead.
+ * The view keeps the message alive, and so can the users of its arrays
+ * (see `message`). In a packet sent as a single frame, the arrays are not
+ * necessarily aligned.
+ */
+template <typename P>
+struct packet_view : public P {
+    packet_view() = default;
+
+    /** Read a packet from `message`, which is taken over by the view. */
+    explicit packet_view(multipart_message&& message)
+        : message_(std::make_shared<multipart_message>(std::move(message))) {
+        view_span buffer(*message_, (const char*)(P*)this);
+        auto om = Packet::omembuf<view_span>(buffer);
+        packet_desc dummy;
+        om | dummy;
+        fill(*(P*)this, om);
+        arrays_ = std::move(buffer.arrays);
+    }
+
+    /** The elements of the array `member` of the packet. */
+    template <typename T>
+    array_view<T> array(std::vector<T> P::*member) const {
+        auto offset = (const char*)&(this->*member) - (const char*)(P*)this;
+        for (auto& a : arrays_) {
+            if (a.member == offset) {
+                return {(const T*)a.data, a.bytes / sizeof(T)};
+            }
+        }
+        return {};
+    }
+
+    /** The message the arrays are in. */
+    std::shared_ptr<multipart_message> message() const { return message_; }
+
+  private:
+    std::shared_ptr<multipart_message> message_;
+    std::vector<view_span::array> arrays_;
+};
+
+} // namespace tomop
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "tomop/tomop.hpp"
+
+/**
+ * Round trips of packets through the array codec and the multipart framing,
+ * and checks that malformed frames are rejected rather than read.
+ */
+
+namespace {
+
+void require(bool condition, const char* what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << "\n";
+        std::exit(1);
+    }
+}
+
+template <typename F>
+bool throws(F&& f) {
+    try {
+        f();
+    } catch (tomop::server_error&) {
+        return true;
+    }
+    return false;
+}
+
+std::vector<char> random_bytes(std::size_t n, unsigned seed) {
+    auto gen = std::mt19937(seed);
+    auto bytes = std::vector<char>(n);
+    for (auto& b : bytes) {
+        b = (char)(gen() & 0xff);
+    }
+    return bytes;
+}
+
+zmq::message_t copy_of(const zmq::message_t& frame, std::size_t size) {
+    return zmq::message_t(frame.data(), size);
+}
+
+/** Compress and decompress `bytes`, returns the size of the frame. */
+std::size_t roundtrip(const std::vector<char>& bytes,
+                      std::size_t element_size) {
+    auto frame = tomop::compress_array(bytes.data(), bytes.size(), element_size);
+    auto array = zmq::message_t();
+    require(tomop::decompress_array(frame, array), "decompress valid frame");
+    require(array.size() == bytes.size(), "decompressed size");
+    require(bytes.empty() || memcmp(array.data(), bytes.data(), bytes.size()) == 0,
+            "decompressed bytes");
+    return frame.size();
+}
+
+void test_codec() {
+    using namespace tomop::detail;
+
+    // empty, and smaller than the margin of the LZ codec
+    roundtrip({}, 4);
+    roundtrip({'a', 'b', 'c'}, 1);
+
+    // all zero, over several chunks, compresses by the maximum ratio of the
+    // codec (about 250:1), within the bound that frames are checked against
+    auto zeros = std::vector<char>(4 * compression_chunk + 12, 0);
+    auto size = roundtrip(zeros, 4);
+    require(size < zeros.size() / 200, "zeros compress");
+    require(zeros.size() / size < max_compression_ratio / 2,
+            "zeros well within the maximum compression ratio");
+
+    // incompressible data is stored as is
+    auto noise = random_bytes(compression_chunk + 1000, 1);
+    size = roundtrip(noise, 2);
+    require(size <= noise.size() + 64, "noise is stored");
+
+    // odd element sizes, which do not divide the chunks (or the array)
+    auto ramp = std::vector<char>(3 * compression_chunk / 2 + 7);
+    for (std::size_t i = 0; i < ramp.size(); ++i) {
+        ramp[i] = (char)(i / 3 % 7);
+    }
+    roundtrip(ramp, 3);
+    roundtrip(ramp, 5);
+
+    // 16-bit pixels of a smooth image
+    auto pixels = std::vector<uint16_t>(512 * 512);
+    for (std::size_t i = 0; i < pixels.size(); ++i) {
+        pixels[i] = (uint16_t)(1000 + (i % 512) * 3 + (i / 512));
+    }
+    auto bytes = std::vector<char>((char*)pixels.data(),
+                                   (char*)(pixels.data() + pixels.size()));
+    require(roundtrip(bytes, 2) < bytes.size() / 2, "smooth pixels compress");
+
+    // a stream that does not fit is not written
+    auto out = std::vector<uint8_t>(zeros.size());
+    require(lz_compress((const uint8_t*)noise.data(), noise.size(), out.data(),
+                        noise.size() / 2) == 0,
+            "lz_compress without room");
+
+    // every truncation of a stream is rejected, as are streams that produce
+    // too much, or match before the start of the output
+    auto n = lz_compress((const uint8_t*)ramp.data(), ramp.size(), out.data(),
+                         out.size());
+    require(n > 0, "lz_compress ramp");
+    auto result = std::vector<uint8_t>(ramp.size());
+    require(lz_decompress(out.data(), n, result.data(), result.size()),
+            "lz_decompress ramp");
+    for (std::size_t k = 0; k < n; ++k) {
+        require(!lz_decompress(out.data(), k, result.data(), result.size()),
+                "lz_decompress truncated stream");
+    }
+    require(!lz_decompress(out.data(), n, result.data(), result.size() - 1),
+            "lz_decompress into too small an output");
+    uint8_t bad_offset[] = {0x10, 'x', 0x02, 0x00};
+    require(!lz_decompress(bad_offset, sizeof(bad_offset), result.data(), 8),
+            "lz_decompress offset before the output");
+    uint8_t zero_offset[] = {0x10, 'x', 0x00, 0x00};
+    require(!lz_decompress(zero_offset, sizeof(zero_offset), result.data(), 8),
+            "lz_decompress zero offset");
+
+    // truncated and corrupted frames
+    auto frame = tomop::compress_array(ramp.data(), ramp.size(), 3);
+    auto array = zmq::message_t();
+    for (auto k : {std::size_t{0}, sizeof(compressed_frame_header) - 1,
+                   sizeof(compressed_frame_header) + 3, frame.size() / 2,
+                   frame.size() - 1}) {
+        auto truncated = copy_of(frame, k);
+        require(!tomop::decompress_array(truncated, array),
+                "decompress truncated frame");
+    }
+
+    auto corrupt = [&](auto&& modify) {
+        auto copy = copy_of(frame, frame.size());
+        auto header = compressed_frame_header{};
+        memcpy(&header, copy.data(), sizeof(header));
+        auto sizes = (uint32_t*)((char*)copy.data() + sizeof(header));
+        modify(header, sizes);
+        memcpy(copy.data(), &header, sizeof(header));
+        return tomop::decompress_array(copy, array);
+    };
+    require(!corrupt([](auto& h, auto) { h.chunks += 1; }), "chunk count");
+    require(!corrupt([](auto& h, auto) { h.chunk_bytes = 0; }), "chunk bytes");
+    require(!corrupt([](auto& h, auto) { h.element_size = 0; }),
+            "element size");
+    require(!corrupt([](auto& h, auto) {
+                h.bytes = (uint64_t)1 << 40;
+                h.chunk_bytes = (uint32_t)1 << 31;
+                h.chunks = 512;
+            }),
+            "more than the maximum compression ratio");
+    require(!corrupt([](auto&, auto sizes) {
+                sizes[0] -= 1;
+                sizes[1] += 1;
+            }),
+            "chunk sizes");
+    require(!corrupt([](auto&, auto sizes) { sizes[0] |= stored_chunk; }),
+            "stored chunk of the wrong size");
+
+    // random damage to the compressed data may go unnoticed, but must not
+    // be read or written out of bounds
+    auto gen = std::mt19937(2);
+    auto payload = sizeof(compressed_frame_header) + 2 * sizeof(uint32_t);
+    for (int trial = 0; trial < 200; ++trial) {
+        auto copy = copy_of(frame, frame.size());
+        auto at = payload + gen() % (frame.size() - payload);
+        ((char*)copy.data())[at] ^= (char)(1 + gen() % 255);
+        if (tomop::decompress_array(copy, array)) {
+            require(array.size() == ramp.size(), "size of a damaged frame");
+        }
+    }
+}
+
+void test_framing() {
+    auto context = zmq::context_t(1);
+    auto sender = zmq::socket_t(context, ZMQ_PAIR);
+    auto receiver = zmq::socket_t(context, ZMQ_PAIR);
+    sender.bind("inproc://roundtrip");
+    receiver.connect("inproc://roundtrip");
+
+    auto received = [&] {
+        auto message = tomop::multipart_message();
+        require(message.recv(receiver), "receive");
+        return message;
+    };
+
+    // fields after an array are in the header frame, the array on its own
+    auto slice = std::make_shared<tomop::SliceDataPacket>(
+        1, 2, std::array<int32_t, 2>{3, 2},
+        std::vector<float>{0.5f, 1.0f, 1.5f, 2.0f, 2.5f, 3.0f}, true);
+    for (auto owner : {std::shared_ptr<const void>(), std::shared_ptr<const void>(slice)}) {
+        slice->send(sender, tomop::framing::multipart, owner);
+        auto message = received();
+        require(message.multipart() && message.arrays.size() == 1,
+                "an array frame");
+        require(message.desc() == tomop::packet_desc::slice_data,
+                "multipart descriptor");
+
+        auto result = tomop::SliceDataPacket();
+        result.deserialize(message);
+        require(result.scene_id == 1 && result.slice_id == 2 &&
+                    result.slice_size == slice->slice_size &&
+                    result.data == slice->data && result.additive,
+                "multipart slice");
+    }
+
+    // packets without arrays are a single frame
+    auto scene = tomop::MakeScenePacket("scene", 3);
+    scene.send(sender, tomop::framing::multipart);
+    auto message = received();
+    require(!message.multipart(), "no array frames");
+    auto scene_result = tomop::MakeScenePacket();
+    scene_result.deserialize(message);
+    require(scene_result.name == "scene" && scene_result.dimension == 3,
+            "multipart scene");
+
+    // views of typed pixels, compressed and sent with either framing
+    auto pixels = std::vector<uint8_t>(64 * 48 * 2);
+    for (std::size_t i = 0; i < pixels.size(); ++i) {
+        pixels[i] = (uint8_t)(i % 2 == 0 ? i / 2 % 251 : 3);
+    }
+    auto projection = tomop::TypedProjectionPacket(
+        2, 17, {48, 64}, (int32_t)tomop::dtype::u16, pixels);
+    for (auto c : {tomop::codec::none, tomop::codec::shuffle_lz}) {
+        for (auto f : {tomop::framing::single, tomop::framing::multipart}) {
+            projection.send(sender, f, nullptr, c);
+            auto view =
+                tomop::packet_view<tomop::TypedProjectionPacket>(received());
+            require(view.type == 2 && view.projection_id == 17 &&
+                        view.shape == projection.shape &&
+                        view.dtype == projection.dtype && view.data.empty(),
+                    "view fields");
+            auto data = view.array(&tomop::TypedProjectionPacket::data);
+            require(data.size() == pixels.size() &&
+                        std::equal(data.begin(), data.end(), pixels.begin()),
+                    "view array");
+        }
+    }
+
+    // a damaged compressed frame leaves the packet unreadable
+    projection.send(sender, tomop::framing::multipart, nullptr,
+                    tomop::codec::shuffle_lz);
+    auto header = zmq::message_t();
+    auto frame = zmq::message_t();
+    require(receiver.recv(&header) && receiver.recv(&frame), "raw frames");
+    auto truncated = copy_of(frame, frame.size() - 1);
+    sender.send(header, ZMQ_SNDMORE);
+    sender.send(truncated);
+    message = received();
+    require(((int)message.desc() & tomop::compressed_packet_flag) != 0,
+            "damaged packet keeps its compressed descriptor");
+
+    // array frames that do not match the header
+    slice->send(sender, tomop::framing::multipart);
+    message = received();
+    message.arrays[0] = copy_of(message.arrays[0], message.arrays[0].size() - 4);
+    require(throws([&] { tomop::SliceDataPacket().deserialize(message); }),
+            "header_span: short array frame");
+    require(throws([&] {
+                tomop::packet_view<tomop::SliceDataPacket>(std::move(message));
+            }),
+            "view_span: short array frame");
+
+    slice->send(sender, tomop::framing::multipart);
+    message = received();
+    message.arrays.emplace_back();
+    message.arrays.erase(message.arrays.begin());
+    require(throws([&] { tomop::SliceDataPacket().deserialize(message); }),
+            "header_span: missing array frame");
+
+    // a single frame packet that is shorter than its fields
+    slice->send(sender, tomop::framing::single);
+    message = received();
+    message.header = copy_of(message.header, message.header.size() - 2);
+    require(throws([&] {
+                tomop::packet_view<tomop::SliceDataPacket>(std::move(message));
+            }),
+            "view_span: truncated packet");
+}
+
+} // namespace
+
+int main() {
+    test_codec();
+    test_framing();
+    std::cout << "All round trips passed\n";
+    return 0;
+}
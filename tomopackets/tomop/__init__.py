@@ -1,5 +1,30 @@
+import numpy as np
+
 from py_tomop import *
 
+# the pixel types that can be sent as is, see `tomop::dtype`
+dtypes = {
+    np.dtype(np.uint8): int(dtype.u8),
+    np.dtype(np.uint16): int(dtype.u16),
+    np.dtype(np.uint32): int(dtype.u32),
+    np.dtype(np.float32): int(dtype.f32)
+}
+
+
+def native_projection_packet(kind, idx, image):
+    '''
+    A projection packet with the pixels in their native type (e.g. 16-bit
+    integers straight from the detector), other types are sent as float.
+    '''
+    image = np.ascontiguousarray(image)
+    if image.dtype not in dtypes:
+        image = image.astype(np.float32)
+    rows, cols = image.shape
+    return typed_projection_packet(kind, idx, [rows, cols],
+                                   dtypes[image.dtype],
+                                   image.view(np.uint8).ravel())
+
+
 __all__ = (
   "server",
   "publisher",
@@ -13,6 +38,11 @@ __all__ = (
   "projection_data_packet",
   "partial_projection_data_packet",
   "projection_packet",
+  "typed_projection_packet",
+  "projection_batch_packet",
+  "native_projection_packet",
+  "dtype",
+  "dtypes",
   "set_part_packet",
   "slice_data_packet",
   "partial_slice_data_packet",
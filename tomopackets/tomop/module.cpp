@@ -34,6 +34,10 @@ PYBIND11_MODULE(py_tomop, m) {
         hana::make_tuple("partial_projection_data_packet"s,
                          hana::type_c<PartialProjectionDataPacket>),
         hana::make_tuple("projection_packet"s, hana::type_c<ProjectionPacket>),
+        hana::make_tuple("typed_projection_packet"s,
+                         hana::type_c<TypedProjectionPacket>),
+        hana::make_tuple("projection_batch_packet"s,
+                         hana::type_c<ProjectionBatchPacket>),
         hana::make_tuple("set_part_packet"s, hana::type_c<SetPartPacket>),
         hana::make_tuple("slice_data_packet"s, hana::type_c<SliceDataPacket>),
         hana::make_tuple("partial_slice_data_packet"s,
@@ -97,10 +101,45 @@ PYBIND11_MODULE(py_tomop, m) {
              py::call_guard<py::gil_scoped_release>())
         .def("listen", &tomop::server::listen,
              py::call_guard<py::gil_scoped_release>())
-        .def("send", &tomop::server::send);
+        .def("send", static_cast<void (tomop::server::*)(const tomop::Packet&)>(
+                         &tomop::server::send));
+
+    // socket types of a publisher
+    m.attr("push") = ZMQ_PUSH;
+    m.attr("req") = ZMQ_REQ;
+    m.attr("dealer") = ZMQ_DEALER;
+
+    // the pixel types of typed projections and batches
+    py::enum_<tomop::dtype>(m, "dtype")
+        .value("u8", tomop::dtype::u8)
+        .value("u16", tomop::dtype::u16)
+        .value("u32", tomop::dtype::u32)
+        .value("f32", tomop::dtype::f32);
+
+    py::enum_<tomop::codec>(m, "codec")
+        .value("none", tomop::codec::none)
+        .value("shuffle_lz", tomop::codec::shuffle_lz);
 
     py::class_<tomop::publisher>(m, "publisher")
         .def(py::init<std::string, int32_t>())
         .def(py::init<std::string, int32_t, int32_t>())
-        .def("send", &tomop::publisher::send);
+        .def("send",
+             static_cast<void (tomop::publisher::*)(const tomop::Packet&)>(
+                 &tomop::publisher::send))
+        .def("send_multipart",
+             [](tomop::publisher& p, const tomop::Packet& packet) {
+                 p.send(packet, tomop::framing::multipart);
+             })
+        .def("set_compression", &tomop::publisher::set_compression)
+        .def("set_window", &tomop::publisher::set_window)
+        .def(
+            "flush",
+            [](tomop::publisher& p, int timeout_ms) {
+                return p.flush(std::chrono::milliseconds(timeout_ms));
+            },
+            py::arg("timeout_ms") = -1,
+            py::call_guard<py::gil_scoped_release>())
+        .def("sent", &tomop::publisher::sent)
+        .def("acknowledged", &tomop::publisher::acknowledged)
+        .def("credits", &tomop::publisher::credits);
 }